@@ -0,0 +1,49 @@
+#ifndef ADMIN_H_
+#define ADMIN_H_
+/**
+ * File: admin.c
+ * Local admin control socket
+ *
+ * A Unix stream socket served from the main event loop. Every connection
+ * sends one or more command lines and receives the text replies, e.g.
+ *
+ *     echo sessions | socat - UNIX-CONNECT:/tmp/tictactoe.admin
+ *
+ * One connection is served at a time, without blocking, and dropped if it
+ * is still open two seconds after it was accepted.
+ *
+ * Commands: help, sessions, show <id>, end <id>, stats, top, trace,
+ * latency, loglevel [n], engine [name], slo [us],
+ * throttle [requests [errors]], capacity [n], timeout [seconds]
+ */
+
+#include <poll.h>
+
+#include "list.h"
+
+/**
+ * Listen for admin connections on Unix socket @path
+ * Return the listening socket, or -1 on failure
+ */
+int admin_listen(const char *path);
+
+/**
+ * Accept one admin connection on @listenfd, served by admin_io()
+ */
+void admin_accept(int listenfd);
+
+/**
+ * Set the events of the listening socket @listen and of the connection
+ * @pfd to poll for, @pfd->fd is -1 without a connection. Drops a
+ * connection past its deadline, so call it before every poll
+ */
+void admin_poll(struct pollfd *listen, struct pollfd *pfd);
+
+/**
+ * Read the commands of the admin connection, once complete run them
+ * against the live @sessions and send the replies, as far as that goes
+ * without blocking. Replies to game clients go out on @sockfd
+ */
+void admin_io(int sockfd, struct list_head *sessions);
+
+#endif
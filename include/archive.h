@@ -0,0 +1,140 @@
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+/**
+ * File: archive.c
+ * Columnar archive of finished games
+ *
+ * The archive is a file header followed by a sequence of blocks. Each block
+ * starts with a struct archive_block header that doubles as the block index
+ * entry (game count, time range and outcome totals), followed by one column
+ * per game attribute. Moves are packed 4 bits each into a single 64-bit word,
+ * first move in the lowest nibble, a zero nibble terminates the sequence.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARCHIVE_MAGIC   0x41545454 // "TTTA"
+#define ARCHIVE_VERSION 1
+#define BLOCK_MAGIC     0x304b4c42 // "BLK0"
+#define BLOCK_GAMES     4096       // maximum games per block
+
+// Game outcome, stored in the outcome column
+enum Outcome
+{
+    OUT_UNFINISHED = 0, // session dropped before the game ended
+    OUT_SERVER     = 1, // server (player 1) won
+    OUT_CLIENT     = 2, // client (player 2) won
+    OUT_TIE        = 3,
+};
+
+// Game record flags
+#define REC_RESUMED 0x01 // game was cloned from a RGAME request
+#define REC_V5      0x02 // game was played over protocol v5
+#define REC_COOKIE  0x04 // stateless game, start and moves are partial
+#define REC_PVP     0x08 // player-vs-player game, the client played O
+
+struct archive_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct archive_block
+{
+    uint32_t magic;
+    uint32_t count;      // number of games in this block
+    uint64_t ts_min;     // earliest game start, ms since epoch
+    uint64_t ts_max;     // latest game start, ms since epoch
+    uint32_t outcome[4]; // number of games per enum Outcome
+    uint32_t size;       // size of column data following the header
+    uint32_t reserved;
+};
+
+/**
+ * One finished game, as handed to the archive writer
+ */
+struct game_record
+{
+    uint64_t start;   // game start, ms since epoch
+    uint32_t length;  // game duration in ms
+    uint32_t addr;    // client IPv4 address, network order
+    uint32_t game_id;
+    uint16_t port;    // client port, network order
+    uint8_t outcome;  // enum Outcome
+    uint8_t flags;
+    uint64_t moves;   // packed move sequence
+};
+
+/**
+ * Pointers to each column of a block
+ */
+struct archive_cols
+{
+    const uint64_t *start;
+    const uint64_t *moves;
+    const uint32_t *length;
+    const uint32_t *addr;
+    const uint32_t *game_id;
+    const uint16_t *port;
+    const uint8_t *outcome;
+    const uint8_t *flags;
+};
+
+/**
+ * Size of the column data for a block of @count games, padded to 8 bytes
+ */
+static inline size_t archive_block_size(uint32_t count)
+{
+    size_t sz = count * (2 * sizeof(uint64_t) + 3 * sizeof(uint32_t)
+                         + sizeof(uint16_t) + 2 * sizeof(uint8_t));
+    return (sz + 7) & ~(size_t)7;
+}
+
+/**
+ * Locate the columns of a block with header @blk, columns are laid out in
+ * decreasing width so every column is naturally aligned
+ */
+static inline struct archive_cols archive_columns(const struct archive_block *blk)
+{
+    struct archive_cols c;
+    const char *p = (const char *)(blk + 1);
+    uint32_t n = blk->count;
+
+    c.start = (const uint64_t *)p;   p += n * sizeof(uint64_t);
+    c.moves = (const uint64_t *)p;   p += n * sizeof(uint64_t);
+    c.length = (const uint32_t *)p;  p += n * sizeof(uint32_t);
+    c.addr = (const uint32_t *)p;    p += n * sizeof(uint32_t);
+    c.game_id = (const uint32_t *)p; p += n * sizeof(uint32_t);
+    c.port = (const uint16_t *)p;    p += n * sizeof(uint16_t);
+    c.outcome = (const uint8_t *)p;  p += n * sizeof(uint8_t);
+    c.flags = (const uint8_t *)p;
+
+    return c;
+}
+
+/**
+ * Return the @i th move (1-9) of packed move sequence @moves, 0 if none
+ */
+static inline int archive_move(uint64_t moves, int i)
+{
+    return (int)((moves >> (4 * i)) & 0xf);
+}
+
+/**
+ * Open archive file @path for appending, creating it if it does not exist
+ * Return 0 on success, -1 on failure
+ */
+int archive_open(const char *path);
+
+/**
+ * Buffer a finished game @rec, the block is written out once it is full
+ */
+void archive_append(const struct game_record *rec);
+
+/**
+ * Write out the pending partial block and close the archive
+ */
+void archive_close();
+
+#endif
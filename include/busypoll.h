@@ -0,0 +1,54 @@
+#ifndef BUSYPOLL_H_
+#define BUSYPOLL_H_
+/**
+ * File: busypoll.c
+ * Low-latency event loop mode
+ *
+ * Instead of sleeping in poll(), the event loop pins itself to one core and
+ * spins on nonblocking receives from the game socket, which also busy-polls
+ * the device queue through SO_BUSY_POLL. The other sockets carry no latency
+ * sensitive traffic and are polled without a timeout about once a
+ * millisecond. When there is nothing to receive the loop backs off, from
+ * pause instructions through sched_yield() to short sleeps, so an idle
+ * server gives the core back.
+ */
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BUSY_POLL_US 50 // SO_BUSY_POLL budget of a receive, us
+
+extern int busy_cpu; // core of the busy-poll loop, -1 when sleeping in poll
+
+/**
+ * Pin the calling thread to busy_cpu and make the sockets @fds nonblocking,
+ * with SO_BUSY_POLL on the first. Return 0 on success, -1 on error
+ */
+int busy_init(const int *fds, int nfds);
+
+/**
+ * Stand-in for poll() on @pfds, of which the first is the game socket. The
+ * game socket is always reported readable, an empty receive is the caller's
+ * cue to call busy_idle(); the others are only checked once a millisecond
+ */
+int busy_poll(struct pollfd *pfds, nfds_t nfds);
+
+/**
+ * Back off after a receive found nothing, longer the longer the loop idles.
+ * Does nothing outside busy-poll mode, like busy_active()
+ */
+void busy_idle();
+
+/**
+ * Reset the backoff after a receive returned a datagram
+ */
+void busy_active();
+
+/**
+ * Print the backoff counters to @f
+ */
+void busy_dump(FILE *f);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+/**
+ * File: capture.c
+ * Wire traffic recorder
+ *
+ * Records every datagram received on or sent from the game socket, with its
+ * client address and a microsecond timestamp, for tictactoeReplay. The file
+ * is a header followed by records, each a struct capture_record and the
+ * datagram itself, written through a large stdio buffer so recording costs
+ * a clock read and a copy per datagram. Like the archive, the file is
+ * appended to, so a hot restart continues the capture.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define CAPTURE_MAGIC   0x43545454 // "TTTC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_REPLY   0x8000     // @len flag of a datagram sent by the server
+
+struct capture_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct capture_record
+{
+    uint32_t t_us; // since the previous record, 0 for the first of a process
+    uint32_t addr; // client IPv4 address, network order
+    uint16_t port; // client port, network order
+    uint16_t len;  // datagram length, with CAPTURE_REPLY for replies
+};
+
+/**
+ * Start recording the traffic of game socket @sockfd to @path.
+ * Return 0 on success, -1 on error
+ */
+int capture_open(const char *path, int sockfd);
+
+/**
+ * Record datagram @buf of @len bytes exchanged with @addr over @sockfd, a
+ * reply if @reply. Does nothing unless @sockfd is being recorded
+ */
+void capture_packet(int sockfd, struct sockaddr_in addr, const void *buf,
+                    size_t len, bool reply);
+
+/**
+ * Flush and close the capture file
+ */
+void capture_close();
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef COOKIE_H_
+#define COOKIE_H_
+/**
+ * File: cookie.c
+ * Stateless games with authenticated board cookies
+ *
+ * In the spirit of SYN cookies, a stateless v5 game keeps no server memory
+ * between moves. Every reply carries the board in the 9-byte board field of
+ * the message, packed in base 3 into 2 bytes and followed by a 7-byte
+ * SipHash-2-4 tag over the game ID, the client address and the board. The
+ * client echoes the cookie with its next move and the server rebuilds the
+ * session from it. The tag key is random per server and survives hot
+ * restarts, along with the game ID counter. Replaying an older cookie of
+ * the same game rewinds that game, which is harmless for a game without
+ * stakes.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "network.h"
+
+#define COOKIE_SIZE (NROWS * NCOLS)
+
+extern bool cookie_mode; // serve stateless games on request
+
+/**
+ * Set the tag key to @key and hand out game IDs from @next_id on, or pick a
+ * random key and start the IDs over if @key is NULL
+ */
+void cookie_init(const uint64_t key[2], uint32_t next_id);
+
+/**
+ * Copy the current tag key to @key, for a hot restart
+ * Return the next game ID to hand out under the key
+ */
+uint32_t cookie_key(uint64_t key[2]);
+
+/**
+ * Start stateless session @s of client @addr with a fresh game ID, from
+ * @board in the RGAME encoding or an empty board if @board is NULL
+ */
+void cookie_start(struct session *s, struct sockaddr_in addr,
+                  const char board[NROWS * NCOLS]);
+
+/**
+ * Write the cookie of stateless session @s to @cookie
+ */
+void cookie_make(const struct session *s, char cookie[COOKIE_SIZE]);
+
+/**
+ * Rebuild stateless session @s of game @game_id and client @addr from
+ * @cookie. Return 0 on success, -1 if the cookie does not authenticate
+ */
+int cookie_open(struct session *s, struct sockaddr_in addr, uint32_t game_id,
+                const char cookie[COOKIE_SIZE]);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+/**
+ * File: dispatch.c
+ * Load-adaptive engine selection
+ *
+ * Picks the engine of every server move. Normally that is move_engine, the
+ * configured one. With a latency target set, the dispatcher steps down the
+ * ladder perfect, table, heuristic, random whenever the requests waiting in
+ * the receive queue, each handled at the recent cost of the engine in use,
+ * would take longer than the target, and steps back up one engine at a time
+ * once the engine above would take less than half of it. A step up that
+ * has to be undone soon after makes the next one wait twice as long.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+extern int slo_us; // request latency target, 0 to always play move_engine
+
+/**
+ * Return the engine of the next server move and count the move against it
+ */
+int dispatch_engine();
+
+/**
+ * Account @ns spent handling one request, to the engine of the last move
+ */
+void dispatch_observe(uint64_t ns);
+
+/**
+ * Sample the receive queue of game socket @sockfd and step the engine down
+ * or up, at most once a millisecond. Call it when a datagram is waiting
+ */
+void dispatch_sample(int sockfd);
+
+/**
+ * Print the moves played by each engine and the dispatcher state to @f
+ */
+void dispatch_dump(FILE *f);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef ENGINE_H_
+#define ENGINE_H_
+/**
+ * File: engine.c
+ * Move generation strategies
+ *
+ * Engines only read the board and draw randomness from the caller's
+ * generator, so they are safe to run on any number of threads.
+ */
+
+#include "game.h"
+#include "rng.h"
+
+enum Engine
+{
+    ENGINE_RANDOM,    // uniformly random free square
+    ENGINE_HEURISTIC, // win, block, then center, corner and side
+    ENGINE_PERFECT,   // full game tree search, never loses
+    ENGINE_TABLE,     // lookups in a solved table, perfect without one
+    NENGINES,
+};
+
+/**
+ * Return the engine named @name, or -1 if there is none
+ */
+int engine_by_name(const char *name);
+
+/**
+ * Return the name of engine @e
+ */
+const char *engine_name(enum Engine e);
+
+/**
+ * Map the solved table file @path for the table engine.
+ * Return 0 on success, -1 on error
+ */
+int engine_table_open(const char *path);
+
+/**
+ * Return whether a solved table is mapped for the table engine
+ */
+bool engine_table_loaded();
+
+/**
+ * Generate a move (1-9) for @player on @board with engine @e, drawing
+ * random numbers from @r. Return -1 if there is no free square
+ */
+int engine_move(enum Engine e, int player, const char board[NROWS * NCOLS],
+                struct rng *r);
+
+#endif
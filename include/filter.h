@@ -0,0 +1,46 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+/**
+ * File: filter.c
+ * In-kernel datagram pre-filtering
+ *
+ * A socket filter drops datagrams with a wrong length, version or command
+ * before they are queued to the socket, so junk traffic never wakes up the
+ * event loop. The filter is an eBPF program counting every verdict in an
+ * array map when the kernel lets us load one, a classic BPF program without
+ * counters otherwise.
+ */
+
+#include <stdio.h>
+
+// Sockets with a filter
+enum FilterSocket
+{
+    FILTER_GAME  = 0, // game socket, v4 and v5 requests
+    FILTER_PROBE = 1, // multicast socket, v4 NSERV probes
+    NFILTERS
+};
+
+// Filter verdicts, one counter each
+enum FilterCount
+{
+    FILTER_PASS    = 0,
+    FILTER_LENGTH  = 1, // wrong datagram length for its version
+    FILTER_VERSION = 2, // unknown protocol version
+    FILTER_COMMAND = 3, // unknown or unexpected command
+    NFILTER_COUNTS
+};
+
+/**
+ * Attach the filter for socket kind @which to @sockfd, replacing any filter
+ * already attached. Return 0 on success, -1 if no filter could be attached,
+ * in which case the socket keeps receiving everything
+ */
+int filter_attach(int sockfd, enum FilterSocket which);
+
+/**
+ * Print the filter mode and verdict counters of every socket to @f
+ */
+void filter_dump(FILE *f);
+
+#endif
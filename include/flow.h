@@ -0,0 +1,63 @@
+#ifndef FLOW_H_
+#define FLOW_H_
+/**
+ * File: flow.c
+ * Per-client upstream sockets of the UDP relays
+ *
+ * The impairment proxy and the load balancer relay every client address
+ * from an upstream socket of its own, connected to the server, so that the
+ * server still tells the clients apart. A flow table maps client addresses
+ * to their flows and watches the upstream sockets with epoll, the event
+ * data pointing at the flow. A tool keeps its own state of a client in a
+ * structure with struct flow as first member, opened at its full size.
+ */
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+#define FLOW_BUCKETS 4096 // client address hash table size
+
+struct flow
+{
+    struct sockaddr_in client;
+    int fd;               // upstream socket, connected to the server
+    uint64_t last;        // last datagram either way, on the clock of the tool
+    struct list_head list;
+    struct list_head hash;
+};
+
+struct flow_table
+{
+    int epoll_fd;             // watches the upstream sockets
+    struct list_head flows;   // every open flow
+    struct list_head buckets[FLOW_BUCKETS];
+};
+
+/**
+ * Set up the empty flow table @t, watching upstream sockets with @epoll_fd
+ */
+void flow_init(struct flow_table *t, int epoll_fd);
+
+/**
+ * Return the flow of client @addr in @t, NULL if there is none
+ */
+struct flow *flow_find(struct flow_table *t, struct sockaddr_in addr);
+
+/**
+ * Open a flow of @size bytes, at least a struct flow, for client @addr with
+ * an upstream socket connected to @server, last active at @now
+ * Return the zeroed flow, or NULL if the socket cannot be created
+ */
+struct flow *flow_open(struct flow_table *t, struct sockaddr_in addr,
+                       const struct sockaddr_in *server, size_t size,
+                       uint64_t now);
+
+/**
+ * Close the upstream socket of flow @f and free it
+ */
+void flow_close(struct flow *f);
+
+#endif
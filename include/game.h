@@ -7,6 +7,9 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "rng.h"
 
 #define RESET "0m"
 #define CYAN  "38;5;14m"
@@ -20,6 +23,18 @@
 #define NROWS 3    // number of rows on tictactoe
 #define NCOLS 3    // number of columns on tictactoe
 
+// Verbosity of the game helper output
+enum LogLevel
+{
+    LOG_QUIET = -1, // nothing at all, for benchmarks and simulation
+    LOG_ERROR = 0, // error messages only
+    LOG_INFO  = 1, // information messages, prompts and boards
+};
+
+extern int log_level;
+extern int move_engine; // engine used by gen_move(), see engine.h
+extern uint64_t move_seed; // server seed of the move generators
+
 /**
  * Initialize game @board according to the protocal layouts
  */
@@ -31,9 +46,29 @@ int init_board(char board[NROWS * NCOLS]);
 void print_board(char board[NROWS* NCOLS], FILE *f);
 
 /**
- * Generate a move for server as player 1
+ * Generate a move for server as player 1 with the engine @move_engine,
+ * drawing from the generator @r of the game
+ */
+int gen_move(const char board[NROWS * NCOLS], struct rng *r);
+
+/**
+ * Generate a move for server as player 1 with engine @engine, drawing from
+ * the generator @r of the game
+ */
+int gen_move_with(int engine, const char board[NROWS * NCOLS], struct rng *r);
+
+/**
+ * Set the server seed @move_seed that the generators of all games derive from
+ */
+void seed_moves(uint64_t seed);
+
+/**
+ * Seed the generator @r of game @game_id, started as game @serial, at turn
+ * @turn from @move_seed, so the moves of a game follow from the server seed
+ * and the logged serial and ID. Games that keep their generator seed it once
+ * at turn 0, stateless games have no serial and seed it every turn
  */
-int gen_move(const char board[NROWS * NCOLS]);
+void seed_game(struct rng *r, uint64_t serial, uint32_t game_id, int turn);
 
 /**
  * Make a move on the @board for @player, with @move representing the spot
@@ -0,0 +1,35 @@
+#ifndef HANDLER_H_
+#define HANDLER_H_
+/**
+ * File: handler.c
+ * Request handling of the game socket
+ *
+ * Everything between receiving a datagram and sending the reply, for both
+ * protocol versions, independent of the event loop driving it. The server
+ * loop and the simulation harness share it.
+ */
+
+#include "list.h"
+
+/**
+ * Receive one datagram from @sockfd and handle it against the live
+ * @sessions, sending the reply on @sockfd
+ * Return the rc of the receive call
+ */
+int serve_packet(int sockfd, struct list_head *sessions);
+
+/**
+ * Drop every session of @sessions idle for longer than the session timeout,
+ * telling both players of a player-vs-player game over @sockfd, and the
+ * players idle in the matchmaking queue
+ */
+void expire_sessions(int sockfd, struct list_head *sessions);
+
+/**
+ * End every session of @sessions with a player on the local socket, telling
+ * its players over @sockfd, before a hot restart. Local peers are named by
+ * slots of this process, so their games cannot be handed over
+ */
+void end_local_games(int sockfd, struct list_head *sessions);
+
+#endif
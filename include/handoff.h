@@ -0,0 +1,40 @@
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+/**
+ * File: handoff.c
+ * Hot restart: hand the server sockets and live sessions to a new process
+ *
+ * The running server listens on a Unix stream socket. A new server started
+ * with the same path connects to it and receives the game and multicast
+ * sockets over SCM_RIGHTS, followed by every live session. Datagrams that
+ * arrive during the switch stay queued on the shared sockets, so none are
+ * lost. The new process acknowledges the transfer once it adopted every
+ * session and the old one answers when it stops serving, so a rejected or
+ * broken transfer leaves the old process serving.
+ */
+
+#include "list.h"
+
+/**
+ * Listen for hot restart requests on Unix socket @path
+ * Return the listening socket, or -1 on failure
+ */
+int handoff_listen(const char *path);
+
+/**
+ * Accept a hot restart request on @listenfd and hand @sockfd, @mcfd and
+ * every session in @sessions over to the new process
+ * Return the number of sessions handed over, or -1 on failure
+ */
+int handoff_send(int listenfd, const char *path, int sockfd, int mcfd,
+                 struct list_head *sessions);
+
+/**
+ * Take over from the server listening on Unix socket @path, set @sockfd and
+ * @mcfd to the inherited sockets and add the inherited sessions to @sessions
+ * Return the number of sessions taken over, or -1 on failure
+ */
+int handoff_receive(const char *path, int *sockfd, int *mcfd,
+                    struct list_head *sessions);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HASH_H_
+#define HASH_H_
+/**
+ * File: hash.h
+ * Integer hash shared by the server and the tools
+ */
+
+#include <stdint.h>
+
+/**
+ * murmur3 64-bit finalizer of @h, every bit of which flips about half of
+ * the result
+ */
+static inline uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef HEAVY_H_
+#define HEAVY_H_
+/**
+ * File: heavy.c
+ * Heavy hitters among the source addresses of the game socket
+ *
+ * Every datagram received, and every request answered with a client error
+ * (EINVMOVE, EGIDWRONG, EINVREQ), is counted against its source address in
+ * a count-min sketch of fixed size, which never undercounts a source and
+ * overcounts it only by colliding traffic. The sources with the highest
+ * estimates are kept in a min-heap of HEAVY_TOPK entries that an update
+ * only has to look at once a source outgrows the smallest of them. Counts
+ * are per window of about a second; the heaviest sources of the last full
+ * window are kept for reporting. With a limit set, sources above it are
+ * throttled for the rest of the window.
+ */
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HEAVY_TOPK 16 // sources reported for requests and for errors
+
+extern int throttle_requests; // datagrams per source and second, 0 no limit
+extern int throttle_errors;   // client errors per source and second, 0 no limit
+
+/**
+ * Count a datagram from @addr. Return whether the source is over a limit
+ * in this window and the datagram should be dropped
+ */
+bool heavy_request(struct sockaddr_in addr);
+
+/**
+ * Count a request from @addr answered with a client error
+ */
+void heavy_error(struct sockaddr_in addr);
+
+/**
+ * End the window if it is a second old: keep its heaviest sources and rates
+ * and clear the sketches. Call it about once a second
+ */
+void heavy_roll();
+
+/**
+ * Print the heaviest sources of the last full window and of the current
+ * one, with the limits, to @f
+ */
+void heavy_dump(FILE *f);
+
+#endif
@@ -48,6 +48,14 @@ static inline void list_add(struct list_head *new, struct list_head *head)
     __list_add(new, head, head->next);
 }
 
+/**
+ * Insert a @new entry before the specified @head, at the end of a queue
+ */
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+    __list_add(new, head->prev, head);
+}
+
 /**
  * Delete a list entry by setting prev/next entries point to each other
  */
@@ -67,6 +75,14 @@ static inline void list_del(struct list_head *entry)
     entry->prev = NULL;
 }
 
+/**
+ * Test whether the list @head is empty
+ */
+static inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
 /**
  * Iterate over a list
  */
@@ -86,6 +102,12 @@ static inline void list_del(struct list_head *entry)
 #define list_entry(ptr, type, member) \
     container_of(ptr, type, member)
 
+/**
+ * Get the first entry of a list that is not empty
+ */
+#define list_first_entry(head, type, member) \
+    list_entry((head)->next, type, member)
+
 /**
  * Iterate over a list with each entry structure
  */
@@ -94,4 +116,14 @@ static inline void list_del(struct list_head *entry)
          &pos-> member != (head);                                       \
          pos = list_entry(pos->member.next, typeof(*pos), member))
 
+/**
+ * Iterate over a list with each entry structure, safe against removal of
+ * the current entry, @n holds the next entry
+ */
+#define list_for_each_entry_safe(pos, n, head, member)                  \
+    for (pos = list_entry((head)->next, typeof(*pos), member),          \
+             n = list_entry(pos->member.next, typeof(*pos), member);    \
+         &pos->member != (head);                                        \
+         pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
 #endif
@@ -0,0 +1,65 @@
+#ifndef LOCAL_H_
+#define LOCAL_H_
+/**
+ * File: local.c
+ * Unix domain datagram transport for clients on the same host
+ *
+ * Gateways next to the server can send the same v4 and v5 datagrams to a
+ * SOCK_DGRAM socket bound to a path instead of going through UDP/IP. The
+ * game code only knows sockaddr_in, so every local peer, named by the path
+ * or abstract name its socket is bound to, gets a slot in a peer table and
+ * is handed to the game code as a synthetic address: family AF_UNIX, the
+ * slot number plus one as the IPv4 address and a generation as the port.
+ * A slot is reused for a new peer once its old one has been idle for the
+ * session timeout, with the next generation, so replies to games of the old
+ * peer never reach the new one. Peers that did not bind their socket cannot
+ * be answered and are dropped.
+ */
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define MAX_LOCAL_PEERS 4096 // local peers known at once
+
+extern int local_sockfd;     // the local game socket, -1 if there is none
+extern int local_udp_sockfd; // UDP game socket, for UDP players of local games
+
+/**
+ * Create the local game socket bound to Unix socket @path, sharing the
+ * game code with the UDP game socket @inet_sockfd
+ * Return the socket, or -1 on failure
+ */
+int local_listen(const char *path, int inet_sockfd);
+
+/**
+ * Close the local game socket and remove its path. The peers are kept, a
+ * socket opened again tells new peers apart from those of live sessions
+ */
+void local_close();
+
+/**
+ * Return whether @addr is the synthetic address of a local peer
+ */
+static inline bool local_addr(struct sockaddr_in addr)
+{
+    return addr.sin_family == AF_UNIX;
+}
+
+/**
+ * Read a datagram of at most @len bytes from the local socket @sockfd into
+ * @buf and set @addr to the synthetic address of its sender
+ * Return the length of the datagram, -1 on failure or if the sender cannot
+ * be answered
+ */
+ssize_t local_recv(int sockfd, void *buf, size_t len,
+                   struct sockaddr_in *addr, socklen_t *addr_len);
+
+/**
+ * Send @len bytes of @buf to the local peer of synthetic address @addr
+ * Return the rc of send, -1 if the peer is gone
+ */
+ssize_t local_send(const void *buf, size_t len, struct sockaddr_in addr);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef MATCH_H_
+#define MATCH_H_
+/**
+ * File: match.c
+ * Matchmaking queue of player-vs-player games
+ *
+ * In player-vs-player mode a v4 NGAME does not start a game against the
+ * server but queues the client until another one asks, and the two play
+ * each other with the server relaying and arbitrating the moves. The queue
+ * is a FIFO, so pairing takes the longest waiting player in O(1); waiting
+ * players are also hashed by address, so a repeated NGAME keeps its place
+ * instead of queueing twice. Waiting players hold no game ID, only a pair
+ * that starts a game does.
+ */
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MAX_WAITING (1 << 16) // players waiting for an opponent
+
+extern bool pvp_mode; // v4 NGAME requests are paired with each other
+
+/**
+ * Queue client @addr for an opponent, or pair it with the longest waiting
+ * player. Return 1 with that player in @opponent, taken off the queue, 0 if
+ * @addr is waiting now or was already, -1 if the queue is full
+ */
+int match_join(struct sockaddr_in addr, struct sockaddr_in *opponent);
+
+/**
+ * Queue @addr, not waiting yet, at the head of the queue if @first, as for
+ * a player taken off by a pairing that could not start a game, or at the
+ * tail otherwise. Return 0, or -1 if the queue is full for the tail
+ */
+int match_wait(struct sockaddr_in addr, bool first);
+
+/**
+ * Drop waiting players not heard from for longer than the session timeout
+ */
+void match_expire();
+
+/**
+ * Drop every waiting player
+ */
+void match_clear();
+
+/**
+ * Print the queue length and matchmaking counters to @f
+ */
+void match_dump(FILE *f);
+
+#endif
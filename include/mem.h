@@ -0,0 +1,61 @@
+#ifndef MEM_H_
+#define MEM_H_
+/**
+ * File: mem.c
+ * Allocation accounting by subsystem
+ *
+ * Every allocation of the server goes through these wrappers, which count
+ * allocations, frees and live bytes of a pool, with the high-water marks of
+ * both. Bytes are the usable size malloc hands out, slack included, so the
+ * session pool divided by live sessions is what a game really costs in
+ * heap. Mapped memory, such as a solved table, is accounted separately.
+ * The counters are not atomic: pools must not be allocated from more than
+ * one thread.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum MemPool
+{
+    MEM_SESSIONS, // game sessions
+    MEM_MATCH,    // players waiting for an opponent
+    MEM_LOGGING,  // log stream buffers
+    MEM_IO,       // capture and other I/O buffers
+    MEM_ENGINE,   // solved tables
+    NMEMPOOLS
+};
+
+/**
+ * Allocate @size bytes for @pool, NULL if out of memory
+ */
+void *mem_alloc(enum MemPool pool, size_t size);
+
+/**
+ * Allocate @n zeroed elements of @size bytes for @pool, NULL if out of
+ * memory
+ */
+void *mem_calloc(enum MemPool pool, size_t n, size_t size);
+
+/**
+ * Free @ptr, allocated for @pool, NULL is ignored
+ */
+void mem_free(enum MemPool pool, void *ptr);
+
+/**
+ * Account @bytes mapped for @pool, negative when unmapped
+ */
+void mem_map(enum MemPool pool, long bytes);
+
+/**
+ * Return the allocations made so far, of all pools
+ */
+uint64_t mem_allocs();
+
+/**
+ * Print the counters of every pool that was used to @f
+ */
+void mem_dump(FILE *f);
+
+#endif
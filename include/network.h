@@ -6,6 +6,7 @@
  */
 
 #include <netinet/in.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
 
@@ -20,13 +21,50 @@ extern const int VERSION;
 extern const int BUFSZ;
 extern const int TIMEOUT;
 
+#define MAX_ID 256 // maximum game ID
+
+#define VERSION_V5   5         // protocol v5, 32-bit game IDs and batching
+#define MAX_BATCH    64        // maximum game messages in a v5 datagram
+#define MAX_V5_GAMES (1 << 20) // maximum concurrent v5 games
+#define MAX_V5_ID    (1 << 30) // v5 game IDs from here on are stateless
+
+extern int session_timeout; // idle seconds before a session is dropped
+extern uint64_t games_started; // sessions started, the serial of the last
+
+/*
+ * Datagram I/O and clocks of the game code, the kernel by default. The
+ * simulation harness swaps in an in-memory network and a virtual clock.
+ */
+struct net_ops
+{
+    ssize_t (*recv)(int sockfd, void *buf, size_t len,
+                    struct sockaddr_in *addr, socklen_t *addr_len);
+    ssize_t (*send)(int sockfd, const void *buf, size_t len,
+                    struct sockaddr_in addr);
+    uint64_t (*now_ms)(); // wall clock, ms since epoch
+    uint64_t (*mono_ms)(); // monotonic clock for timeouts, ms
+};
+
+extern const struct net_ops *net_ops;
+
 struct session
 {
     int game_id;               // unique identifer for each game
     struct sockaddr_in client; // client's socket address
     char board[NROWS * NCOLS]; // game board
     int turn;                  // current turn number
+    uint64_t start;            // game start time, ms since epoch
+    uint64_t moves;            // move sequence, 4 bits per move
+    int nmoves;                // number of moves recorded in @moves
+    uint8_t flags;             // game record flags, see archive.h
+    uint64_t last_active;      // mono_ms() of the last client message
+    struct sockaddr_in peer;   // player 1 of a player-vs-player game
+    uint64_t serial;           // order the game started in, 0 if stateless or busy
+    struct rng rng;            // generator of the server moves
     struct list_head list;
+    struct list_head hash;     // game ID hash chain
+    struct list_head addr_hash; // v4 client address hash chain
+    struct list_head peer_hash; // player 1 address hash chain
 };
 
 struct message
@@ -40,6 +78,38 @@ struct message
     char board[NROWS * NCOLS];  // board for a resume game request
 };
 
+// shortest acceptable v4 message, up to the game ID
+#define MIN_MESSAGE offsetof(struct message, board)
+
+/*
+ * Protocol v5 datagram: a header followed by @count game messages. Several
+ * games, even of the same client address, can share one datagram.
+ */
+struct header_v5
+{
+    uint8_t version; // VERSION_V5
+    uint8_t count;   // number of game messages, at most MAX_BATCH
+} __attribute__((packed));
+
+// Protocol v5 game message, multi-byte fields in network order
+struct message_v5
+{
+    uint8_t cmd;      // connection command code
+    uint8_t resp;     // response code
+    uint8_t move;     // the number of the square moving to
+    uint8_t flags;    // message flags, MSG_*
+    uint16_t turn;    // sequence number representing the turn
+    uint32_t game;    // unique identifer for game
+    char board[NROWS * NCOLS]; // board for a resume game request
+} __attribute__((packed));
+
+// Protocol v5 message flags
+#define MSG_COOKIE 0x01 // stateless game, @board carries the game cookie
+
+// largest datagram of either protocol version
+#define MAX_PACKET \
+    (sizeof(struct header_v5) + MAX_BATCH * sizeof(struct message_v5))
+
 // Connection Command codes
 enum Cmd
 {
@@ -65,11 +135,10 @@ enum Code
 };
 
 /**
- * Create the socket based on cmd args and return the socket file descriptor
- * Set @player_no according to the cmd arg
+ * Create the server socket bound to @port and return the socket file descriptor
  * Exit the program if there's error, not recoverable
  */
-int init_socket(int argc, char *argv[]);
+int init_socket(const char *port);
 
 /**
  * Create the multicast socket
@@ -78,17 +147,71 @@ int init_socket(int argc, char *argv[]);
 int init_mc_sock();
 
 /**
- * Initialize the session struct @s to current available game id and
- * proper sockaddr and game board
+ * Parse multicast group @spec of the form "group[:port]" into @addr, using
+ * @port when @spec has none
+ * Return 0 on success, -1 if @spec is not a valid multicast group
+ */
+int mc_group_addr(const char *spec, int port, struct sockaddr_in *addr);
+
+/**
+ * Initialize the session struct @s to current available game id of protocol
+ * @version and proper sockaddr and game board, return the game ID or -1
+ */
+int init_session(struct session *s, struct sockaddr_in addr, int version);
+
+/**
+ * Set the board of session @s from @board in the RGAME encoding, 0 for a
+ * free square, 1 for X and 2 for O. Set the turn and return the number of
+ * squares taken
  */
-int init_session(struct session *s, struct sockaddr_in addr);
+int load_board(struct session *s, const char board[NROWS * NCOLS]);
 
 /**
- * Clone a session from a resume game request based on @msg,
- * return the game number
+ * Clone a session of protocol @version from the @board of a resume game
+ * request, return the game number or -1
  */
 int clone_session(struct session *s, struct sockaddr_in addr,
-                  struct message msg);
+                  const char board[NROWS * NCOLS], int version);
+
+/**
+ * Find the live session of game @game_id, NULL if there is none
+ */
+struct session *lookup_game(uint32_t game_id);
+
+/**
+ * Find the live v4 session client @addr plays in, as the client or the
+ * peer, NULL if there is none
+ */
+struct session *lookup_client(struct sockaddr_in addr);
+
+/**
+ * Make @peer player 1 of v4 session @s, a player-vs-player game with the
+ * client as player 2
+ */
+void add_peer(struct session *s, struct sockaddr_in peer);
+
+/**
+ * Reserve the game ID of session @s handed over from another process
+ * Return the game ID, or -1 if the ID is already in use
+ */
+int adopt_session(struct session *s);
+
+/**
+ * Limit the number of concurrent games to @n, at most MAX_ID
+ * Games already running keep their IDs. Return 0 on success, -1 otherwise
+ */
+int set_capacity(int n);
+
+/**
+ * Return the current limit of concurrent games
+ */
+int get_capacity();
+
+/**
+ * Count the end of the game in session @s with @winner from checkwin(),
+ * 0 if the game did not finish, and append it to the game archive
+ */
+void finish_game(const struct session *s, int winner);
 
 /**
  * Release game ID and memory of session @s
@@ -100,6 +223,22 @@ void free_session(struct session *s);
  */
 int sendmsg_to(int sockfd, struct sockaddr_in addr, struct message msg);
 
+/**
+ * Send the raw datagram @buf of @len bytes to @addr, return the rc of send
+ */
+int send_packet(int sockfd, struct sockaddr_in addr, const void *buf, size_t len);
+
+/**
+ * Read a raw datagram of at most @size bytes into @buf, return the rc of recv
+ */
+int recv_packet(int sockfd, struct sockaddr_in *addr, socklen_t *len,
+                void *buf, size_t size);
+
+/**
+ * Log the content of v4 message @msg
+ */
+void log_message(const struct message *msg);
+
 /**
  * Read a message from socket, set the @msg body and return the rc of recv call
  */
@@ -107,13 +246,41 @@ int recvmsg_from(
     int sockfd, struct sockaddr_in *addr, socklen_t *len, struct message *msg);
 
 /**
- * Send a move command with possible response code to @addr
+ * Send a move command with possible response code to the client of @sess
  */
 int send_move(int sockfd, const struct session *sess, int move, int resp);
 
+/**
+ * Send a move command of game @sess with possible response code to @addr,
+ * either player of a player-vs-player game
+ */
+int send_move_to(int sockfd, const struct session *sess,
+                 struct sockaddr_in addr, int move, int resp);
+
+/**
+ * Append @move to the recorded move sequence of session @s
+ */
+void record_move(struct session *s, int move);
+
+/**
+ * Return the wall clock time in milliseconds since epoch, from @net_ops
+ */
+uint64_t time_ms();
+
+/**
+ * Return the monotonic clock in milliseconds, from @net_ops. Timeouts are
+ * measured with it, so a step of the wall clock does not end every game
+ */
+uint64_t mono_ms();
+
 /**
  * Compare if two socket address is the same
  */
 bool equal_addr(struct sockaddr_in lhs, struct sockaddr_in rhs);
 
+/**
+ * Hash socket address @addr into one of 2^@bits buckets
+ */
+unsigned int addr_bucket(struct sockaddr_in addr, int bits);
+
 #endif
@@ -0,0 +1,63 @@
+#ifndef RNG_H_
+#define RNG_H_
+/**
+ * File: rng.h
+ * Small fast PRNG (xoshiro128**) with explicit state, so every thread or
+ * game can own its generator instead of sharing rand()
+ */
+
+#include <stdint.h>
+
+struct rng
+{
+    uint32_t s[4];
+};
+
+/**
+ * Seed generator @r from a 64-bit @seed, expanded with splitmix64
+ */
+static inline void rng_seed(struct rng *r, uint64_t seed)
+{
+    for (int i = 0; i < 4; i += 2) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        r->s[i] = (uint32_t)z;
+        r->s[i + 1] = (uint32_t)(z >> 32);
+    }
+}
+
+static inline uint32_t rng_rotl(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+/**
+ * Return the next 32 random bits of @r
+ */
+static inline uint32_t rng_next(struct rng *r)
+{
+    uint32_t *s = r->s;
+    uint32_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 11);
+
+    return result;
+}
+
+/**
+ * Return a random number in [0, @n) without modulo bias worth caring about
+ */
+static inline uint32_t rng_below(struct rng *r, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)rng_next(r) * n) >> 32);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SPECTATOR_H_
+#define SPECTATOR_H_
+/**
+ * File: spectator.c
+ * Multicast spectator feed of live games
+ *
+ * Every move is published as a compact board-delta record. Records are
+ * coalesced during an event loop iteration and flushed as few datagrams as
+ * possible, so the cost does not depend on the number of spectators.
+ */
+
+#include <stdint.h>
+
+#include "network.h"
+
+#define SPECTATOR_PORT    (MC_PORT + 1)
+#define SPECTATOR_VERSION 1
+#define SPECTATOR_MTU     1400 // maximum datagram payload
+
+struct spectator_header
+{
+    uint8_t version;
+    uint8_t count; // number of records following the header
+    uint16_t seq;  // datagram sequence number, network order
+} __attribute__((packed));
+
+struct spectator_record
+{
+    uint32_t game;   // game ID, network order
+    uint16_t turn;   // turn number after the move, network order
+    uint8_t move;    // player in the high nibble, square in the low nibble
+    int8_t outcome;  // checkwin() result after the move
+} __attribute__((packed));
+
+/**
+ * Publish the feed to multicast group @spec, "group[:port]"
+ * Return 0 on success, -1 on failure
+ */
+int spectator_open(const char *spec);
+
+/**
+ * Queue the @move of @player in session @s with the resulting @winner
+ */
+void spectator_publish(const struct session *s, int player, int move,
+                       int winner);
+
+/**
+ * Send the records queued during this event loop iteration
+ */
+void spectator_flush();
+
+/**
+ * Flush pending records and close the feed
+ */
+void spectator_close();
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef STATS_H_
+#define STATS_H_
+/**
+ * File: stats.c
+ * Server counters, dumped through the admin socket and on shutdown
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct stats
+{
+    uint64_t rx_packets;   // datagrams received
+    uint64_t tx_packets;   // datagrams sent
+    uint64_t rx_errors;    // failed receive calls
+    uint64_t tx_errors;    // failed send calls
+    uint64_t games_new;    // games started by NGAME
+    uint64_t games_resumed; // games cloned from RGAME
+    uint64_t games_stateless; // games started with a cookie, of the above
+    uint64_t server_wins;
+    uint64_t client_wins;
+    uint64_t ties;
+    uint64_t expired;      // sessions dropped after the idle timeout
+    uint64_t aborted;      // sessions ended from the admin socket
+    uint64_t busy;         // NGAME rejected with EBUSYGAME
+    uint64_t invalid_moves; // moves answered with EINVMOVE
+    uint64_t wrong_game;   // moves answered with EGIDWRONG
+    uint64_t out_of_sync;  // v5 moves answered with EOSYNC
+    uint64_t bad_cookies;  // cookie moves with an invalid tag
+    uint64_t probes;       // NSERV probes answered
+    uint64_t rejected;     // malformed datagrams that passed the filter
+    uint64_t throttled;    // datagrams dropped from sources over a limit
+};
+
+extern struct stats stats;
+
+/**
+ * Print every counter of @stats to @f, one "name value" pair per line
+ */
+void stats_dump(FILE *f);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TABLE_H_
+#define TABLE_H_
+/**
+ * File: table.c
+ * Solved-position tables for n x n boards, n-in-a-row wins
+ *
+ * A table holds the game value of every legal position, for the player to
+ * move, in 2 bits. Of the up to eight boards equal under rotation and
+ * reflection only the canonical one is solved and looked up: the one with
+ * the smallest mask of X squares, then of O squares. Positions are numbered
+ * by rank: boards with the same number of X and O marks form consecutive
+ * blocks, and inside a block a board is ranked by its set of X squares
+ * among the canonical ones and then by the combination of its O squares
+ * among the rest. That leaves out the boards no game can reach by mark
+ * count and most of those that are not canonical, 1.34M of the 43M boards
+ * of 4x4 in 334 KB.
+ *
+ * A table file is mapped read-only and never read up front, so opening is
+ * instant and only the pages of positions actually looked up are resident.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+#define TABLE_MAX_N 4 // 5x5 has over 10^11 positions
+
+// Game value for the player to move
+enum Value
+{
+    VAL_NONE = 0, // unreachable, or not canonical
+    VAL_WIN  = 1,
+    VAL_LOSS = 2,
+    VAL_DRAW = 3,
+};
+
+struct table
+{
+    int n;                 // board side
+    uint64_t npos;         // positions, by rank
+    const uint8_t *values; // 2 bits per position
+    void *map;             // file mapping, NULL for a table in memory
+    size_t map_len;
+};
+
+/**
+ * Solve the n x n game into @t, a table in memory.
+ * Return the number of canonical positions solved, -1 on error
+ */
+int64_t table_solve(struct table *t, int n);
+
+/**
+ * Write table @t to file @path. Return 0 on success, -1 on error
+ */
+int table_write(const struct table *t, const char *path);
+
+/**
+ * Map the table file @path into @t. Return 0 on success, -1 on error
+ */
+int table_open(struct table *t, const char *path);
+
+/**
+ * Unmap or free table @t
+ */
+void table_close(struct table *t);
+
+/**
+ * Return the value of @cells for the player to move, from table @t. Cells
+ * are 0 free, 1 X and 2 O, row by row
+ */
+enum Value table_value(const struct table *t, const uint8_t *cells);
+
+/**
+ * Return the square (from 0) of a best move of @player on @cells, drawing
+ * random numbers from @r to break ties. Return -1 if there is no free
+ * square or @cells is not a position of @player to move
+ */
+int table_move(const struct table *t, const uint8_t *cells, int player,
+               struct rng *r);
+
+#endif
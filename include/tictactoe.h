@@ -0,0 +1,61 @@
+#ifndef TICTACTOE_H_
+#define TICTACTOE_H_
+/**
+ * File: tictactoe.c
+ * Game core of libtictactoe
+ *
+ * The rules on a board of the protocol layout, '1' to '9' for a free square
+ * and 'X' or 'O' for a taken one, with no I/O and no global state, so they
+ * can be embedded anywhere and called from any thread. The batch functions
+ * apply the same rules to an array of boards in one call, and evaluating
+ * boards is vectorized across the array.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TTT_CELLS 9 // squares on a board
+
+/**
+ * Set @board to the starting position
+ */
+void ttt_init(char board[TTT_CELLS]);
+
+/**
+ * Mark square @move (1-9) of @board for @player (1 is X, 2 is O).
+ * Return whether the square was free, the board is unchanged otherwise
+ */
+bool ttt_play(int player, int move, char board[TTT_CELLS]);
+
+/**
+ * Return the state of @board: 1 or 2 if that player has a line, -1 for a
+ * tie, 0 if the game goes on. Lines of both players, which no game
+ * reaches, count for player 1
+ */
+int ttt_winner(const char board[TTT_CELLS]);
+
+/**
+ * Return ttt_winner() of @board, and on a win turn the marks of the first
+ * line in lower case to highlight it
+ */
+int ttt_checkwin(char board[TTT_CELLS]);
+
+/**
+ * Set all @n @boards to the starting position
+ */
+void ttt_init_batch(char (*boards)[TTT_CELLS], size_t n);
+
+/**
+ * Advance each of @n @boards by one move of @player, square @moves[i] on
+ * board i, where 0 leaves that board alone. Return the number of moves
+ * made, a taken or out of range square is not
+ */
+size_t ttt_play_batch(char (*boards)[TTT_CELLS], int player, const int *moves,
+                      size_t n);
+
+/**
+ * Store ttt_winner() of each of @n @boards in @winners
+ */
+void ttt_winner_batch(const char (*boards)[TTT_CELLS], int *winners, size_t n);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+/**
+ * File: trace.c
+ * Per-request stage tracing
+ *
+ * Every stage boundary is a USDT probe (provider "tictactoe", probes
+ * "<stage>_begin" and "<stage>_end", argument 0 is the game ID or -1). A
+ * disabled probe is a single nop, so perf/bpftrace can attach to a production
+ * binary without rebuilding, e.g.
+ *
+ *     bpftrace -e 'usdt:./tictactoeServer:tictactoe:engine_begin { ... }'
+ *
+ * The optional built-in sampler (-T) additionally records the duration of
+ * every stage into log2 histograms, printed when the server stops.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, arg) DTRACE_PROBE1(tictactoe, name, arg)
+#endif
+#endif
+
+#if !defined(TRACE_PROBE) && (defined(__x86_64__) || defined(__aarch64__))
+/*
+ * Minimal SystemTap SDT v3 note, the same layout <sys/sdt.h> emits, for
+ * build hosts without the systemtap headers
+ */
+#define TRACE_PROBE(name, arg)                                          \
+    __asm__ __volatile__(                                               \
+        "990: nop\n"                                                    \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                   \
+        ".balign 4\n"                                                   \
+        ".4byte 992f-991f, 994f-993f, 3\n"                              \
+        "991: .asciz \"stapsdt\"\n"                                     \
+        "992: .balign 4\n"                                              \
+        "993: .8byte 990b\n"                                            \
+        ".8byte _.stapsdt.base\n"                                       \
+        ".8byte 0\n"                                                    \
+        ".asciz \"tictactoe\"\n"                                        \
+        ".asciz \"" #name "\"\n"                                        \
+        ".asciz \"-8@%[a0]\"\n"                                         \
+        "994: .balign 4\n"                                              \
+        ".popsection\n"                                                 \
+        ".ifndef _.stapsdt.base\n"                                      \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\","               \
+        ".stapsdt.base,comdat\n"                                        \
+        ".weak _.stapsdt.base\n"                                        \
+        ".hidden _.stapsdt.base\n"                                      \
+        "_.stapsdt.base: .space 1\n"                                    \
+        ".size _.stapsdt.base, 1\n"                                     \
+        ".popsection\n"                                                 \
+        ".endif\n"                                                      \
+        :: [a0] "nor" ((long)(arg)))
+#endif
+
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(name, arg) ((void)(arg))
+#endif
+
+// Request handling stages
+enum Stage
+{
+    STAGE_recv,   // recvmsg_from() syscall
+    STAGE_lookup, // session lookup
+    STAGE_play,   // play_move() and checkwin()
+    STAGE_engine, // gen_move()
+    STAGE_log,    // print_board() and message logging
+    STAGE_send,   // sendmsg_to() syscall
+    NSTAGES,
+};
+
+extern bool trace_sampling;
+
+/**
+ * Record the start time of @stage for the sampler
+ */
+void trace_sample_begin(enum Stage stage);
+
+/**
+ * Record the duration of @stage into its histogram
+ */
+void trace_sample_end(enum Stage stage);
+
+/**
+ * Print the per-stage histograms to @f
+ */
+void trace_report(FILE *f);
+
+/**
+ * Mark the beginning of @stage for game @game
+ */
+#define TRACE_BEGIN(stage, game)                    \
+    do {                                            \
+        TRACE_PROBE(stage##_begin, game);           \
+        if (__builtin_expect(trace_sampling, 0))    \
+            trace_sample_begin(STAGE_##stage);      \
+    } while (0)
+
+/**
+ * Mark the end of @stage for game @game
+ */
+#define TRACE_END(stage, game)                      \
+    do {                                            \
+        if (__builtin_expect(trace_sampling, 0))    \
+            trace_sample_end(STAGE_##stage);        \
+        TRACE_PROBE(stage##_end, game);             \
+    } while (0)
+
+#endif
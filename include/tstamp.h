@@ -0,0 +1,75 @@
+#ifndef TSTAMP_H_
+#define TSTAMP_H_
+/**
+ * File: tstamp.c
+ * Kernel timestamps of the game socket
+ *
+ * The request stages of trace.c start when recvmsg returns, so time a
+ * datagram spends queued on the socket, waiting for poll() to wake up or
+ * for a log write to finish, is invisible to them. With kernel timestamps
+ * on, every request carries the time the kernel received it as ancillary
+ * data, and the server records how long it took from there until the
+ * datagram was read, and until the reply was handed to sendto. With
+ * SO_TIMESTAMPING the kernel also stamps replies on their way to the
+ * device, reported back through the error queue by a per-socket counter,
+ * which covers the whole path through the server. Only the first datagram
+ * sent after a request counts as its reply.
+ */
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Timestamping socket options
+enum TstampMode
+{
+    TSTAMP_OFF,
+    TSTAMP_NS,     // SO_TIMESTAMPNS, receive only
+    TSTAMP_ALL,    // SO_TIMESTAMPING, software receive and transmit
+};
+
+extern int tstamp_sockfd; // socket with timestamps on, -1 if there is none
+
+/**
+ * Return the mode of option name @name, "timestampns" or "timestamping",
+ * TSTAMP_OFF if there is no such mode
+ */
+enum TstampMode tstamp_mode(const char *name);
+
+/**
+ * Turn on timestamps of @mode on @sockfd, replacing the settings of a
+ * previous owner of the socket. Return 0 on success, -1 otherwise
+ */
+int tstamp_enable(int sockfd, enum TstampMode mode);
+
+/**
+ * Read a datagram of at most @len bytes into @buf, like recvfrom, and
+ * remember its receive timestamp for the reply
+ */
+ssize_t tstamp_recv(int sockfd, void *buf, size_t len,
+                    struct sockaddr_in *addr, socklen_t *addr_len);
+
+/**
+ * Count a datagram sent on the socket, the reply of the last request if
+ * it has none yet
+ */
+void tstamp_sent();
+
+/**
+ * End the request being served: read the transmit timestamps the kernel
+ * queued so far and forget the receive timestamp
+ */
+void tstamp_reap();
+
+/**
+ * Read the transmit timestamps behind a POLLERR of the socket, which arrived
+ * after the request they answer was done
+ */
+void tstamp_error();
+
+/**
+ * Print the latency histograms and counters to @f
+ */
+void tstamp_dump(FILE *f);
+
+#endif
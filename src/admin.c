@@ -0,0 +1,332 @@
+#define _GNU_SOURCE // accept4
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "admin.h"
+#include "network.h"
+#include "archive.h"
+#include "engine.h"
+#include "stats.h"
+#include "match.h"
+#include "dispatch.h"
+#include "heavy.h"
+#include "mem.h"
+#include "filter.h"
+#include "busypoll.h"
+#include "trace.h"
+#include "tstamp.h"
+#include "game.h"
+
+#define CMD_MAX 512          // maximum size of the commands of one connection
+#define OUT_MAX (256 * 1024) // maximum size of the replies of one connection
+#define CONN_TIMEOUT 2000    // time a connection may stay open, ms
+#define SESSIONS_SHOWN 1000  // games listed by sessions, the rest are counted
+
+// the one admin connection being served, fd -1 if none
+static struct
+{
+    int fd;
+    uint64_t deadline; // mono_ms() the connection is dropped at
+    char in[CMD_MAX + 1];
+    size_t in_len;
+    char *out;         // replies, NULL until the commands ran
+    size_t out_len;
+    size_t out_sent;
+} conn = { .fd = -1 };
+
+int admin_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errmsg("Admin socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        errmsg("Unable to create admin socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(fd, 4) < 0) {
+        errmsg("Unable to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    infomsg("Admin socket listening on %s\n", path);
+    return fd;
+}
+
+static void list_sessions(FILE *out, struct list_head *sessions)
+{
+    uint64_t now = time_ms(), mono = mono_ms();
+    int count = 0;
+    struct session *sess;
+
+    fprintf(out, "%10s  %-21s %4s %8s %8s\n", "game", "client", "turn",
+            "age s", "idle s");
+    list_for_each_entry(sess, sessions, list) {
+        if (++count > SESSIONS_SHOWN) {
+            continue;
+        }
+        char addr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &sess->client.sin_addr, addr, sizeof(addr));
+        fprintf(out, "%10d  %-15s:%-5u %4d %8llu %8llu\n", sess->game_id, addr,
+                ntohs(sess->client.sin_port), sess->turn,
+                (unsigned long long)(now - sess->start) / 1000,
+                (unsigned long long)(mono - sess->last_active) / 1000);
+    }
+    if (count > SESSIONS_SHOWN) {
+        fprintf(out, "... %d more\n", count - SESSIONS_SHOWN);
+    }
+    fprintf(out, "%d sessions, capacity %d\n", count, get_capacity());
+}
+
+static void show_session(FILE *out, const struct session *sess)
+{
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &sess->client.sin_addr, addr, sizeof(addr));
+
+    fprintf(out, "game %d, client %s:%u, turn %d%s%s\n", sess->game_id, addr,
+            ntohs(sess->client.sin_port), sess->turn,
+            (sess->flags & REC_RESUMED) ? ", resumed" : "",
+            (sess->flags & REC_V5) ? ", v5" : "");
+    if (sess->flags & REC_PVP) {
+        inet_ntop(AF_INET, &sess->peer.sin_addr, addr, sizeof(addr));
+        fprintf(out, "peer %s:%u plays X\n", addr, ntohs(sess->peer.sin_port));
+    }
+    for (int r = 0; r < NROWS; ++r) {
+        fprintf(out, " %c | %c | %c\n", sess->board[r * NCOLS],
+                sess->board[r * NCOLS + 1], sess->board[r * NCOLS + 2]);
+    }
+    fprintf(out, "moves");
+    for (int i = 0; i < sess->nmoves; ++i) {
+        fprintf(out, " %d", (int)((sess->moves >> (4 * i)) & 0xf));
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * Run command line @line and write the reply to @out
+ */
+static void run_command(FILE *out, char *line, int sockfd,
+                        struct list_head *sessions)
+{
+    char *cmd = strtok(line, " \t\r\n");
+    char *arg = strtok(NULL, " \t\r\n");
+
+    if (!cmd) {
+        return;
+    } else if (strcmp(cmd, "help") == 0) {
+        fprintf(out, "sessions | show <id> | end <id> | stats | top | trace | "
+                "latency | "
+                "loglevel [n] | engine [name] | slo [us] | "
+                "throttle [requests [errors]] | capacity [n] | "
+                "timeout [seconds]\n");
+    } else if (strcmp(cmd, "sessions") == 0) {
+        list_sessions(out, sessions);
+    } else if (strcmp(cmd, "show") == 0 || strcmp(cmd, "end") == 0) {
+        struct session *sess = arg ? lookup_game(strtoul(arg, NULL, 10)) : NULL;
+        if (!sess) {
+            fprintf(out, "error: no such game\n");
+        } else if (cmd[0] == 's') {
+            show_session(out, sess);
+        } else {
+            // tell the client the game is over, then drop the session
+            send_move(sockfd, sess, 0, GAMEOVR);
+            if (sess->flags & REC_PVP)
+                send_move_to(sockfd, sess, sess->peer, 0, GAMEOVR);
+            finish_game(sess, 0);
+            list_del(&sess->list);
+            free_session(sess);
+            stats.aborted++;
+            fprintf(out, "ok\n");
+        }
+    } else if (strcmp(cmd, "stats") == 0) {
+        stats_dump(out);
+        match_dump(out);
+        dispatch_dump(out);
+        filter_dump(out);
+        busy_dump(out);
+        mem_dump(out);
+    } else if (strcmp(cmd, "top") == 0) {
+        heavy_dump(out);
+    } else if (strcmp(cmd, "throttle") == 0) {
+        char *errs = arg ? strtok(NULL, " \t\r\n") : NULL;
+        if ((arg && atoi(arg) < 0) || (errs && atoi(errs) < 0)) {
+            fprintf(out, "error: limits must be 0 (off) or positive\n");
+        } else {
+            if (arg)
+                throttle_requests = atoi(arg);
+            if (errs)
+                throttle_errors = atoi(errs);
+            fprintf(out, "throttle %d requests/s, %d errors/s\n",
+                    throttle_requests, throttle_errors);
+        }
+    } else if (strcmp(cmd, "trace") == 0) {
+        if (trace_sampling)
+            trace_report(out);
+        else
+            fprintf(out, "error: sampler disabled, start with -T\n");
+    } else if (strcmp(cmd, "latency") == 0) {
+        if (tstamp_sockfd >= 0)
+            tstamp_dump(out);
+        else
+            fprintf(out, "error: kernel timestamps off, start with -K\n");
+    } else if (strcmp(cmd, "loglevel") == 0) {
+        if (arg) {
+            log_level = atoi(arg);
+        }
+        fprintf(out, "loglevel %d\n", log_level);
+    } else if (strcmp(cmd, "engine") == 0) {
+        int e = arg ? engine_by_name(arg) : move_engine;
+        if (e < 0) {
+            fprintf(out, "error: unknown engine\n");
+        } else {
+            move_engine = e;
+            fprintf(out, "engine %s\n", engine_name(move_engine));
+        }
+    } else if (strcmp(cmd, "slo") == 0) {
+        if (arg && atoi(arg) < 0) {
+            fprintf(out, "error: slo must be 0 (off) or positive\n");
+        } else {
+            if (arg)
+                slo_us = atoi(arg);
+            fprintf(out, "slo %d us\n", slo_us);
+        }
+    } else if (strcmp(cmd, "capacity") == 0) {
+        if (arg && set_capacity(atoi(arg)) < 0) {
+            fprintf(out, "error: capacity must be 1 to %d\n", MAX_ID);
+        } else {
+            fprintf(out, "capacity %d\n", get_capacity());
+        }
+    } else if (strcmp(cmd, "timeout") == 0) {
+        if (arg && atoi(arg) <= 0) {
+            fprintf(out, "error: timeout must be positive\n");
+        } else {
+            if (arg)
+                session_timeout = atoi(arg);
+            fprintf(out, "timeout %d\n", session_timeout);
+        }
+    } else {
+        fprintf(out, "error: unknown command %s, try help\n", cmd);
+    }
+}
+
+/**
+ * Drop the open admin connection and its reply
+ */
+static void close_conn()
+{
+    close(conn.fd);
+    conn.fd = -1;
+    mem_free(MEM_IO, conn.out);
+    conn.out = NULL;
+}
+
+/**
+ * Run the commands read so far and buffer their replies to be sent
+ */
+static void run_commands(int sockfd, struct list_head *sessions)
+{
+    conn.in[conn.in_len] = '\0';
+    conn.out = mem_alloc(MEM_IO, OUT_MAX);
+    conn.out_len = conn.out_sent = 0;
+    FILE *out = conn.out ? fmemopen(conn.out, OUT_MAX, "w") : NULL;
+    if (!out) {
+        close_conn();
+        return;
+    }
+
+    char *save, *line = strtok_r(conn.in, "\n", &save);
+    while (line) {
+        run_command(out, line, sockfd, sessions);
+        line = strtok_r(NULL, "\n", &save);
+    }
+
+    // a reply longer than the buffer is cut short
+    fflush(out);
+    long len = ftell(out);
+    conn.out_len = (len < 0) ? 0 : (len > OUT_MAX) ? OUT_MAX : len;
+    fclose(out);
+}
+
+void admin_accept(int listenfd)
+{
+    int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        errmsg("Unable to accept admin connection: %s\n", strerror(errno));
+        return;
+    }
+
+    conn.fd = fd;
+    conn.deadline = mono_ms() + CONN_TIMEOUT;
+    conn.in_len = 0;
+}
+
+void admin_poll(struct pollfd *listen, struct pollfd *pfd)
+{
+    if (conn.fd >= 0 && mono_ms() >= conn.deadline) {
+        errmsg("Admin connection timed out, dropped\n");
+        close_conn();
+    }
+
+    // one connection at a time, the next waits in the backlog
+    listen->events = (conn.fd < 0) ? POLLIN : 0;
+    pfd->fd = conn.fd;
+    pfd->events = conn.out ? POLLOUT : POLLIN;
+}
+
+void admin_io(int sockfd, struct list_head *sessions)
+{
+    if (conn.fd < 0) {
+        return;
+    }
+
+    if (!conn.out) {
+        ssize_t rc = read(conn.fd, conn.in + conn.in_len, CMD_MAX - conn.in_len);
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else if (rc < 0) {
+            close_conn();
+            return;
+        }
+        conn.in_len += rc;
+
+        // commands run once a read ends a line, or on end of file
+        if (rc > 0 && conn.in_len < CMD_MAX && conn.in[conn.in_len - 1] != '\n') {
+            return;
+        }
+        run_commands(sockfd, sessions);
+        if (!conn.out) {
+            return;
+        }
+    }
+
+    while (conn.out_sent < conn.out_len) {
+        ssize_t rc = send(conn.fd, conn.out + conn.out_sent,
+                          conn.out_len - conn.out_sent, MSG_NOSIGNAL);
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else if (rc < 0) {
+            break;
+        }
+        conn.out_sent += rc;
+    }
+    close_conn();
+}
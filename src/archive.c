@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "archive.h"
+#include "game.h"
+
+static FILE *archive_file = NULL;
+
+// columns of the block being filled
+static uint32_t pending = 0;
+static uint64_t col_start[BLOCK_GAMES];
+static uint64_t col_moves[BLOCK_GAMES];
+static uint32_t col_length[BLOCK_GAMES];
+static uint32_t col_addr[BLOCK_GAMES];
+static uint32_t col_game_id[BLOCK_GAMES];
+static uint16_t col_port[BLOCK_GAMES];
+static uint8_t col_outcome[BLOCK_GAMES];
+static uint8_t col_flags[BLOCK_GAMES];
+
+int archive_open(const char *path)
+{
+    archive_file = fopen(path, "ab");
+    if (!archive_file) {
+        errmsg("Unable to open archive %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (ftell(archive_file) == 0) {
+        struct archive_header hdr = { ARCHIVE_MAGIC, ARCHIVE_VERSION };
+        if (fwrite(&hdr, sizeof(hdr), 1, archive_file) != 1) {
+            errmsg("Unable to write archive header: %s\n", strerror(errno));
+            fclose(archive_file);
+            archive_file = NULL;
+            return -1;
+        }
+    }
+
+    infomsg("Archiving finished games to %s\n", path);
+    return 0;
+}
+
+/**
+ * Write the pending block out to the archive file
+ */
+static void archive_flush()
+{
+    if (!archive_file || pending == 0) {
+        return;
+    }
+
+    struct archive_block blk;
+    memset(&blk, 0, sizeof(blk));
+    blk.magic = BLOCK_MAGIC;
+    blk.count = pending;
+    blk.ts_min = UINT64_MAX;
+    blk.size = archive_block_size(pending);
+
+    for (uint32_t i = 0; i < pending; ++i) {
+        if (col_start[i] < blk.ts_min)
+            blk.ts_min = col_start[i];
+        if (col_start[i] > blk.ts_max)
+            blk.ts_max = col_start[i];
+        blk.outcome[col_outcome[i] & 3]++;
+    }
+
+    fwrite(&blk, sizeof(blk), 1, archive_file);
+    fwrite(col_start, sizeof(*col_start), pending, archive_file);
+    fwrite(col_moves, sizeof(*col_moves), pending, archive_file);
+    fwrite(col_length, sizeof(*col_length), pending, archive_file);
+    fwrite(col_addr, sizeof(*col_addr), pending, archive_file);
+    fwrite(col_game_id, sizeof(*col_game_id), pending, archive_file);
+    fwrite(col_port, sizeof(*col_port), pending, archive_file);
+    fwrite(col_outcome, sizeof(*col_outcome), pending, archive_file);
+    fwrite(col_flags, sizeof(*col_flags), pending, archive_file);
+
+    // pad the block to keep the next header aligned
+    static const char zeros[8];
+    size_t used = pending * (2 * sizeof(uint64_t) + 3 * sizeof(uint32_t)
+                             + sizeof(uint16_t) + 2 * sizeof(uint8_t));
+    fwrite(zeros, 1, blk.size - used, archive_file);
+
+    if (fflush(archive_file) != 0) {
+        errmsg("Unable to write archive block: %s\n", strerror(errno));
+    }
+
+    pending = 0;
+}
+
+void archive_append(const struct game_record *rec)
+{
+    if (!archive_file) {
+        return;
+    }
+
+    col_start[pending] = rec->start;
+    col_moves[pending] = rec->moves;
+    col_length[pending] = rec->length;
+    col_addr[pending] = rec->addr;
+    col_game_id[pending] = rec->game_id;
+    col_port[pending] = rec->port;
+    col_outcome[pending] = rec->outcome;
+    col_flags[pending] = rec->flags;
+
+    if (++pending == BLOCK_GAMES) {
+        archive_flush();
+    }
+}
+
+void archive_close()
+{
+    if (!archive_file) {
+        return;
+    }
+
+    archive_flush();
+    fclose(archive_file);
+    archive_file = NULL;
+    infomsg("Game archive closed\n");
+}
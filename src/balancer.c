@@ -0,0 +1,577 @@
+/**
+ * File: balancer.c
+ * UDP front end spreading clients over several tictactoe servers
+ *
+ * Clients talk to one public port. Every client address is placed on a
+ * consistent hash ring of the healthy backends, each backend owning many
+ * virtual nodes, and relayed to its owner from an upstream socket of its
+ * own, so the server still tells clients apart by address. A client keeps
+ * its upstream socket, and so its backend, for as long as it plays; when a
+ * backend joins or leaves, only the share of the ring it gains or loses
+ * changes hands, and only for clients without a live flow.
+ *
+ * Backends are probed with the v4 NSERV request that servers answer with
+ * SPOTAVAIL. A backend missing enough probes in a row leaves the ring and
+ * its clients are cut loose, to be placed again with their next datagram;
+ * it joins again with the next answer.
+ *
+ * Datagrams from clients are read in batches with recvmmsg, replies are
+ * gathered from all upstream sockets ready in an epoll round and written
+ * back in batches with sendmmsg.
+ */
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "network.h"
+#include "flow.h"
+#include "hash.h"
+#include "list.h"
+
+#define PROTO_VERSION 4
+#define MAX_BACKENDS  64
+#define MAX_VNODES    1024     // virtual nodes per backend
+#define BATCH         64       // datagrams per recvmmsg and sendmmsg
+#define MAX_EVENTS    64
+#define SAMPLES       4096     // ring positions compared on a rebuild
+
+struct backend
+{
+    struct sockaddr_in addr;
+    char name[INET_ADDRSTRLEN + 6];
+    bool up;
+    bool probed;    // a probe is out without an answer
+    int misses;     // probes in a row without an answer
+    uint64_t flows; // clients placed on it
+    uint64_t relayed[2]; // datagrams to clients, to the backend
+    uint64_t changes;    // times it went up or down
+};
+
+// Client and the backend it was placed on, flow.last in ms
+struct client
+{
+    struct flow flow;
+    int backend;
+};
+
+// Virtual node of a backend on the ring
+struct point
+{
+    uint32_t pos;
+    int backend;
+};
+
+static struct
+{
+    int vnodes;
+    int interval_ms; // between health probes
+    int failures;    // missed probes before a backend leaves
+    int idle_s;      // a silent client is forgotten after this
+} cfg = { 160, 500, 3, 60 }; // idle as long as the server keeps a game
+
+static struct
+{
+    uint64_t relayed[2];
+    uint64_t unrouted;    // datagrams dropped with no backend up
+    uint64_t flows, cut;  // flows opened, and closed by a backend leaving
+    uint64_t syscalls[2]; // recvmmsg from and sendmmsg to clients
+    uint64_t rebuilds;
+} st;
+
+static volatile sig_atomic_t quit = 0;
+
+static int listen_fd, health_fd, epoll_fd;
+static struct backend backends[MAX_BACKENDS];
+static int nbackends;
+
+static struct point ring[MAX_BACKENDS * MAX_VNODES];
+static int npoints;
+
+static struct flow_table flows;
+
+// replies to clients gathered for the next sendmmsg
+static struct mmsghdr out_msgs[BATCH];
+static struct iovec out_iov[BATCH];
+static char out_buf[BATCH][MAX_PACKET];
+static int nout;
+
+static void quit_handler(int signo)
+{
+    quit = 1;
+}
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Ring position of virtual node @vnode of @addr, unkeyed so that balancers
+ * of the same backends place clients alike
+ */
+static inline uint32_t ring_pos(struct sockaddr_in addr, int vnode)
+{
+    uint64_t key = (uint64_t)addr.sin_addr.s_addr << 32
+        | (uint64_t)addr.sin_port << 16 | (uint64_t)vnode;
+    return hash_mix(key) >> 32;
+}
+
+/* ring */
+
+/**
+ * Return the backend owning ring position @pos, -1 if the ring is empty
+ */
+static int owner(uint32_t pos)
+{
+    if (npoints == 0)
+        return -1;
+
+    // first point at or after @pos, wrapping around
+    int lo = 0, hi = npoints;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].pos < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ring[lo == npoints ? 0 : lo].backend;
+}
+
+static int by_pos(const void *a, const void *b)
+{
+    const struct point *x = a, *y = b;
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+/**
+ * Place the virtual nodes of the backends that are up, and report the
+ * share of the ring each owns and how much of it changed hands
+ */
+static void rebuild_ring()
+{
+    static int before[SAMPLES];
+    const uint32_t step = UINT32_MAX / SAMPLES;
+    for (int i = 0; i < SAMPLES; ++i)
+        before[i] = owner(i * step);
+
+    npoints = 0;
+    for (int b = 0; b < nbackends; ++b) {
+        if (!backends[b].up)
+            continue;
+        for (int v = 0; v < cfg.vnodes; ++v) {
+            ring[npoints].pos = ring_pos(backends[b].addr, v);
+            ring[npoints].backend = b;
+            npoints++;
+        }
+    }
+    qsort(ring, npoints, sizeof(ring[0]), by_pos);
+    st.rebuilds++;
+
+    int moved = 0;
+    int share[MAX_BACKENDS] = { 0 };
+    for (int i = 0; i < SAMPLES; ++i) {
+        int b = owner(i * step);
+        moved += (b != before[i]);
+        if (b >= 0)
+            share[b]++;
+    }
+
+    printf("ring          %d points, %.1f%% moved, shares", npoints,
+           100.0 * moved / SAMPLES);
+    for (int b = 0; b < nbackends; ++b) {
+        if (backends[b].up)
+            printf(" %s %.1f%%", backends[b].name, 100.0 * share[b] / SAMPLES);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/* clients */
+
+static struct client *open_client(struct sockaddr_in addr, uint64_t now)
+{
+    int b = owner(ring_pos(addr, 0));
+    if (b < 0) {
+        st.unrouted++;
+        return NULL;
+    }
+
+    struct flow *f = flow_open(&flows, addr, &backends[b].addr,
+                               sizeof(struct client), now);
+    if (!f)
+        return NULL;
+
+    struct client *c = list_entry(f, struct client, flow);
+    c->backend = b;
+    backends[b].flows++;
+    st.flows++;
+    return c;
+}
+
+/* relaying */
+
+static void flush_replies()
+{
+    int sent = 0;
+    while (sent < nout) {
+        int rc = sendmmsg(listen_fd, out_msgs + sent, nout - sent, 0);
+        st.syscalls[0]++;
+        if (rc < 0) {
+            // a full socket buffer drops the rest, like the network would
+            break;
+        }
+        sent += rc;
+    }
+    st.relayed[0] += sent;
+    nout = 0;
+}
+
+/**
+ * Queue the reply waiting on the upstream socket of @c. Servers answer
+ * every request with one datagram, so one is read per wakeup; epoll keeps
+ * reporting the socket while there are more, which saves the empty read
+ */
+static void from_backend(struct client *c, uint64_t now)
+{
+    if (nout == BATCH)
+        flush_replies();
+
+    ssize_t len = recv(c->flow.fd, out_buf[nout], MAX_PACKET, MSG_DONTWAIT);
+    if (len < 0)
+        return;
+
+    out_iov[nout].iov_base = out_buf[nout];
+    out_iov[nout].iov_len = len;
+    memset(&out_msgs[nout], 0, sizeof(out_msgs[nout]));
+    out_msgs[nout].msg_hdr.msg_name = &c->flow.client;
+    out_msgs[nout].msg_hdr.msg_namelen = sizeof(c->flow.client);
+    out_msgs[nout].msg_hdr.msg_iov = &out_iov[nout];
+    out_msgs[nout].msg_hdr.msg_iovlen = 1;
+    nout++;
+
+    c->flow.last = now;
+    backends[c->backend].relayed[0]++;
+}
+
+static void from_clients(uint64_t now)
+{
+    static struct mmsghdr msgs[BATCH];
+    static struct iovec iov[BATCH];
+    static struct sockaddr_in addrs[BATCH];
+    static char bufs[BATCH][MAX_PACKET];
+
+    for (;;) {
+        for (int i = 0; i < BATCH; ++i) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = MAX_PACKET;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = recvmmsg(listen_fd, msgs, BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            return;
+        st.syscalls[1]++;
+
+        for (int i = 0; i < n; ++i) {
+            struct flow *f = flow_find(&flows, addrs[i]);
+            struct client *c = f ? list_entry(f, struct client, flow)
+                                 : open_client(addrs[i], now);
+            if (!c)
+                continue;
+
+            c->flow.last = now;
+            if (send(c->flow.fd, bufs[i], msgs[i].msg_len, 0) >= 0) {
+                st.relayed[1]++;
+                backends[c->backend].relayed[1]++;
+            }
+        }
+        if (n < BATCH)
+            return;
+    }
+}
+
+/* health */
+
+static void set_health(int b, bool up)
+{
+    struct backend *be = &backends[b];
+    be->up = up;
+    be->changes++;
+    printf("backend       %s %s\n", be->name, up ? "up" : "down");
+
+    if (!up) {
+        // its games are gone, the clients start over on another backend
+        struct client *c, *next;
+        list_for_each_entry_safe(c, next, &flows.flows, flow.list) {
+            if (c->backend == b) {
+                flow_close(&c->flow);
+                st.cut++;
+            }
+        }
+    }
+    rebuild_ring();
+}
+
+static void probe_backends()
+{
+    struct message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.version = PROTO_VERSION;
+    msg.cmd = NSERV;
+
+    for (int b = 0; b < nbackends; ++b) {
+        struct backend *be = &backends[b];
+        if (be->probed && ++be->misses >= cfg.failures && be->up)
+            set_health(b, false);
+
+        be->probed = true;
+        sendto(health_fd, &msg, sizeof(msg), 0, (struct sockaddr *)&be->addr,
+               sizeof(be->addr));
+    }
+}
+
+static void from_probes()
+{
+    struct message msg;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    ssize_t len;
+
+    while ((len = recvfrom(health_fd, &msg, sizeof(msg), MSG_DONTWAIT,
+                           (struct sockaddr *)&addr, &addr_len)) >= 0) {
+        addr_len = sizeof(addr);
+        if (len < (ssize_t)MIN_MESSAGE || msg.resp != SPOTAVAIL)
+            continue;
+
+        for (int b = 0; b < nbackends; ++b) {
+            struct backend *be = &backends[b];
+            if (be->addr.sin_addr.s_addr != addr.sin_addr.s_addr
+                || be->addr.sin_port != addr.sin_port)
+                continue;
+            be->probed = false;
+            be->misses = 0;
+            if (!be->up)
+                set_health(b, true);
+        }
+    }
+}
+
+static void forget_idle(uint64_t now)
+{
+    struct flow *f, *next;
+    list_for_each_entry_safe(f, next, &flows.flows, list) {
+        if (now - f->last > cfg.idle_s * 1000ULL)
+            flow_close(f);
+    }
+}
+
+static void report(double secs)
+{
+    printf("duration      %.2f s, %llu clients, %llu cut by a backend leaving\n",
+           secs, (unsigned long long)st.flows, (unsigned long long)st.cut);
+    printf("to backends   %llu relayed, %llu unrouted, %.1f per recvmmsg\n",
+           (unsigned long long)st.relayed[1],
+           (unsigned long long)st.unrouted,
+           st.syscalls[1] ? (double)(st.relayed[1] + st.unrouted)
+               / st.syscalls[1] : 0.0);
+    printf("to clients    %llu relayed, %.1f per sendmmsg\n",
+           (unsigned long long)st.relayed[0],
+           st.syscalls[0] ? (double)st.relayed[0] / st.syscalls[0] : 0.0);
+    for (int b = 0; b < nbackends; ++b) {
+        const struct backend *be = &backends[b];
+        printf("%-21s %-4s %llu clients, %llu up, %llu down, "
+               "%llu health changes\n", be->name, be->up ? "up" : "down",
+               (unsigned long long)be->flows,
+               (unsigned long long)be->relayed[1],
+               (unsigned long long)be->relayed[0],
+               (unsigned long long)be->changes);
+    }
+}
+
+/**
+ * Resolve backend @spec of the form "host:port" into @be
+ * Return 0 on success, -1 otherwise
+ */
+static int parse_backend(const char *spec, struct backend *be)
+{
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= sizeof(host))
+        return -1;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int status = getaddrinfo(host, colon + 1, &hints, &res);
+    if (status != 0) {
+        fprintf(stderr, "Unable to resolve %s: %s\n", spec,
+                gai_strerror(status));
+        return -1;
+    }
+    memcpy(&be->addr, res->ai_addr, sizeof(be->addr));
+    freeaddrinfo(res);
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &be->addr.sin_addr, ip, sizeof(ip));
+    snprintf(be->name, sizeof(be->name), "%s:%u", ip,
+             ntohs(be->addr.sin_port));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "f:i:t:v:")) != -1) {
+        switch (opt) {
+        case 'f':
+            cfg.failures = atoi(optarg);
+            break;
+        case 'i':
+            cfg.interval_ms = atoi(optarg);
+            break;
+        case 't':
+            cfg.idle_s = atoi(optarg);
+            break;
+        case 'v':
+            cfg.vnodes = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    nbackends = argc - optind - 1;
+    if (nbackends < 1 || nbackends > MAX_BACKENDS || cfg.failures < 1
+        || cfg.interval_ms < 1 || cfg.idle_s < 1
+        || cfg.vnodes < 1 || cfg.vnodes > MAX_VNODES) {
+    usage:
+        fprintf(stderr, "Usage: %s [-f failures] [-i interval-ms] "
+                "[-t idle-s] [-v vnodes] <port> <host:port>...\n", argv[0]);
+        exit(1);
+    }
+    for (int b = 0; b < nbackends; ++b) {
+        if (parse_backend(argv[optind + 1 + b], &backends[b]) < 0)
+            goto usage;
+    }
+
+    // every client address holds a socket, allow as many as we may
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(argv[optind]));
+
+    listen_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Unable to bind port %s: %s\n", argv[optind],
+                strerror(errno));
+        exit(1);
+    }
+
+    health_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (health_fd < 0) {
+        fprintf(stderr, "Unable to create probe socket: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    epoll_fd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        fprintf(stderr, "Unable to create epoll instance: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+    ev.data.ptr = &health_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, health_fd, &ev) < 0) {
+        fprintf(stderr, "Unable to watch probe socket: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    flow_init(&flows, epoll_fd);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = quit_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // backends join the ring with their first answer
+    uint64_t start = now_ms();
+    uint64_t last_probe = start;
+    probe_backends();
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!quit) {
+        uint64_t now = now_ms();
+        int wait = (int)(last_probe + cfg.interval_ms - now);
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, wait > 0 ? wait : 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        now = now_ms();
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &health_fd) {
+                from_probes();
+            } else if (events[i].data.ptr) {
+                from_backend(list_entry((struct flow *)events[i].data.ptr,
+                                        struct client, flow), now);
+            } else {
+                from_clients(now);
+            }
+        }
+        if (nout > 0)
+            flush_replies();
+
+        if (now - last_probe >= (uint64_t)cfg.interval_ms) {
+            probe_backends();
+            forget_idle(now);
+            last_probe = now;
+        }
+    }
+
+    report((now_ms() - start) / 1e3);
+
+    struct flow *f, *next;
+    list_for_each_entry_safe(f, next, &flows.flows, list) {
+        flow_close(f);
+    }
+    close(epoll_fd);
+    close(health_fd);
+    close(listen_fd);
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE // sched_setaffinity
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "busypoll.h"
+#include "game.h"
+
+#define SPIN_ROUNDS  4096  // empty receives before yielding the core
+#define YIELD_ROUNDS 1024  // yields before sleeping
+#define MAX_SLEEP_US 50    // longest idle sleep, bounds the wakeup delay
+#define CHECK_NS     1000000 // other sockets are polled this often
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+int busy_cpu = -1;
+
+static unsigned int idle_rounds;
+static unsigned int sleep_us;
+static uint64_t last_check;
+
+static struct
+{
+    uint64_t spins;
+    uint64_t yields;
+    uint64_t sleeps;
+} busy;
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int busy_init(const int *fds, int nfds)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(busy_cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        errmsg("Unable to pin to CPU %d: %s\n", busy_cpu, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < nfds; ++i) {
+        // FIONBIO rather than fcntl(), whose header clashes with tee()
+        int on = 1;
+        if (ioctl(fds[i], FIONBIO, &on) < 0) {
+            errmsg("Unable to make socket nonblocking: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    // raising the budget above net.core.busy_read takes CAP_NET_ADMIN
+    int usec = BUSY_POLL_US;
+    if (setsockopt(fds[0], SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        errmsg("SO_BUSY_POLL unavailable, spinning without it: %s\n",
+               strerror(errno));
+    }
+
+    infomsg("Busy polling on CPU %d\n", busy_cpu);
+    return 0;
+}
+
+int busy_poll(struct pollfd *pfds, nfds_t nfds)
+{
+    pfds[0].revents = POLLIN;
+    for (nfds_t i = 1; i < nfds; ++i) {
+        pfds[i].revents = 0;
+    }
+
+    uint64_t now = now_ns();
+    if (now - last_check < CHECK_NS) {
+        return 1;
+    }
+    last_check = now;
+
+    int rc = poll(pfds + 1, nfds - 1, 0);
+    return rc < 0 ? rc : rc + 1;
+}
+
+void busy_idle()
+{
+    if (busy_cpu < 0) {
+        return;
+    }
+
+    if (idle_rounds < SPIN_ROUNDS) {
+        // pause a little longer every 512 empty rounds
+        for (unsigned int i = 0; i < 1u << (idle_rounds >> 9); ++i) {
+            cpu_relax();
+        }
+        busy.spins++;
+    } else if (idle_rounds < SPIN_ROUNDS + YIELD_ROUNDS) {
+        sched_yield();
+        busy.yields++;
+    } else {
+        struct timespec ts = { 0, sleep_us * 1000 };
+        nanosleep(&ts, NULL);
+        if (sleep_us < MAX_SLEEP_US) {
+            sleep_us = sleep_us ? 2 * sleep_us : 1;
+            if (sleep_us > MAX_SLEEP_US)
+                sleep_us = MAX_SLEEP_US;
+        }
+        busy.sleeps++;
+    }
+    idle_rounds++;
+}
+
+void busy_active()
+{
+    idle_rounds = 0;
+    sleep_us = 0;
+}
+
+void busy_dump(FILE *f)
+{
+    if (busy_cpu < 0) {
+        return;
+    }
+    fprintf(f, "busy poll cpu %d\n", busy_cpu);
+    fprintf(f, "%-16s %llu\n", "idle_spins", (unsigned long long)busy.spins);
+    fprintf(f, "%-16s %llu\n", "idle_yields", (unsigned long long)busy.yields);
+    fprintf(f, "%-16s %llu\n", "idle_sleeps", (unsigned long long)busy.sleeps);
+}
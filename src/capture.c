@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+
+#include "capture.h"
+#include "game.h"
+#include "mem.h"
+
+#define CAPTURE_BUFSZ (1 << 20)
+
+static FILE *capture_file = NULL;
+static char *capture_buf = NULL;
+static int capture_sock = -1;
+static uint64_t last_us;
+
+static inline uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int capture_open(const char *path, int sockfd)
+{
+    capture_file = fopen(path, "ab");
+    if (!capture_file) {
+        errmsg("Unable to open capture %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    capture_buf = mem_alloc(MEM_IO, CAPTURE_BUFSZ);
+    setvbuf(capture_file, capture_buf, _IOFBF, CAPTURE_BUFSZ);
+
+    if (ftell(capture_file) == 0) {
+        struct capture_header hdr = { CAPTURE_MAGIC, CAPTURE_VERSION };
+        if (fwrite(&hdr, sizeof(hdr), 1, capture_file) != 1) {
+            errmsg("Unable to write capture header: %s\n", strerror(errno));
+            capture_close();
+            return -1;
+        }
+    }
+
+    capture_sock = sockfd;
+    last_us = 0;
+    infomsg("Recording game traffic to %s\n", path);
+    return 0;
+}
+
+void capture_packet(int sockfd, struct sockaddr_in addr, const void *buf,
+                    size_t len, bool reply)
+{
+    if (sockfd != capture_sock || len >= CAPTURE_REPLY) {
+        return;
+    }
+
+    uint64_t now = now_us();
+    struct capture_record rec;
+    rec.t_us = last_us ? (uint32_t)(now - last_us) : 0;
+    rec.addr = addr.sin_addr.s_addr;
+    rec.port = addr.sin_port;
+    rec.len = len | (reply ? CAPTURE_REPLY : 0);
+    last_us = now;
+
+    if (fwrite(&rec, sizeof(rec), 1, capture_file) != 1
+        || (len && fwrite(buf, len, 1, capture_file) != 1)) {
+        errmsg("Unable to record datagram, capture stopped: %s\n",
+               strerror(errno));
+        capture_close();
+    }
+}
+
+void capture_close()
+{
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+    mem_free(MEM_IO, capture_buf);
+    capture_buf = NULL;
+    capture_sock = -1;
+}
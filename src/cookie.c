@@ -0,0 +1,172 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cookie.h"
+#include "network.h"
+#include "archive.h"
+#include "game.h"
+
+#define TAG_SIZE (COOKIE_SIZE - 2)
+
+bool cookie_mode = false;
+
+static uint64_t tag_key[2];
+static uint32_t next_game = MAX_V5_ID;
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                    \
+    do {                                                            \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);   \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                      \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                      \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);   \
+    } while (0)
+
+/**
+ * SipHash-2-4 of the two 64-bit words @m0 and @m1 under @key
+ */
+static uint64_t siphash(const uint64_t key[2], uint64_t m0, uint64_t m1)
+{
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+    uint64_t msg[3] = { m0, m1, (uint64_t)16 << 56 };
+
+    for (int i = 0; i < 3; ++i) {
+        v3 ^= msg[i];
+        SIPROUND;
+        SIPROUND;
+        v0 ^= msg[i];
+    }
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * Tag of board @code of game @game_id played by @addr
+ */
+static uint64_t cookie_tag(uint32_t game_id, struct sockaddr_in addr,
+                           uint16_t code)
+{
+    uint64_t m0 = ((uint64_t)game_id << 32) | addr.sin_addr.s_addr;
+    uint64_t m1 = ((uint64_t)addr.sin_port << 16) | code;
+    return siphash(tag_key, m0, m1);
+}
+
+void cookie_init(const uint64_t key[2], uint32_t next_id)
+{
+    if (key) {
+        // games of the old key are still in flight, never reuse their IDs
+        tag_key[0] = key[0];
+        tag_key[1] = key[1];
+        next_game = next_id;
+        return;
+    }
+
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, tag_key, sizeof(tag_key)) != sizeof(tag_key)) {
+        errmsg("Unable to read a cookie key: %s\n", strerror(errno));
+        exit(1);
+    }
+    close(fd);
+}
+
+uint32_t cookie_key(uint64_t key[2])
+{
+    key[0] = tag_key[0];
+    key[1] = tag_key[1];
+    return next_game;
+}
+
+void cookie_start(struct session *s, struct sockaddr_in addr,
+                  const char board[NROWS * NCOLS])
+{
+    memset(s, 0, sizeof(*s));
+
+    s->game_id = next_game;
+    next_game = (next_game >= INT32_MAX) ? MAX_V5_ID : next_game + 1;
+    s->client = addr;
+    s->start = time_ms();
+    s->last_active = mono_ms();
+    s->flags = REC_V5 | REC_COOKIE;
+
+    if (board) {
+        load_board(s, board);
+        s->flags |= REC_RESUMED;
+    } else {
+        init_board(s->board);
+    }
+    seed_game(&s->rng, 0, s->game_id, s->turn);
+}
+
+void cookie_make(const struct session *s, char cookie[COOKIE_SIZE])
+{
+    uint16_t code = 0;
+    for (int i = NROWS * NCOLS - 1; i >= 0; --i) {
+        int cell = (s->board[i] == 'X') ? 1 : (s->board[i] == 'O') ? 2 : 0;
+        code = code * 3 + cell;
+    }
+
+    uint64_t tag = cookie_tag(s->game_id, s->client, code);
+
+    cookie[0] = code & 0xff;
+    cookie[1] = code >> 8;
+    for (int i = 0; i < TAG_SIZE; ++i) {
+        cookie[2 + i] = (tag >> (8 * i)) & 0xff;
+    }
+}
+
+int cookie_open(struct session *s, struct sockaddr_in addr, uint32_t game_id,
+                const char cookie[COOKIE_SIZE])
+{
+    const uint8_t *c = (const uint8_t *)cookie;
+    uint16_t code = c[0] | (c[1] << 8);
+    if (game_id < MAX_V5_ID || game_id > INT32_MAX || code >= 19683) {
+        return -1;
+    }
+
+    uint64_t tag = cookie_tag(game_id, addr, code);
+    uint8_t diff = 0;
+    for (int i = 0; i < TAG_SIZE; ++i) {
+        diff |= c[2 + i] ^ ((tag >> (8 * i)) & 0xff);
+    }
+    if (diff) {
+        return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->game_id = game_id;
+    s->client = addr;
+    s->start = time_ms();
+    s->last_active = mono_ms();
+    s->flags = REC_V5 | REC_COOKIE;
+
+    // same encoding as a RGAME board, the turn follows from the move count
+    char board[NROWS * NCOLS];
+    for (int i = 0; i < NROWS * NCOLS; ++i) {
+        board[i] = code % 3;
+        code /= 3;
+    }
+    s->turn = load_board(s, board) - 1;
+
+    // no generator survives between moves, each turn derives its own
+    seed_game(&s->rng, 0, game_id, s->turn);
+
+    return 0;
+}
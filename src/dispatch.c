@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
+
+#include "dispatch.h"
+#include "engine.h"
+#include "game.h"
+
+#define SAMPLE_NS   1000000 // receive queue sampled at most this often
+#define MIN_HOLD_NS 100000000ULL  // shortest stay before stepping up
+#define MAX_HOLD_NS 5000000000ULL // longest, after step ups that failed
+#define EWMA_SHIFT  4       // weight 1/16 of a new cost sample
+
+// engines from the most expensive down
+static const int ladder_order[] = {
+    ENGINE_PERFECT, ENGINE_TABLE, ENGINE_HEURISTIC, ENGINE_RANDOM,
+};
+
+int slo_us = 0;
+
+static int ladder[NENGINES]; // move_engine and the cheaper engines
+static int nladder;
+static int level;            // ladder index of the engine in use
+static int last_engine = -1; // engine of the last move
+
+static uint64_t cost_ns[NENGINES];  // recent handling time of a request
+static uint32_t dgram_size;  // smallest receive queue seen, one datagram
+static int queued;           // datagrams waiting at the last sample
+static uint64_t last_sample, last_up, hold_ns = MIN_HOLD_NS;
+
+static struct
+{
+    uint64_t moves[NENGINES];
+    uint64_t steps_down;
+    uint64_t steps_up;
+} counts;
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Rebuild the ladder below move_engine, which may have changed. Without a
+ * mapped table the table engine searches like perfect, so it is skipped
+ */
+static void build_ladder()
+{
+    int n = sizeof(ladder_order) / sizeof(ladder_order[0]);
+    int top = 0;
+    while (top < n && ladder_order[top] != move_engine)
+        top++;
+
+    nladder = 0;
+    for (int i = top; i < n; ++i) {
+        if (ladder_order[i] == ENGINE_TABLE && i != top
+            && !engine_table_loaded())
+            continue;
+        ladder[nladder++] = ladder_order[i];
+    }
+    if (nladder == 0) {
+        ladder[nladder++] = move_engine;
+    }
+    if (level >= nladder) {
+        level = nladder - 1;
+    }
+}
+
+int dispatch_engine()
+{
+    int e = move_engine;
+    if (slo_us > 0 && nladder > 0 && ladder[0] == move_engine) {
+        e = ladder[level];
+    }
+    counts.moves[e]++;
+    last_engine = e;
+    return e;
+}
+
+void dispatch_observe(uint64_t ns)
+{
+    if (last_engine < 0) {
+        return;
+    }
+    uint64_t *c = &cost_ns[last_engine];
+    if (*c == 0) {
+        *c = ns;
+    } else {
+        *c = (uint64_t)((int64_t)*c + (((int64_t)ns - (int64_t)*c) >> EWMA_SHIFT));
+    }
+}
+
+void dispatch_sample(int sockfd)
+{
+    if (slo_us <= 0) {
+        return;
+    }
+    uint64_t now = now_ns();
+    if (now - last_sample < SAMPLE_NS) {
+        return;
+    }
+    last_sample = now;
+
+    // the kernel charges every datagram its buffer size, so the queue only
+    // tells bytes; the smallest queue seen while one waits is one datagram
+    uint32_t mem[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(mem);
+    queued = 0;
+    if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, mem, &len) == 0
+        && mem[SK_MEMINFO_RMEM_ALLOC] > 0) {
+        uint32_t rmem = mem[SK_MEMINFO_RMEM_ALLOC];
+        if (dgram_size == 0 || rmem < dgram_size)
+            dgram_size = rmem;
+        queued = rmem / dgram_size;
+    }
+
+    build_ladder();
+    uint64_t slo_ns = (uint64_t)slo_us * 1000;
+    uint64_t wait = queued * cost_ns[ladder[level]];
+
+    if (level + 1 < nladder && wait > slo_ns) {
+        // a step up undone this soon is retried later
+        hold_ns = (now - last_up < hold_ns)
+            ? (2 * hold_ns < MAX_HOLD_NS ? 2 * hold_ns : MAX_HOLD_NS)
+            : MIN_HOLD_NS;
+        level++;
+        counts.steps_down++;
+        infomsg("Latency target at risk, playing the %s engine\n",
+                engine_name(ladder[level]));
+    } else if (level > 0 && now - last_up >= hold_ns
+               && queued * cost_ns[ladder[level - 1]] < slo_ns / 2) {
+        level--;
+        last_up = now;
+        counts.steps_up++;
+        infomsg("Load dropped, playing the %s engine\n",
+                engine_name(ladder[level]));
+    }
+}
+
+void dispatch_dump(FILE *f)
+{
+    for (int e = 0; e < NENGINES; ++e) {
+        fprintf(f, "moves_%-10s %llu\n", engine_name(e),
+                (unsigned long long)counts.moves[e]);
+    }
+    if (slo_us <= 0) {
+        return;
+    }
+
+    fprintf(f, "adaptive engine  slo %d us, playing %s, %d queued\n", slo_us,
+            engine_name(nladder ? ladder[level] : move_engine), queued);
+    fprintf(f, "%-16s %llu\n", "steps_down",
+            (unsigned long long)counts.steps_down);
+    fprintf(f, "%-16s %llu\n", "steps_up", (unsigned long long)counts.steps_up);
+    for (int e = 0; e < NENGINES; ++e) {
+        if (cost_ns[e])
+            fprintf(f, "cost_%-11s %llu ns\n", engine_name(e),
+                    (unsigned long long)cost_ns[e]);
+    }
+}
@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "engine.h"
+#include "table.h"
+
+#define NCELLS (NROWS * NCOLS)
+
+static const char *names[NENGINES] = {
+    "random", "heuristic", "perfect", "table",
+};
+
+static struct table solved; // mapped by engine_table_open()
+
+static const int lines[8][3] = {
+    { 0, 1, 2 }, { 3, 4, 5 }, { 6, 7, 8 }, // rows
+    { 0, 3, 6 }, { 1, 4, 7 }, { 2, 5, 8 }, // columns
+    { 0, 4, 8 }, { 2, 4, 6 },              // diagonals
+};
+
+int engine_by_name(const char *name)
+{
+    for (int e = 0; e < NENGINES; ++e) {
+        if (strcmp(name, names[e]) == 0)
+            return e;
+    }
+    return -1;
+}
+
+const char *engine_name(enum Engine e)
+{
+    return (e >= 0 && e < NENGINES) ? names[e] : "unknown";
+}
+
+static inline bool is_free(const char board[NCELLS], int i)
+{
+    return board[i] == '1' + i;
+}
+
+static inline char mark_of(int player)
+{
+    return (player == 1) ? 'X' : 'O';
+}
+
+/**
+ * Return the player owning a complete line on @board, 0 if there is none
+ */
+static int line_owner(const char board[NCELLS])
+{
+    for (int l = 0; l < 8; ++l) {
+        char c = board[lines[l][0]];
+        if (c == board[lines[l][1]] && c == board[lines[l][2]])
+            return (c == 'X') ? 1 : 2;
+    }
+    return 0;
+}
+
+/**
+ * Pick a random square among the free squares of @cand, -1 if none is free
+ */
+static int pick(const char board[NCELLS], const int *cand, int n,
+                struct rng *r)
+{
+    int free_cells[NCELLS], nfree = 0;
+    for (int i = 0; i < n; ++i) {
+        if (is_free(board, cand[i]))
+            free_cells[nfree++] = cand[i];
+    }
+    return nfree ? free_cells[rng_below(r, nfree)] : -1;
+}
+
+static int random_move(const char board[NCELLS], struct rng *r)
+{
+    static const int all[NCELLS] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+    return pick(board, all, NCELLS, r);
+}
+
+/**
+ * Return a square that completes a line of @player, -1 if there is none
+ */
+static int completing_move(const char board[NCELLS], int player)
+{
+    char m = mark_of(player);
+    for (int l = 0; l < 8; ++l) {
+        int owned = 0, empty = -1;
+        for (int k = 0; k < 3; ++k) {
+            int i = lines[l][k];
+            if (board[i] == m)
+                owned++;
+            else if (is_free(board, i))
+                empty = i;
+        }
+        if (owned == 2 && empty >= 0)
+            return empty;
+    }
+    return -1;
+}
+
+static int heuristic_move(const char board[NCELLS], int player,
+                          struct rng *r)
+{
+    static const int center[] = { 4 };
+    static const int corners[] = { 0, 2, 6, 8 };
+    static const int sides[] = { 1, 3, 5, 7 };
+
+    int move;
+    if ((move = completing_move(board, player)) >= 0
+        || (move = completing_move(board, 3 - player)) >= 0
+        || (move = pick(board, center, 1, r)) >= 0
+        || (move = pick(board, corners, 4, r)) >= 0
+        || (move = pick(board, sides, 4, r)) >= 0)
+        return move;
+    return -1;
+}
+
+#define NPOS 19683     // 3^9 board encodings
+#define UNKNOWN INT8_MIN
+
+static const int pow3[NCELLS] = { 1, 3, 9, 27, 81, 243, 729, 2187, 6561 };
+
+/**
+ * Negamax over the full game tree, memoized by board encoding @code in
+ * @memo. Return the score of @board for @player to move: positive is a win,
+ * sooner wins score higher
+ */
+static int negamax(char board[NCELLS], int code, int player, int depth,
+                   int8_t memo[NPOS])
+{
+    if (memo[code] != UNKNOWN)
+        return memo[code];
+
+    int best;
+    if (line_owner(board)) {
+        best = -(NCELLS + 1 - depth); // the previous move won
+    } else if (depth == NCELLS) {
+        best = 0; // board full, tie
+    } else {
+        best = -NCELLS - 2;
+        for (int i = 0; i < NCELLS; ++i) {
+            if (!is_free(board, i))
+                continue;
+
+            board[i] = mark_of(player);
+            int score = -negamax(board, code + player * pow3[i], 3 - player,
+                                 depth + 1, memo);
+            board[i] = '1' + i;
+
+            if (score > best)
+                best = score;
+        }
+    }
+
+    memo[code] = best;
+    return best;
+}
+
+static int perfect_move(const char board[NCELLS], int player, struct rng *r)
+{
+    char b[NCELLS];
+    memcpy(b, board, NCELLS);
+
+    int8_t memo[NPOS];
+    memset(memo, UNKNOWN, sizeof(memo));
+
+    int depth = 0, code = 0;
+    for (int i = 0; i < NCELLS; ++i) {
+        if (!is_free(b, i)) {
+            depth++;
+            code += ((b[i] == 'X' || b[i] == 'x') ? 1 : 2) * pow3[i];
+        }
+    }
+
+    // score every move exactly, break ties randomly
+    int best = -NCELLS - 2, cand[NCELLS], ncand = 0;
+    for (int i = 0; i < NCELLS; ++i) {
+        if (!is_free(b, i))
+            continue;
+
+        b[i] = mark_of(player);
+        int score = -negamax(b, code + player * pow3[i], 3 - player,
+                             depth + 1, memo);
+        b[i] = '1' + i;
+
+        if (score > best) {
+            best = score;
+            ncand = 0;
+        }
+        if (score == best)
+            cand[ncand++] = i;
+    }
+    return ncand ? cand[rng_below(r, ncand)] : -1;
+}
+
+int engine_table_open(const char *path)
+{
+    struct table t;
+    if (table_open(&t, path) < 0) {
+        return -1;
+    }
+    if (t.n != NROWS) {
+        errmsg("Table %s solves %dx%d, not the %dx%d game\n", path,
+               t.n, t.n, NROWS, NCOLS);
+        table_close(&t);
+        return -1;
+    }
+
+    if (solved.values) {
+        table_close(&solved);
+    }
+    solved = t;
+    return 0;
+}
+
+bool engine_table_loaded()
+{
+    return solved.values != NULL;
+}
+
+static int table_engine_move(const char board[NCELLS], int player,
+                             struct rng *r)
+{
+    uint8_t cells[NCELLS];
+    for (int i = 0; i < NCELLS; ++i) {
+        cells[i] = is_free(board, i) ? 0
+            : (board[i] == 'X' || board[i] == 'x') ? 1 : 2;
+    }
+
+    // a resumed board need not be in turn order, search it instead
+    int move = solved.values ? table_move(&solved, cells, player, r) : -1;
+    return (move >= 0) ? move : perfect_move(board, player, r);
+}
+
+int engine_move(enum Engine e, int player, const char board[NROWS * NCOLS],
+                struct rng *r)
+{
+    int move;
+    switch (e) {
+    case ENGINE_HEURISTIC:
+        move = heuristic_move(board, player, r);
+        break;
+    case ENGINE_PERFECT:
+        move = perfect_move(board, player, r);
+        break;
+    case ENGINE_TABLE:
+        move = table_engine_move(board, player, r);
+        break;
+    default:
+        move = random_move(board, r);
+        break;
+    }
+    return (move < 0) ? -1 : move + 1;
+}
@@ -0,0 +1,362 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+
+#include "filter.h"
+#include "network.h"
+#include "game.h"
+
+#ifndef SO_ATTACH_BPF
+#define SO_ATTACH_BPF 50
+#endif
+
+#define UDP_HDR   8  // socket filters see the UDP header before the payload
+#define MAX_INSNS 64
+
+static const char *socket_names[NFILTERS] = { "game", "probe" };
+static const char *count_names[NFILTER_COUNTS] = {
+    "pass", "bad_length", "bad_version", "bad_command"
+};
+
+static struct
+{
+    bool attached;
+    bool ebpf;
+    int map_fd; // verdict counters, -1 for a classic filter
+} filters[NFILTERS] = { { false, false, -1 }, { false, false, -1 } };
+
+/*
+ * Both programs are assembled with symbolic jump targets, resolved once the
+ * whole program is emitted
+ */
+enum Label
+{
+    L_NEXT = -1, // fall through
+    L_V4,
+    L_V5,
+    L_BADLEN,
+    L_BADVER,
+    L_BADCMD,
+    L_PASS,
+    L_COUNT,
+    L_OUT,
+    L_DROP,
+    NLABELS
+};
+
+struct assembler
+{
+    int n;
+    int labels[NLABELS];
+    int jt[MAX_INSNS], jf[MAX_INSNS]; // jump targets of each instruction
+};
+
+static void asm_init(struct assembler *a)
+{
+    memset(a, 0, sizeof(*a));
+    for (int i = 0; i < MAX_INSNS; ++i)
+        a->jt[i] = a->jf[i] = L_NEXT;
+}
+
+static void asm_label(struct assembler *a, enum Label l)
+{
+    a->labels[l] = a->n;
+}
+
+/**
+ * Jump offset from instruction @i to label @l
+ */
+static int asm_offset(const struct assembler *a, int i, int l)
+{
+    return (l == L_NEXT) ? 0 : a->labels[l] - i - 1;
+}
+
+/* eBPF */
+
+static struct bpf_insn ebpf[MAX_INSNS];
+
+static void emit(struct assembler *a, uint8_t code, uint8_t dst, uint8_t src,
+                 int16_t off, int32_t imm, int target)
+{
+    struct bpf_insn *insn = &ebpf[a->n];
+    memset(insn, 0, sizeof(*insn));
+    insn->code = code;
+    insn->dst_reg = dst;
+    insn->src_reg = src;
+    insn->off = off;
+    insn->imm = imm;
+    a->jt[a->n++] = target;
+}
+
+#define MOV_IMM(r, k)    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, r, 0, 0, k, L_NEXT)
+#define MOV_REG(d, s)    emit(&a, BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0, L_NEXT)
+#define ALU_IMM(op, r, k) emit(&a, BPF_ALU64 | op | BPF_K, r, 0, 0, k, L_NEXT)
+#define LD_BYTE(off)     emit(&a, BPF_LD | BPF_B | BPF_ABS, 0, 0, 0, off, L_NEXT)
+#define JMP_IMM(op, r, k, l) emit(&a, BPF_JMP | op | BPF_K, r, 0, 0, k, l)
+#define JMP_REG(op, d, s, l) emit(&a, BPF_JMP | op | BPF_X, d, s, 0, 0, l)
+#define JA(l)            emit(&a, BPF_JMP | BPF_JA, 0, 0, 0, 0, l)
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(SYS_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * Load the eBPF filter of socket kind @which counting into map @map_fd
+ * Return the program file descriptor or -1
+ *
+ * r6 holds the context for the packet loads, r7 the payload length, r8 the
+ * counter index and r9 the verdict
+ */
+static int load_ebpf(enum FilterSocket which, int map_fd)
+{
+    struct assembler a;
+    asm_init(&a);
+
+    MOV_REG(BPF_REG_6, BPF_REG_1);
+    emit(&a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_7, BPF_REG_6,
+         offsetof(struct __sk_buff, len), 0, L_NEXT);
+    ALU_IMM(BPF_SUB, BPF_REG_7, UDP_HDR);
+    JMP_IMM(BPF_JLT, BPF_REG_7, sizeof(struct header_v5), L_BADLEN);
+
+    LD_BYTE(UDP_HDR + offsetof(struct message, version));
+    JMP_IMM(BPF_JEQ, BPF_REG_0, VERSION, L_V4);
+    if (which == FILTER_GAME)
+        JMP_IMM(BPF_JEQ, BPF_REG_0, VERSION_V5, L_V5);
+    JA(L_BADVER);
+
+    asm_label(&a, L_V4);
+    JMP_IMM(BPF_JLT, BPF_REG_7, MIN_MESSAGE, L_BADLEN);
+    JMP_IMM(BPF_JGT, BPF_REG_7, sizeof(struct message), L_BADLEN);
+    LD_BYTE(UDP_HDR + offsetof(struct message, cmd));
+    if (which == FILTER_GAME)
+        JMP_IMM(BPF_JGT, BPF_REG_0, NSERV, L_BADCMD);
+    else
+        JMP_IMM(BPF_JNE, BPF_REG_0, NSERV, L_BADCMD);
+    JA(L_PASS);
+
+    // the length must match the message count exactly
+    if (which == FILTER_GAME) {
+        asm_label(&a, L_V5);
+        LD_BYTE(UDP_HDR + offsetof(struct header_v5, count));
+        JMP_IMM(BPF_JEQ, BPF_REG_0, 0, L_BADLEN);
+        JMP_IMM(BPF_JGT, BPF_REG_0, MAX_BATCH, L_BADLEN);
+        ALU_IMM(BPF_MUL, BPF_REG_0, sizeof(struct message_v5));
+        ALU_IMM(BPF_ADD, BPF_REG_0, sizeof(struct header_v5));
+        JMP_REG(BPF_JNE, BPF_REG_0, BPF_REG_7, L_BADLEN);
+        LD_BYTE(UDP_HDR + sizeof(struct header_v5)
+                + offsetof(struct message_v5, cmd));
+        JMP_IMM(BPF_JGT, BPF_REG_0, NSERV, L_BADCMD);
+        JA(L_PASS);
+    }
+
+    // keep the whole datagram on pass, nothing otherwise
+    asm_label(&a, L_BADLEN);
+    MOV_IMM(BPF_REG_8, FILTER_LENGTH);
+    JA(L_DROP);
+    asm_label(&a, L_BADVER);
+    MOV_IMM(BPF_REG_8, FILTER_VERSION);
+    JA(L_DROP);
+    asm_label(&a, L_BADCMD);
+    MOV_IMM(BPF_REG_8, FILTER_COMMAND);
+    asm_label(&a, L_DROP);
+    MOV_IMM(BPF_REG_9, 0);
+    JA(L_COUNT);
+    asm_label(&a, L_PASS);
+    MOV_IMM(BPF_REG_8, FILTER_PASS);
+    MOV_IMM(BPF_REG_9, -1);
+
+    asm_label(&a, L_COUNT);
+    emit(&a, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_8, -4, 0, L_NEXT);
+    emit(&a, BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+         map_fd, L_NEXT);
+    emit(&a, 0, 0, 0, 0, 0, L_NEXT);
+    MOV_REG(BPF_REG_2, BPF_REG_10);
+    ALU_IMM(BPF_ADD, BPF_REG_2, -4);
+    emit(&a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem, L_NEXT);
+    JMP_IMM(BPF_JEQ, BPF_REG_0, 0, L_OUT);
+    MOV_IMM(BPF_REG_1, 1);
+    emit(&a, BPF_STX | BPF_XADD | BPF_DW, BPF_REG_0, BPF_REG_1, 0, 0, L_NEXT);
+
+    asm_label(&a, L_OUT);
+    MOV_REG(BPF_REG_0, BPF_REG_9);
+    emit(&a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0, L_NEXT);
+
+    for (int i = 0; i < a.n; ++i) {
+        if (a.jt[i] != L_NEXT)
+            ebpf[i].off = asm_offset(&a, i, a.jt[i]);
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uint64_t)(uintptr_t)ebpf;
+    attr.insn_cnt = a.n;
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int create_map()
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_ARRAY;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint64_t);
+    attr.max_entries = NFILTER_COUNTS;
+
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+/* classic BPF */
+
+static struct sock_filter cbpf[MAX_INSNS];
+
+static void cemit(struct assembler *a, uint16_t code, uint32_t k, int jt, int jf)
+{
+    cbpf[a->n].code = code;
+    cbpf[a->n].k = k;
+    a->jt[a->n] = jt;
+    a->jf[a->n++] = jf;
+}
+
+/**
+ * Attach the classic BPF filter of socket kind @which, the same checks as
+ * the eBPF one without counters. Return the setsockopt rc
+ *
+ * A holds the loaded byte, X the payload length
+ */
+static int attach_classic(int sockfd, enum FilterSocket which)
+{
+    struct assembler a;
+    asm_init(&a);
+
+    cemit(&a, BPF_LD | BPF_W | BPF_LEN, 0, L_NEXT, L_NEXT);
+    cemit(&a, BPF_ALU | BPF_SUB | BPF_K, UDP_HDR, L_NEXT, L_NEXT);
+    cemit(&a, BPF_MISC | BPF_TAX, 0, L_NEXT, L_NEXT);
+    cemit(&a, BPF_JMP | BPF_JGE | BPF_K, sizeof(struct header_v5),
+          L_NEXT, L_DROP);
+
+    cemit(&a, BPF_LD | BPF_B | BPF_ABS,
+          UDP_HDR + offsetof(struct message, version), L_NEXT, L_NEXT);
+    cemit(&a, BPF_JMP | BPF_JEQ | BPF_K, VERSION, L_V4, L_NEXT);
+    if (which == FILTER_GAME)
+        cemit(&a, BPF_JMP | BPF_JEQ | BPF_K, VERSION_V5, L_V5, L_NEXT);
+    cemit(&a, BPF_RET | BPF_K, 0, L_NEXT, L_NEXT);
+
+    asm_label(&a, L_V4);
+    cemit(&a, BPF_MISC | BPF_TXA, 0, L_NEXT, L_NEXT);
+    cemit(&a, BPF_JMP | BPF_JGE | BPF_K, MIN_MESSAGE, L_NEXT, L_DROP);
+    cemit(&a, BPF_JMP | BPF_JGT | BPF_K, sizeof(struct message),
+          L_DROP, L_NEXT);
+    cemit(&a, BPF_LD | BPF_B | BPF_ABS,
+          UDP_HDR + offsetof(struct message, cmd), L_NEXT, L_NEXT);
+    if (which == FILTER_GAME)
+        cemit(&a, BPF_JMP | BPF_JGT | BPF_K, NSERV, L_DROP, L_PASS);
+    else
+        cemit(&a, BPF_JMP | BPF_JEQ | BPF_K, NSERV, L_PASS, L_DROP);
+
+    if (which == FILTER_GAME) {
+        asm_label(&a, L_V5);
+        cemit(&a, BPF_LD | BPF_B | BPF_ABS,
+              UDP_HDR + offsetof(struct header_v5, count), L_NEXT, L_NEXT);
+        cemit(&a, BPF_JMP | BPF_JEQ | BPF_K, 0, L_DROP, L_NEXT);
+        cemit(&a, BPF_JMP | BPF_JGT | BPF_K, MAX_BATCH, L_DROP, L_NEXT);
+        cemit(&a, BPF_ALU | BPF_MUL | BPF_K, sizeof(struct message_v5),
+              L_NEXT, L_NEXT);
+        cemit(&a, BPF_ALU | BPF_ADD | BPF_K, sizeof(struct header_v5),
+              L_NEXT, L_NEXT);
+        cemit(&a, BPF_JMP | BPF_JEQ | BPF_X, 0, L_NEXT, L_DROP);
+        cemit(&a, BPF_LD | BPF_B | BPF_ABS, UDP_HDR + sizeof(struct header_v5)
+              + offsetof(struct message_v5, cmd), L_NEXT, L_NEXT);
+        cemit(&a, BPF_JMP | BPF_JGT | BPF_K, NSERV, L_DROP, L_PASS);
+    }
+
+    // classic filters cannot count, every rejection shares one exit
+    asm_label(&a, L_DROP);
+    cemit(&a, BPF_RET | BPF_K, 0, L_NEXT, L_NEXT);
+    asm_label(&a, L_PASS);
+    cemit(&a, BPF_RET | BPF_K, 0xffffffff, L_NEXT, L_NEXT);
+
+    for (int i = 0; i < a.n; ++i) {
+        cbpf[i].jt = asm_offset(&a, i, a.jt[i]);
+        cbpf[i].jf = asm_offset(&a, i, a.jf[i]);
+    }
+
+    struct sock_fprog prog = { a.n, cbpf };
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+int filter_attach(int sockfd, enum FilterSocket which)
+{
+    if (filters[which].map_fd < 0) {
+        filters[which].map_fd = create_map();
+    }
+
+    if (filters[which].map_fd >= 0) {
+        int prog_fd = load_ebpf(which, filters[which].map_fd);
+        if (prog_fd >= 0) {
+            int rc = setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_BPF,
+                                &prog_fd, sizeof(prog_fd));
+            // the socket holds its own reference to the program
+            close(prog_fd);
+            if (rc == 0) {
+                filters[which].attached = true;
+                filters[which].ebpf = true;
+                infomsg("Attached eBPF filter to %s socket\n",
+                        socket_names[which]);
+                return 0;
+            }
+        }
+        infomsg("eBPF filter unavailable (%s), trying classic BPF\n",
+                strerror(errno));
+        close(filters[which].map_fd);
+        filters[which].map_fd = -1;
+    }
+
+    if (attach_classic(sockfd, which) < 0) {
+        errmsg("Unable to attach socket filter: %s\n", strerror(errno));
+        return -1;
+    }
+
+    filters[which].attached = true;
+    filters[which].ebpf = false;
+    infomsg("Attached classic BPF filter to %s socket\n", socket_names[which]);
+    return 0;
+}
+
+void filter_dump(FILE *f)
+{
+    for (int i = 0; i < NFILTERS; ++i) {
+        fprintf(f, "%s filter%*s %s\n", socket_names[i],
+                (int)(9 - strlen(socket_names[i])), "",
+                !filters[i].attached ? "none"
+                : filters[i].ebpf    ? "ebpf" : "classic, no counters");
+        if (!filters[i].ebpf)
+            continue;
+
+        for (uint32_t k = 0; k < NFILTER_COUNTS; ++k) {
+            uint64_t value = 0;
+            union bpf_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.map_fd = filters[i].map_fd;
+            attr.key = (uint64_t)(uintptr_t)&k;
+            attr.value = (uint64_t)(uintptr_t)&value;
+            sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+
+            fprintf(f, "  %-14s %llu\n", count_names[k],
+                    (unsigned long long)value);
+        }
+    }
+}
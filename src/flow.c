@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "flow.h"
+
+void flow_init(struct flow_table *t, int epoll_fd)
+{
+    t->epoll_fd = epoll_fd;
+    INIT_LIST_HEAD(&t->flows);
+    for (int i = 0; i < FLOW_BUCKETS; ++i)
+        INIT_LIST_HEAD(&t->buckets[i]);
+}
+
+static inline struct list_head *bucket_of(struct flow_table *t,
+                                          struct sockaddr_in addr)
+{
+    uint32_t h = (addr.sin_addr.s_addr ^ addr.sin_port) * 2654435761u;
+    return &t->buckets[h >> 20 & (FLOW_BUCKETS - 1)];
+}
+
+struct flow *flow_find(struct flow_table *t, struct sockaddr_in addr)
+{
+    struct flow *f;
+    list_for_each_entry(f, bucket_of(t, addr), hash) {
+        if (f->client.sin_addr.s_addr == addr.sin_addr.s_addr
+            && f->client.sin_port == addr.sin_port)
+            return f;
+    }
+    return NULL;
+}
+
+struct flow *flow_open(struct flow_table *t, struct sockaddr_in addr,
+                       const struct sockaddr_in *server, size_t size,
+                       uint64_t now)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)server, sizeof(*server)) < 0) {
+        fprintf(stderr, "Unable to create upstream socket: %s\n",
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    struct flow *f = calloc(1, size);
+    f->client = addr;
+    f->fd = fd;
+    f->last = now;
+    list_add(&f->list, &t->flows);
+    list_add(&f->hash, bucket_of(t, addr));
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = f };
+    if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf(stderr, "Unable to watch upstream socket: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+
+    return f;
+}
+
+void flow_close(struct flow *f)
+{
+    list_del(&f->list);
+    list_del(&f->hash);
+    close(f->fd);
+    free(f);
+}
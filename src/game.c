@@ -6,21 +6,32 @@
 #include <time.h>
 
 #include "game.h"
+#include "engine.h"
+#include "tictactoe.h"
 
 extern FILE *log_file;
 
 const char *FILE_TEMP = "2020-OCT-01 00:00:00";
 const char *TIME_FMT = "%Y-%b-%d %H:%M:%S";
 
+int log_level = LOG_INFO;
+int move_engine = ENGINE_RANDOM;
+
+uint64_t move_seed = 0;
+
 void prompt(const char *fmt, ...)
 {
     va_list args;
 
+    if (log_level < LOG_INFO) {
+        return;
+    }
+
     time_t curr = time(NULL);
     struct tm *tm_time = localtime(&curr);
-    char *time_str = malloc(strlen(FILE_TEMP) + 10);
+    char time_str[32]; // FILE_TEMP and room for long month names
 
-    strftime(time_str, strlen(FILE_TEMP) + 10, TIME_FMT, tm_time);
+    strftime(time_str, sizeof(time_str), TIME_FMT, tm_time);
 
     set_style(stdout, "38;5;45m");
     printf(" [%s] >>>", time_str);
@@ -40,19 +51,21 @@ void prompt(const char *fmt, ...)
         vfprintf(log_file, fmt, args);
     }
     va_end(args);
-
-    free(time_str);
 }
 
 void infomsg(const char *fmt, ...)
 {
     va_list args;
 
+    if (log_level < LOG_INFO) {
+        return;
+    }
+
     time_t curr = time(NULL);
     struct tm *tm_time = localtime(&curr);
-    char *time_str = malloc(strlen(FILE_TEMP) + 10);
+    char time_str[32]; // FILE_TEMP and room for long month names
 
-    strftime(time_str, strlen(FILE_TEMP) + 10, TIME_FMT, tm_time);
+    strftime(time_str, sizeof(time_str), TIME_FMT, tm_time);
 
     set_style(stdout, GREEN);
     printf(" [%s] --> ", time_str);
@@ -72,14 +85,16 @@ void infomsg(const char *fmt, ...)
         vfprintf(log_file, fmt, args);
     }
     va_end(args);
-
-    free(time_str);
 }
 
 void errmsg(const char *fmt, ...)
 {
     va_list args;
 
+    if (log_level < LOG_ERROR) {
+        return;
+    }
+
     set_style(stderr, RED);
     fprintf(stderr, "!!! ");
     set_style(stderr, RESET);
@@ -93,86 +108,12 @@ void errmsg(const char *fmt, ...)
 
 bool play_move(int player, int move, char board[NROWS * NCOLS])
 {
-    char mark = (player == 1) ? 'X' : 'O';
-
-    int row = (int)((move - 1) / NROWS);
-    int col = (move - 1) % NCOLS;
-
-    if (board[row * NCOLS +  col] == (move + '0')) {
-        board[row * NCOLS + col] = mark;
-        return true;
-    } else {
-        return false;
-    }
+    return ttt_play(player, move, board);
 }
 
 int checkwin(char board[NROWS * NCOLS])
 {
-    char winner = '0';
-
-    // row matches
-    if (board[0] == board[1] && board[1] == board[2]) {
-        winner = board[0];
-        board[0] = board[1] = board[2] = tolower(board[0]);
-    }
-
-    // row matches
-    else if (board[3] == board[4] && board[4] == board[5]) {
-        winner = board[3];
-        board[3] = board[4] = board[5] = tolower(board[3]);
-    }
-
-    // row matches
-    else if (board[6] == board[7] && board[7] == board[8]) {
-        winner = board[6];
-        board[6] = board[7] = board[8] = tolower(board[6]);
-    }
-
-    // column
-    else if (board[0] == board[3] && board[3] == board[6]) {
-        winner = board[0];
-        board[0] = board[3] = board[6] = tolower(board[0]);
-    }
-
-    // column
-    else if (board[1] == board[4] && board[4] == board[7]) {
-        winner = board[1];
-        board[1] = board[4] = board[7] = tolower(board[1]);
-    }
-
-    // column
-    else if (board[2] == board[5] && board[5] == board[8]) {
-        winner = board[2];
-        board[2] = board[5] = board[8] = tolower(board[2]);
-    }
-
-    // diagonal
-    else if (board[0] == board[4] && board[4] == board[8]) {
-        winner = board[0];
-        board[0] = board[4] = board[8] = tolower(board[0]);
-    }
-
-    // diagonal
-    else if (board[2] == board[4] && board[4] == board[6]) {
-        winner = board[2];
-        board[2] = board[4] = board[6] = tolower(board[2]);
-    }
-
-    // game over, tie
-    else if (board[0] != '1' && board[1] != '2' && board[2] != '3' &&
-             board[3] != '4' && board[4] != '5' && board[5] != '6' &&
-             board[6] != '7' && board[7] != '8' && board[8] != '9')
-        return -1;
-
-    // game not finished
-    else
-        return 0;
-
-    // there is winner, return the player number
-    if (winner == 'X')
-        return 1;
-    else
-        return 2;
+    return ttt_checkwin(board);
 }
 
 /**
@@ -193,6 +134,10 @@ static void print_cell(FILE *f, char cell)
 
 void print_board(char board[NROWS * NCOLS], FILE *f)
 {
+    if (log_level < LOG_INFO) {
+        return;
+    }
+
     /* brute force print out the board and all the squares/values    */
 
     printf("\n\n\n       Current TicTacToe Game\n\n");
@@ -239,11 +184,7 @@ int init_board(char board[NROWS * NCOLS])
 {
     infomsg("Initializing Game Board ...\n\n");
 
-    int count = 1;
-    for (int i = 0; i < NROWS * NCOLS; i++) {
-        board[i] = count + '0';
-        count++;
-    }
+    ttt_init(board);
     return 0;
 }
 
@@ -291,13 +232,26 @@ void tee(FILE *f, char const *fmt, ...)
     }
 }
 
-int gen_move(const char board[NROWS * NCOLS])
+int gen_move(const char board[NROWS * NCOLS], struct rng *r)
 {
-    while (true) {
-        int move = rand() % 9;
-        if (board[move] != 'O' && board[move] != 'X') {
-            return move + 1;
-        }
-    }
-    return -1;
+    return gen_move_with(move_engine, board, r);
+}
+
+int gen_move_with(int engine, const char board[NROWS * NCOLS], struct rng *r)
+{
+    return engine_move(engine, 1, board, r);
+}
+
+void seed_moves(uint64_t seed)
+{
+    move_seed = seed;
+}
+
+void seed_game(struct rng *r, uint64_t serial, uint32_t game_id, int turn)
+{
+    // odd multipliers keep every (ID, turn) pair and every serial apart and
+    // spread consecutive ones over the whole seed before splitmix64 mixes it
+    uint64_t key = ((uint64_t)(uint32_t)turn << 32) | game_id;
+    rng_seed(r, move_seed ^ (key * 0xd6e8feb86659fd93ULL)
+                ^ (serial * 0x9e3779b97f4a7c15ULL));
 }
@@ -0,0 +1,768 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "handler.h"
+#include "network.h"
+#include "archive.h"
+#include "cookie.h"
+#include "dispatch.h"
+#include "heavy.h"
+#include "local.h"
+#include "match.h"
+#include "mem.h"
+#include "spectator.h"
+#include "stats.h"
+#include "trace.h"
+#include "game.h"
+
+extern FILE *log_file;
+
+static int server_move(struct session *sess, int *move);
+static int play_turn(struct session *sess, int move, int *reply, int *winner);
+static void start_match(int sockfd, struct sockaddr_in addr,
+                        struct list_head *sessions);
+static void relay_pending(int sockfd, const struct session *sess,
+                          struct sockaddr_in addr);
+static void relay_move(int sockfd, struct session *sess,
+                       struct sockaddr_in addr, int move);
+static void handle_v4(int sockfd, struct sockaddr_in addr, const char *pkt,
+                      int len, struct list_head *sessions);
+static void handle_v5(int sockfd, struct sockaddr_in addr, const char *pkt,
+                      int len, struct list_head *sessions);
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int serve_packet(int sockfd, struct list_head *sessions)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    char pkt[MAX_PACKET];
+
+    int rc = recv_packet(sockfd, &addr, &addr_len, pkt, sizeof(pkt));
+    if (rc < 0) {
+        return -1;
+    }
+    if (log_level >= LOG_INFO) {
+        tee(log_file, "\n");
+    }
+
+    if (heavy_request(addr)) {
+        stats.throttled++;
+        return rc;
+    }
+
+    // the adaptive engine learns the cost of a request at each engine
+    uint64_t start = (slo_us > 0) ? now_ns() : 0;
+    if (rc > 0 && pkt[0] == VERSION_V5) {
+        handle_v5(sockfd, addr, pkt, rc, sessions);
+    } else {
+        handle_v4(sockfd, addr, pkt, rc, sessions);
+    }
+    if (slo_us > 0) {
+        dispatch_observe(now_ns() - start);
+    }
+    return rc;
+}
+
+/**
+ * Handle the v4 datagram @pkt of @len bytes from @addr
+ */
+static void handle_v4(int sockfd, struct sockaddr_in addr, const char *pkt,
+                      int len, struct list_head *sessions)
+{
+    struct message msg;
+    char buf[INET_ADDRSTRLEN];
+    int rc;
+
+    memset(&msg, 0, sizeof(msg));
+    memcpy(&msg, pkt, (size_t)len < sizeof(msg) ? (size_t)len : sizeof(msg));
+    log_message(&msg);
+
+    // only reached when the socket filter could not be attached
+    if (msg.version != VERSION) {
+        errmsg("Received unsupported version %d\n", (int)msg.version);
+        stats.rejected++;
+        struct message reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.version = VERSION;
+        reply.resp = ENOVERSION;
+        sendmsg_to(sockfd, addr, reply);
+        return;
+    } else if (len < MIN_MESSAGE) {
+        infomsg("Did not receive enough bytes\n");
+        stats.rejected++;
+        return;
+    }
+
+    if (msg.cmd == NSERV) {
+        // a health probe, answered like the multicast ones
+        stats.probes++;
+        struct message reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.version = VERSION;
+        reply.resp = SPOTAVAIL;
+        sendmsg_to(sockfd, addr, reply);
+        return;
+    }
+
+    if (msg.cmd == NGAME) { // new game request
+        infomsg("NEW GAME request from %s:%u\n",
+                inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf)),
+                addr.sin_port);
+
+        TRACE_BEGIN(lookup, -1);
+        struct session *pos = lookup_client(addr);
+        TRACE_END(lookup, -1);
+        if (pos && (pos->flags & REC_PVP)) {
+            // the player missed the reply that started the game
+            relay_pending(sockfd, pos, addr);
+            return;
+        } else if (pos) {
+            errmsg("Existing client sent new game request, rejecting\n");
+            stats.busy++;
+            rc = send_move(sockfd, pos, 0, EBUSYGAME);
+            if (rc <= 0) {
+                errmsg("Unable to send response message: %s\n",
+                       strerror(errno));
+            }
+            return;
+        }
+
+        if (pvp_mode) {
+            start_match(sockfd, addr, sessions);
+            return;
+        }
+
+        struct session *sess = mem_alloc(MEM_SESSIONS, sizeof(struct session));
+        rc = init_session(sess, addr, VERSION);
+        if (rc < 0) {
+            errmsg("Server at full load, send busy response code\n");
+            stats.busy++;
+            rc = send_move(sockfd, sess, 0, EBUSYGAME);
+            if (rc <= 0) {
+                errmsg("Unable to send response message: %s\n",
+                       strerror(errno));
+            }
+            free_session(sess);
+            return;
+        }
+
+        int move;
+        server_move(sess, &move);
+
+        infomsg("Assigned game ID %d, serial %llu, to client %s:%u\n",
+                sess->game_id, (unsigned long long)sess->serial,
+                inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf)),
+                addr.sin_port);
+        rc = send_move(sockfd, sess, move, SUCC);
+        if (rc <= 0) {
+            errmsg("Unable to send initial message: %s\n", strerror(errno));
+            free_session(sess);
+            return;
+        }
+
+        INIT_LIST_HEAD(&sess->list);
+        list_add(&sess->list, sessions);
+        infomsg("Added session to the current list\n");
+        stats.games_new++;
+
+        return;
+    } else if (msg.cmd == RGAME) {
+        // resume game request
+        infomsg("RESUME GAME request from %s:%u\n",
+                inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf)),
+                addr.sin_port);
+
+
+        if (len < sizeof(msg)) {
+            infomsg("Did not receive enough bytes\n");
+            return;
+        }
+
+        struct session *sess = mem_alloc(MEM_SESSIONS, sizeof(struct session));
+        rc = clone_session(sess, addr, msg.board, VERSION);
+        if (rc < 0) {
+            errmsg("Server at full load, ignore request\n");
+            stats.busy++;
+            free_session(sess);
+            return;
+        }
+        stats.games_resumed++;
+
+        int move;
+        int winner = server_move(sess, &move);
+
+        if (winner == 0) {
+            infomsg("Assigned game ID %d, serial %llu, to client %s:%u\n",
+                    sess->game_id, (unsigned long long)sess->serial,
+                    inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf)),
+                    addr.sin_port);
+            rc = send_move(sockfd, sess, move, SUCC);
+            if (rc <= 0) {
+                errmsg("Unable to send initial message: %s\n",
+                       strerror(errno));
+                free_session(sess);
+                return;
+            }
+
+            INIT_LIST_HEAD(&sess->list);
+            list_add(&sess->list, sessions);
+            infomsg("Added session to the current list\n");
+            return;
+        } else {
+            infomsg("Sending move with winning message\n");
+            rc = send_move(sockfd, sess, move, GAMEOVR);
+            if (rc <= 0) {
+                errmsg("Failed to send message to client: %s\n",
+                       strerror(errno));
+            }
+            finish_game(sess, winner);
+            free_session(sess);
+            return;
+        }
+
+    }
+
+    TRACE_BEGIN(lookup, msg.game);
+    struct session *sess = lookup_client(addr);
+    TRACE_END(lookup, msg.game);
+
+    if (sess) {
+        infomsg("New message from current session\n");
+        // only moves keep a player-vs-player game alive, not the
+        // retransmissions of a player whose opponent left
+        if (!(sess->flags & REC_PVP))
+            sess->last_active = mono_ms();
+
+        // check for game ID
+        if (msg.game != sess->game_id) {
+            errmsg("Received mismatched game ID, expected %d, got %d\n",
+                   sess->game_id, msg.game);
+            stats.wrong_game++;
+            heavy_error(addr);
+            rc = send_move_to(sockfd, sess, addr, 0, EGIDWRONG);
+            if (rc <= 0) {
+                errmsg("Unable to send response message: %s\n",
+                       strerror(errno));
+            }
+            return;
+        }
+
+        if (msg.resp != SUCC
+            && msg.resp != GAMEOVR
+            && msg.resp != GAMOVRACK) {
+
+            // error not able to handle
+            return;
+        }
+
+        if (sess->flags & REC_PVP) {
+            relay_move(sockfd, sess, addr, msg.move);
+            return;
+        }
+
+        if (log_level >= LOG_INFO) {
+            set_style(stdout, "\033[2J\033[H");
+            fflush(stdout);
+        }
+
+        int move, winner;
+        int resp = play_turn(sess, msg.move, &move, &winner);
+        if (resp == EINVMOVE) {
+            errmsg("Received invalid move, send back response\n");
+            heavy_error(addr);
+        } else if (resp == GAMOVRACK) {
+            infomsg("Server lost\n");
+        } else if (resp == GAMEOVR) {
+            infomsg("Sending move with winning message\n");
+        } else {
+            infomsg("Sending move to client\n");
+        }
+
+        rc = send_move(sockfd, sess, move, resp);
+        if (rc <= 0) {
+            errmsg("Failed to send message to client: %s\n",
+                   strerror(errno));
+        }
+
+        if (resp == GAMEOVR || resp == GAMOVRACK) {
+            finish_game(sess, winner);
+
+            // remove session from the list
+            list_del(&sess->list);
+            free_session(sess);
+        }
+    }
+}
+
+void expire_sessions(int sockfd, struct list_head *sessions)
+{
+    uint64_t now = mono_ms();
+    uint64_t idle = (uint64_t)session_timeout * 1000;
+    struct session *sess, *next;
+
+    list_for_each_entry_safe(sess, next, sessions, list) {
+        if (now - sess->last_active > idle) {
+            infomsg("Game %d timed out, dropping session\n", sess->game_id);
+            if (sess->flags & REC_PVP) {
+                // the player still waiting for a move would wait forever
+                send_move_to(sockfd, sess, sess->peer, 0, GAMEOVR);
+                send_move(sockfd, sess, 0, GAMEOVR);
+            }
+            finish_game(sess, 0);
+            list_del(&sess->list);
+            free_session(sess);
+            stats.expired++;
+        }
+    }
+    match_expire();
+}
+
+void end_local_games(int sockfd, struct list_head *sessions)
+{
+    struct session *sess, *next;
+
+    list_for_each_entry_safe(sess, next, sessions, list) {
+        bool local_peer = (sess->flags & REC_PVP) && local_addr(sess->peer);
+        if (!local_addr(sess->client) && !local_peer) {
+            continue;
+        }
+        infomsg("Game %d has a local player, ending it\n", sess->game_id);
+        if (sess->flags & REC_PVP) {
+            send_move_to(sockfd, sess, sess->peer, 0, GAMEOVR);
+        }
+        send_move(sockfd, sess, 0, GAMEOVR);
+        finish_game(sess, 0);
+        list_del(&sess->list);
+        free_session(sess);
+    }
+}
+
+/**
+ * Play the server move of session @sess and store it in @move, 0 if the
+ * board is full
+ * Return checkwin() of the board after the move
+ */
+static int server_move(struct session *sess, int *move)
+{
+    TRACE_BEGIN(engine, sess->game_id);
+    *move = gen_move_with(dispatch_engine(), sess->board, &sess->rng);
+    TRACE_END(engine, sess->game_id);
+
+    if (*move < 0) {
+        // a resumed board without a free spot, the game is already over
+        *move = 0;
+        return checkwin(sess->board);
+    }
+
+    TRACE_BEGIN(play, sess->game_id);
+    play_move(1, *move, sess->board);
+    record_move(sess, *move);
+    int winner = checkwin(sess->board);
+    TRACE_END(play, sess->game_id);
+    spectator_publish(sess, 1, *move, winner);
+
+    TRACE_BEGIN(log, sess->game_id);
+    print_board(sess->board, log_file);
+    TRACE_END(log, sess->game_id);
+
+    return winner;
+}
+
+/**
+ * Play client @move in session @sess and answer it with a server move
+ * Return the response code for the client, @reply is the server move, 0 if
+ * none, and @winner is checkwin() of the resulting board
+ */
+static int play_turn(struct session *sess, int move, int *reply, int *winner)
+{
+    *reply = 0;
+    *winner = 0;
+
+    TRACE_BEGIN(play, sess->game_id);
+    bool valid = play_move(2, move, sess->board);
+    if (valid) {
+        record_move(sess, move);
+        *winner = checkwin(sess->board);
+    }
+    TRACE_END(play, sess->game_id);
+
+    if (!valid) {
+        stats.invalid_moves++;
+        return EINVMOVE;
+    }
+
+    TRACE_BEGIN(log, sess->game_id);
+    print_board(sess->board, log_file);
+    TRACE_END(log, sess->game_id);
+
+    ++(sess->turn);
+    spectator_publish(sess, 2, move, *winner);
+
+    if (*winner != 0) {
+        return GAMOVRACK;
+    }
+
+    // the server move is published with the turn it leads to, like the
+    // client move above
+    ++(sess->turn);
+    *winner = server_move(sess, reply);
+
+    return (*winner == 0) ? SUCC : GAMEOVR;
+}
+
+/**
+ * Pair client @addr with the longest waiting player, or queue it until the
+ * next one asks. The waiting player moves first and is told so with a move
+ * of 0, the other hears of the game with that first move
+ */
+static void start_match(int sockfd, struct sockaddr_in addr,
+                        struct list_head *sessions)
+{
+    struct sockaddr_in opponent;
+    struct session *sess = NULL;
+    int rc = match_join(addr, &opponent);
+    if (rc > 0) {
+        sess = mem_alloc(MEM_SESSIONS, sizeof(struct session));
+        if (init_session(sess, addr, VERSION) < 0) {
+            // no game ID left, both wait for a game to end
+            mem_free(MEM_SESSIONS, sess);
+            match_wait(opponent, true);
+            rc = match_wait(addr, false);
+        }
+    }
+    if (rc == 0) {
+        infomsg("Client waiting for an opponent\n");
+        return;
+    } else if (rc < 0) {
+        errmsg("Matchmaking queue full, send busy response code\n");
+        stats.busy++;
+        struct message reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.version = VERSION;
+        reply.resp = EBUSYGAME;
+        sendmsg_to(sockfd, addr, reply);
+        return;
+    }
+
+    add_peer(sess, opponent);
+    INIT_LIST_HEAD(&sess->list);
+    list_add(&sess->list, sessions);
+    stats.games_new++;
+    infomsg("Matched game ID %d\n", sess->game_id);
+
+    if (send_move_to(sockfd, sess, opponent, 0, SUCC) <= 0) {
+        errmsg("Unable to send initial message: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Player of player-vs-player session @sess on turn, 1 for the peer, who
+ * moves first, 2 for the client
+ */
+static inline int turn_player(const struct session *sess)
+{
+    return (sess->turn % 2 == 0) ? 1 : 2;
+}
+
+/**
+ * Send player @addr of session @sess the last move of its opponent again,
+ * if @addr is on turn and so waiting for it
+ */
+static void relay_pending(int sockfd, const struct session *sess,
+                          struct sockaddr_in addr)
+{
+    int player = equal_addr(addr, sess->peer) ? 1 : 2;
+    if (player != turn_player(sess)) {
+        return;
+    }
+
+    int last = sess->nmoves ? (sess->moves >> (4 * (sess->nmoves - 1))) & 0xf
+                            : 0;
+    send_move_to(sockfd, sess, addr, last, SUCC);
+}
+
+/**
+ * Play @move of player @addr in player-vs-player session @sess, arbitrated
+ * like a move against the server, and relay it to the opponent. The mover
+ * hears back with the reply move of the opponent, or at once if the move
+ * was invalid or ended the game
+ */
+static void relay_move(int sockfd, struct session *sess,
+                       struct sockaddr_in addr, int move)
+{
+    int player = equal_addr(addr, sess->peer) ? 1 : 2;
+    struct sockaddr_in opponent = (player == 1) ? sess->client : sess->peer;
+
+    if (player != turn_player(sess)) {
+        // a retransmission while the opponent thinks, its move answers it
+        return;
+    }
+
+    int winner = 0;
+    TRACE_BEGIN(play, sess->game_id);
+    bool valid = play_move(player, move, sess->board);
+    if (valid) {
+        record_move(sess, move);
+        winner = checkwin(sess->board);
+    }
+    TRACE_END(play, sess->game_id);
+
+    if (!valid) {
+        int own = (sess->nmoves >= 2)
+            ? (sess->moves >> (4 * (sess->nmoves - 2))) & 0xf : 0;
+        if (move == own) {
+            // the relayed reply to this move was lost, not the move itself
+            relay_pending(sockfd, sess, addr);
+            return;
+        }
+        errmsg("Received invalid move, send back response\n");
+        stats.invalid_moves++;
+        heavy_error(addr);
+        send_move_to(sockfd, sess, addr, 0, EINVMOVE);
+        return;
+    }
+
+    TRACE_BEGIN(log, sess->game_id);
+    print_board(sess->board, log_file);
+    TRACE_END(log, sess->game_id);
+
+    ++(sess->turn);
+    sess->last_active = mono_ms();
+    spectator_publish(sess, player, move, winner);
+
+    if (winner != 0) {
+        infomsg("Relaying move with winning message\n");
+        send_move_to(sockfd, sess, addr, 0, GAMOVRACK);
+        send_move_to(sockfd, sess, opponent, move, GAMEOVR);
+        finish_game(sess, winner);
+        list_del(&sess->list);
+        free_session(sess);
+        return;
+    }
+
+    infomsg("Relaying move to opponent\n");
+    if (send_move_to(sockfd, sess, opponent, move, SUCC) <= 0) {
+        errmsg("Failed to send message to client: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Handle message @req of a stateless game from @addr, fill in @resp
+ * The session only lives for the duration of the call
+ */
+static void handle_cookie_game(struct sockaddr_in addr,
+                               const struct message_v5 *req,
+                               struct message_v5 *resp)
+{
+    struct session sess;
+    int move = 0, winner = 0;
+
+    if (req->cmd == NGAME || req->cmd == RGAME) {
+        cookie_start(&sess, addr, (req->cmd == RGAME) ? req->board : NULL);
+        if (req->cmd == NGAME) {
+            stats.games_new++;
+        } else {
+            stats.games_resumed++;
+        }
+        stats.games_stateless++;
+
+        winner = server_move(&sess, &move);
+        resp->resp = (winner == 0) ? SUCC : GAMEOVR;
+    } else if (req->cmd == MOVE) {
+        if (cookie_open(&sess, addr, ntohl(req->game), req->board) < 0) {
+            errmsg("Received forged cookie for game %u\n", ntohl(req->game));
+            stats.bad_cookies++;
+            resp->resp = EGIDWRONG;
+            return;
+        }
+        resp->resp = play_turn(&sess, req->move, &move, &winner);
+    } else {
+        resp->resp = EINVREQ;
+        return;
+    }
+
+    resp->flags = MSG_COOKIE;
+    resp->move = move;
+    resp->game = htonl(sess.game_id);
+    resp->turn = htons(sess.turn);
+
+    if (resp->resp == GAMEOVR || resp->resp == GAMOVRACK) {
+        finish_game(&sess, winner);
+    } else {
+        cookie_make(&sess, resp->board);
+    }
+}
+
+/**
+ * Handle game message @req of a v5 datagram from @addr, fill in @resp
+ */
+static void handle_v5_game(struct sockaddr_in addr,
+                           const struct message_v5 *req,
+                           struct message_v5 *resp,
+                           struct list_head *sessions)
+{
+    struct session *sess;
+    int move = 0, winner = 0;
+
+    memset(resp, 0, sizeof(*resp));
+    resp->cmd = req->cmd;
+    resp->game = req->game;
+    resp->turn = req->turn;
+
+    if (cookie_mode && (req->flags & MSG_COOKIE) && req->cmd != NSERV) {
+        handle_cookie_game(addr, req, resp);
+        return;
+    }
+
+    switch (req->cmd) {
+    case NGAME:
+    case RGAME:
+        sess = mem_alloc(MEM_SESSIONS, sizeof(struct session));
+        if (req->cmd == NGAME) {
+            init_session(sess, addr, VERSION_V5);
+        } else {
+            clone_session(sess, addr, req->board, VERSION_V5);
+        }
+        if (sess->game_id < 0) {
+            stats.busy++;
+            mem_free(MEM_SESSIONS, sess);
+            resp->resp = EBUSYGAME;
+            return;
+        }
+
+        if (req->cmd == NGAME) {
+            stats.games_new++;
+        } else {
+            stats.games_resumed++;
+        }
+        winner = server_move(sess, &move);
+        resp->move = move;
+        resp->game = htonl(sess->game_id);
+        resp->turn = htons(sess->turn);
+
+        if (winner != 0) {
+            resp->resp = GAMEOVR;
+            finish_game(sess, winner);
+            free_session(sess);
+            return;
+        }
+
+        infomsg("Assigned v5 game ID %d, serial %llu\n", sess->game_id,
+                (unsigned long long)sess->serial);
+        INIT_LIST_HEAD(&sess->list);
+        list_add(&sess->list, sessions);
+        resp->resp = SUCC;
+        return;
+
+    case MOVE:
+        TRACE_BEGIN(lookup, -1);
+        sess = lookup_game(ntohl(req->game));
+        TRACE_END(lookup, -1);
+
+        // a game is only reachable from the address that started it
+        if (!sess || !(sess->flags & REC_V5) || !equal_addr(sess->client, addr)) {
+            errmsg("Received move for unknown game %u\n", ntohl(req->game));
+            stats.wrong_game++;
+            resp->resp = EGIDWRONG;
+            return;
+        }
+        sess->last_active = mono_ms();
+
+        int turn = ntohs(req->turn);
+        if (turn == (uint16_t)(sess->turn - 1)) {
+            // the reply to this move was lost, not the move itself
+            resp->resp = SUCC;
+            resp->move = sess->nmoves
+                ? (sess->moves >> (4 * (sess->nmoves - 1))) & 0xf : 0;
+            resp->turn = htons(sess->turn);
+            return;
+        } else if (turn != (uint16_t)(sess->turn + 1)) {
+            errmsg("Received move out of turn for game %d\n", sess->game_id);
+            stats.out_of_sync++;
+            resp->resp = EOSYNC;
+            return;
+        }
+
+        resp->resp = play_turn(sess, req->move, &move, &winner);
+        resp->move = move;
+        resp->turn = htons(sess->turn);
+
+        if (resp->resp == GAMEOVR || resp->resp == GAMOVRACK) {
+            finish_game(sess, winner);
+            list_del(&sess->list);
+            free_session(sess);
+        }
+        return;
+
+    case NSERV:
+        stats.probes++;
+        resp->resp = SPOTAVAIL;
+        return;
+
+    default:
+        resp->resp = EINVREQ;
+        return;
+    }
+}
+
+/**
+ * Handle the v5 datagram @pkt of @len bytes from @addr, every game message
+ * is answered in order within a single reply datagram
+ */
+static void handle_v5(int sockfd, struct sockaddr_in addr, const char *pkt,
+                      int len, struct list_head *sessions)
+{
+    struct header_v5 hdr;
+    char out[MAX_PACKET];
+
+    if ((size_t)len < sizeof(hdr)) {
+        return;
+    }
+    memcpy(&hdr, pkt, sizeof(hdr));
+
+    // ignore trailing partial messages rather than the whole batch
+    int count = (len - sizeof(hdr)) / sizeof(struct message_v5);
+    if (count > hdr.count) {
+        count = hdr.count;
+    }
+    if (count > MAX_BATCH) {
+        count = MAX_BATCH;
+    }
+    infomsg("Received v5 batch of %d game messages\n", count);
+
+    for (int i = 0; i < count; ++i) {
+        struct message_v5 req, resp;
+        memcpy(&req, pkt + sizeof(hdr) + i * sizeof(req), sizeof(req));
+        handle_v5_game(addr, &req, &resp, sessions);
+        if (resp.resp == EINVMOVE || resp.resp == EGIDWRONG
+            || resp.resp == EINVREQ) {
+            heavy_error(addr);
+        }
+        memcpy(out + sizeof(hdr) + i * sizeof(resp), &resp, sizeof(resp));
+    }
+
+    hdr.version = VERSION_V5;
+    hdr.count = count;
+    memcpy(out, &hdr, sizeof(hdr));
+
+    int rc = send_packet(sockfd, addr, out,
+                         sizeof(hdr) + count * sizeof(struct message_v5));
+    if (rc <= 0) {
+        errmsg("Unable to send v5 response: %s\n", strerror(errno));
+    }
+}
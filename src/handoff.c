@@ -0,0 +1,315 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+#include "network.h"
+#include "archive.h"
+#include "game.h"
+#include "cookie.h"
+#include "mem.h"
+
+#define HANDOFF_MAGIC 0x37464f48 // "HOF7"
+#define HANDOFF_ACK   'K'
+#define ACK_TIMEOUT   5000       // ms to wait for the new process to adopt
+
+struct handoff_header
+{
+    uint32_t magic;
+    uint32_t nsessions;
+    uint64_t cookie_key[2]; // stateless games outlive the process
+    uint32_t cookie_next;   // and so do their game IDs
+    uint64_t move_seed;     // and so do the moves of every game
+    uint64_t games_started; // serials go on where the old process stopped
+};
+
+// Session as streamed to the new process, independent of struct layout
+struct handoff_session
+{
+    int32_t game_id;
+    int32_t turn;
+    uint32_t addr;  // network order
+    uint16_t port;  // network order
+    uint32_t peer_addr; // player 1 of a player-vs-player game
+    uint16_t peer_port;
+    uint8_t flags;
+    uint8_t nmoves;
+    uint64_t start;
+    uint64_t moves;
+    uint64_t serial;
+    uint32_t rng[4]; // move generator, halfway through the game
+    char board[NROWS * NCOLS];
+} __attribute__((packed));
+
+static int unix_addr(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errmsg("Hot restart socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/**
+ * Write or read exactly @len bytes, return false on error or EOF
+ */
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t rc = write(fd, p, len);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        p += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t rc = read(fd, p, len);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        p += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+int handoff_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (unix_addr(&addr, path) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        errmsg("Unable to create hot restart socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(fd, 1) < 0) {
+        errmsg("Unable to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    infomsg("Listening for hot restart on %s\n", path);
+    return fd;
+}
+
+int handoff_send(int listenfd, const char *path, int sockfd, int mcfd,
+                 struct list_head *sessions)
+{
+    int fd = accept(listenfd, NULL, NULL);
+    if (fd < 0) {
+        errmsg("Unable to accept hot restart request: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // the new process binds the path again once the transfer is done
+    unlink(path);
+
+    struct handoff_header hdr = { HANDOFF_MAGIC, 0 };
+    hdr.cookie_next = cookie_key(hdr.cookie_key);
+    hdr.move_seed = move_seed;
+    hdr.games_started = games_started;
+    // games of local peers were ended by end_local_games()
+    struct session *sess;
+    list_for_each_entry(sess, sessions, list) {
+        hdr.nsessions++;
+    }
+
+    // the header carries both sockets as ancillary data
+    int fds[2] = { sockfd, mcfd };
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    memset(cbuf, 0, sizeof(cbuf));
+
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &mh, 0) != sizeof(hdr)) {
+        errmsg("Unable to hand over sockets: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    list_for_each_entry(sess, sessions, list) {
+        struct handoff_session rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.game_id = sess->game_id;
+        rec.turn = sess->turn;
+        rec.addr = sess->client.sin_addr.s_addr;
+        rec.port = sess->client.sin_port;
+        rec.peer_addr = sess->peer.sin_addr.s_addr;
+        rec.peer_port = sess->peer.sin_port;
+        rec.flags = sess->flags;
+        rec.nmoves = sess->nmoves;
+        rec.start = sess->start;
+        rec.moves = sess->moves;
+        rec.serial = sess->serial;
+        memcpy(rec.rng, sess->rng.s, sizeof(rec.rng));
+        memcpy(rec.board, sess->board, sizeof(rec.board));
+
+        if (!write_all(fd, &rec, sizeof(rec))) {
+            errmsg("Unable to hand over session %d: %s\n",
+                   sess->game_id, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    // the new process acknowledges once it adopted everything, and only
+    // starts serving after our reply, so exactly one of us keeps serving
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char ack = 0;
+    if (poll(&pfd, 1, ACK_TIMEOUT) != 1 || read(fd, &ack, 1) != 1
+        || ack != HANDOFF_ACK || send(fd, &ack, 1, MSG_NOSIGNAL) != 1) {
+        errmsg("New process did not take over the sessions\n");
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    infomsg("Handed over sockets and %u sessions\n", hdr.nsessions);
+    return hdr.nsessions;
+}
+
+int handoff_receive(const char *path, int *sockfd, int *mcfd,
+                    struct list_head *sessions)
+{
+    struct sockaddr_un addr;
+    if (unix_addr(&addr, path) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        errmsg("Unable to create hot restart socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        errmsg("Unable to reach running server at %s: %s\n",
+               path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    infomsg("Taking over from running server at %s\n", path);
+
+    struct handoff_header hdr;
+    int fds[2];
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    ssize_t rc = recvmsg(fd, &mh, MSG_WAITALL);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (rc != sizeof(hdr) || hdr.magic != HANDOFF_MAGIC || !cmsg
+        || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        errmsg("Invalid hot restart handshake\n");
+        close(fd);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    *sockfd = fds[0];
+    *mcfd = fds[1];
+    cookie_init(hdr.cookie_key, hdr.cookie_next);
+    seed_moves(hdr.move_seed);
+    games_started = hdr.games_started;
+
+    int count = 0;
+    for (uint32_t i = 0; i < hdr.nsessions; ++i) {
+        struct handoff_session rec;
+        if (!read_all(fd, &rec, sizeof(rec))) {
+            errmsg("Hot restart stream ended after %d sessions\n", count);
+            close(fd);
+            return -1;
+        }
+
+        struct session *sess = mem_alloc(MEM_SESSIONS, sizeof(struct session));
+        memset(sess, 0, sizeof(*sess));
+        sess->game_id = rec.game_id;
+        sess->turn = rec.turn;
+        sess->client.sin_family = AF_INET;
+        sess->client.sin_addr.s_addr = rec.addr;
+        sess->client.sin_port = rec.port;
+        if (rec.flags & REC_PVP) {
+            sess->peer.sin_family = AF_INET;
+            sess->peer.sin_addr.s_addr = rec.peer_addr;
+            sess->peer.sin_port = rec.peer_port;
+        }
+        sess->flags = rec.flags;
+        sess->nmoves = rec.nmoves;
+        sess->start = rec.start;
+        sess->moves = rec.moves;
+        sess->serial = rec.serial;
+        memcpy(sess->rng.s, rec.rng, sizeof(sess->rng.s));
+        sess->last_active = mono_ms();
+        memcpy(sess->board, rec.board, sizeof(sess->board));
+
+        if (adopt_session(sess) < 0) {
+            errmsg("Duplicated game ID %d in hot restart, dropped\n",
+                   rec.game_id);
+            mem_free(MEM_SESSIONS, sess);
+            continue;
+        }
+
+        INIT_LIST_HEAD(&sess->list);
+        list_add(&sess->list, sessions);
+        count++;
+    }
+
+    // the old process answers the ack once it stops serving, without the
+    // answer it gave up on us and keeps serving
+    char ack = HANDOFF_ACK;
+    if (send(fd, &ack, 1, MSG_NOSIGNAL) != 1 || !read_all(fd, &ack, 1)
+        || ack != HANDOFF_ACK) {
+        errmsg("Running server did not release the sessions\n");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    infomsg("Took over %d sessions\n", count);
+    return count;
+}
@@ -0,0 +1,246 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "heavy.h"
+#include "hash.h"
+#include "network.h"
+#include "stats.h"
+
+#define DEPTH      4   // rows of a sketch, one hash each
+#define WIDTH_BITS 12  // counters in a row, 2^WIDTH_BITS
+#define WINDOW_MS  1000
+
+struct hitter
+{
+    uint32_t addr;  // IPv4 source, network order
+    uint32_t count; // estimate in the window
+};
+
+struct sketch
+{
+    const char *name;
+    uint32_t rows[DEPTH][1 << WIDTH_BITS];
+    struct hitter top[HEAVY_TOPK]; // min-heap on count
+    int ntop;
+    uint64_t total;
+    struct hitter last[HEAVY_TOPK]; // heaviest of the last window, sorted
+    int nlast;
+    uint64_t last_total;
+};
+
+int throttle_requests = 0;
+int throttle_errors = 0;
+
+static struct sketch requests = { .name = "requests" };
+static struct sketch errors = { .name = "errors" };
+
+static uint64_t key;         // hash key, random so sources cannot collide
+static uint64_t window_start; // ms
+static uint64_t last_window;  // length of the last window, ms
+
+/**
+ * Hash of @addr, the rows take WIDTH_BITS each out of it
+ */
+static inline uint64_t hash(uint32_t addr)
+{
+    if (key == 0) {
+        int fd = open("/dev/urandom", O_RDONLY);
+        if (fd < 0 || read(fd, &key, sizeof(key)) != sizeof(key)) {
+            key = time_ms();
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        key |= 1;
+    }
+
+    return hash_mix(addr ^ key);
+}
+
+static void sift_down(struct hitter *heap, int n, int i)
+{
+    for (;;) {
+        int min = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && heap[l].count < heap[min].count)
+            min = l;
+        if (r < n && heap[r].count < heap[min].count)
+            min = r;
+        if (min == i)
+            return;
+        struct hitter t = heap[i];
+        heap[i] = heap[min];
+        heap[min] = t;
+        i = min;
+    }
+}
+
+static void sift_up(struct hitter *heap, int i)
+{
+    while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+        struct hitter t = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * Count one event of source @addr in @s and return its estimate. Only the
+ * smallest counters of the source grow, which keeps the estimate as tight
+ * as the colliding sources allow
+ */
+static uint32_t count(struct sketch *s, uint32_t addr)
+{
+    const uint32_t mask = (1 << WIDTH_BITS) - 1;
+    uint64_t h = hash(addr);
+    uint32_t *c[DEPTH], v[DEPTH];
+    uint32_t est = UINT32_MAX;
+
+    for (int d = 0; d < DEPTH; ++d) {
+        c[d] = &s->rows[d][(h >> (d * WIDTH_BITS)) & mask];
+        v[d] = *c[d];
+        est = (v[d] < est) ? v[d] : est;
+    }
+    // without branches, which would mispredict about half the time
+    for (int d = 0; d < DEPTH; ++d) {
+        *c[d] = v[d] + (v[d] == est);
+    }
+    est++;
+    s->total++;
+
+    // most sources never reach the heap
+    if (s->ntop == HEAVY_TOPK && est <= s->top[0].count) {
+        return est;
+    }
+    for (int i = 0; i < s->ntop; ++i) {
+        if (s->top[i].addr == addr) {
+            s->top[i].count = est;
+            sift_down(s->top, s->ntop, i);
+            return est;
+        }
+    }
+    if (s->ntop < HEAVY_TOPK) {
+        s->top[s->ntop] = (struct hitter){ addr, est };
+        sift_up(s->top, s->ntop++);
+    } else {
+        s->top[0] = (struct hitter){ addr, est };
+        sift_down(s->top, s->ntop, 0);
+    }
+    return est;
+}
+
+/**
+ * Estimate of source @addr in @s, without counting
+ */
+static uint32_t estimate(const struct sketch *s, uint32_t addr)
+{
+    const uint32_t mask = (1 << WIDTH_BITS) - 1;
+    uint64_t h = hash(addr);
+    uint32_t est = UINT32_MAX;
+    for (int d = 0; d < DEPTH; ++d) {
+        uint32_t c = s->rows[d][(h >> (d * WIDTH_BITS)) & mask];
+        if (c < est)
+            est = c;
+    }
+    return est;
+}
+
+bool heavy_request(struct sockaddr_in addr)
+{
+    uint32_t src = addr.sin_addr.s_addr;
+    uint32_t n = count(&requests, src);
+    if (throttle_requests > 0 && n > (uint32_t)throttle_requests) {
+        return true;
+    }
+    return throttle_errors > 0
+        && estimate(&errors, src) > (uint32_t)throttle_errors;
+}
+
+void heavy_error(struct sockaddr_in addr)
+{
+    count(&errors, addr.sin_addr.s_addr);
+}
+
+static int by_count(const void *a, const void *b)
+{
+    const struct hitter *x = a, *y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static void roll(struct sketch *s)
+{
+    memcpy(s->last, s->top, s->ntop * sizeof(s->top[0]));
+    s->nlast = s->ntop;
+    qsort(s->last, s->nlast, sizeof(s->last[0]), by_count);
+    s->last_total = s->total;
+
+    memset(s->rows, 0, sizeof(s->rows));
+    s->ntop = 0;
+    s->total = 0;
+}
+
+void heavy_roll()
+{
+    uint64_t now = mono_ms();
+    if (window_start == 0) {
+        window_start = now;
+    }
+    if (now - window_start < WINDOW_MS) {
+        return;
+    }
+    last_window = now - window_start;
+    window_start = now;
+    roll(&requests);
+    roll(&errors);
+}
+
+static void dump_list(FILE *f, const struct hitter *list, int n, uint64_t ms)
+{
+    for (int i = 0; i < n; ++i) {
+        char buf[INET_ADDRSTRLEN];
+        struct in_addr a = { list[i].addr };
+        inet_ntop(AF_INET, &a, buf, sizeof(buf));
+        if (ms) {
+            fprintf(f, "  %-15s %10u %10.0f/s\n", buf, list[i].count,
+                    list[i].count * 1000.0 / ms);
+        } else {
+            fprintf(f, "  %-15s %10u\n", buf, list[i].count);
+        }
+    }
+}
+
+static void dump_sketch(FILE *f, const struct sketch *s, uint64_t now)
+{
+    if (last_window) {
+        fprintf(f, "%s, last window %.2f s, %llu total\n", s->name,
+                last_window / 1000.0, (unsigned long long)s->last_total);
+        dump_list(f, s->last, s->nlast, last_window);
+    }
+
+    struct hitter top[HEAVY_TOPK];
+    memcpy(top, s->top, s->ntop * sizeof(top[0]));
+    qsort(top, s->ntop, sizeof(top[0]), by_count);
+    fprintf(f, "%s, current window %.2f s, %llu total\n", s->name,
+            (now - window_start) / 1000.0, (unsigned long long)s->total);
+    dump_list(f, top, s->ntop, 0);
+}
+
+void heavy_dump(FILE *f)
+{
+    uint64_t now = mono_ms();
+    if (window_start == 0) {
+        window_start = now;
+    }
+    fprintf(f, "throttle %d requests/s, %d errors/s per source, %llu dropped\n",
+            throttle_requests, throttle_errors,
+            (unsigned long long)stats.throttled);
+    dump_sketch(f, &requests, now);
+    dump_sketch(f, &errors, now);
+}
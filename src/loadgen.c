@@ -0,0 +1,463 @@
+/**
+ * File: loadgen.c
+ * Load generator for the tictactoe server
+ *
+ * Runs many concurrent clients, each playing random legal moves game after
+ * game for a fixed duration. A request that is not answered within the
+ * timeout is counted as lost and the client starts over from a new address,
+ * so the loss rate covers restarts and network impairment alike.
+ *
+ * With -g, clients speak protocol v5 and each one plays several games from
+ * the same address, sending the moves of all its games in one datagram. -C
+ * asks for stateless games and echoes the cookie of every reply.
+ *
+ * With -u, clients talk to the local socket of a server on the same host
+ * instead of UDP, each from its own autobound abstract name. The CPU time
+ * of the generator is reported per request for comparing the transports.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+
+#include "network.h"
+
+#define PROTO_VERSION 4
+#define MAX_GAMES 64 // games per client in v5 mode, MAX_BATCH
+#define HIST_US 100000 // latency histogram range, 1us buckets
+
+enum State
+{
+    IDLE,    // about to start a game
+    WAITING, // request in flight
+};
+
+struct game
+{
+    uint32_t id;
+    uint16_t turn;
+    uint8_t cmd;               // next request
+    uint8_t move;
+    uint8_t flags;             // MSG_COOKIE once the server sent a cookie
+    char board[NROWS * NCOLS]; // 0 free, 1 server, 2 client
+    char cookie[NROWS * NCOLS];
+};
+
+struct client
+{
+    int fd;
+    enum State state;
+    uint8_t game;
+    uint8_t turn;
+    char board[NROWS * NCOLS]; // 0 free, 1 server, 2 client
+    uint64_t sent;             // send time of the request in flight, ns
+    struct game *games;        // v5 games, NULL in v4 mode
+};
+
+static struct
+{
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t lost;
+    uint64_t errors;
+    uint64_t games;
+    uint64_t hist[HIST_US + 1];
+    uint64_t max_ns;
+} st;
+
+static struct addrinfo *server;
+static struct sockaddr_un local_server; // with -u, instead of @server
+static unsigned int seed;
+static int games_per_client = 0; // v5 games per client, 0 for v4
+static bool stateless = false;   // ask for stateless v5 games
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int open_client()
+{
+    if (local_server.sun_family == AF_UNIX) {
+        // a name of the kernel's choosing, the server needs one to reply
+        sa_family_t autobind = AF_UNIX;
+        int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (fd < 0
+            || bind(fd, (struct sockaddr *)&autobind, sizeof(autobind)) < 0
+            || connect(fd, (struct sockaddr *)&local_server,
+                       sizeof(local_server)) < 0) {
+            fprintf(stderr, "Unable to create client socket: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+        return fd;
+    }
+
+    int fd = socket(server->ai_family, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, server->ai_addr, server->ai_addrlen) < 0) {
+        fprintf(stderr, "Unable to create client socket: %s\n", strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+static void send_request(struct client *c, int cmd, int move)
+{
+    struct message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.version = PROTO_VERSION;
+    msg.cmd = cmd;
+    msg.move = move;
+    msg.turn = c->turn;
+    msg.game = c->game;
+
+    c->sent = now_ns();
+    c->state = WAITING;
+    if (send(c->fd, &msg, sizeof(msg), 0) == sizeof(msg)) {
+        st.requests++;
+    }
+}
+
+static void new_game(struct client *c)
+{
+    memset(c->board, 0, sizeof(c->board));
+    c->turn = 0;
+    c->game = 0;
+    send_request(c, NGAME, 0);
+}
+
+static void record_latency(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    st.hist[us < HIST_US ? us : HIST_US]++;
+    if (ns > st.max_ns)
+        st.max_ns = ns;
+}
+
+/**
+ * Pick a random free cell of @board, -1 if it is full
+ */
+static int random_cell(const char *board)
+{
+    int free_cells[NROWS * NCOLS], nfree = 0;
+    for (int i = 0; i < NROWS * NCOLS; ++i) {
+        if (board[i] == 0)
+            free_cells[nfree++] = i;
+    }
+    return nfree ? free_cells[rand_r(&seed) % nfree] : -1;
+}
+
+static void handle_reply(struct client *c)
+{
+    struct message msg;
+    ssize_t rc = recv(c->fd, &msg, sizeof(msg), 0);
+    if (rc < 6 || c->state != WAITING) {
+        return;
+    }
+
+    st.responses++;
+    record_latency(now_ns() - c->sent);
+    c->state = IDLE;
+
+    if (msg.move >= 1 && msg.move <= NROWS * NCOLS) {
+        c->board[msg.move - 1] = 1;
+    }
+
+    if (msg.resp == GAMEOVR || msg.resp == GAMOVRACK) {
+        st.games++;
+        new_game(c);
+        return;
+    } else if (msg.resp != SUCC) {
+        st.errors++;
+        close(c->fd);
+        c->fd = open_client();
+        new_game(c);
+        return;
+    }
+
+    c->game = msg.game;
+    c->turn = msg.turn + 1;
+
+    int cell = random_cell(c->board);
+    if (cell < 0) {
+        new_game(c);
+        return;
+    }
+
+    c->board[cell] = 2;
+    send_request(c, MOVE, cell + 1);
+}
+
+static void reset_game(struct game *g)
+{
+    memset(g, 0, sizeof(*g));
+    g->cmd = NGAME;
+    g->flags = stateless ? MSG_COOKIE : 0;
+}
+
+/**
+ * Send the next request of every game of v5 client @c in one datagram
+ */
+static void send_batch(struct client *c)
+{
+    char pkt[MAX_PACKET];
+    struct header_v5 hdr = { VERSION_V5, games_per_client };
+    memcpy(pkt, &hdr, sizeof(hdr));
+
+    for (int i = 0; i < games_per_client; ++i) {
+        struct game *g = &c->games[i];
+        struct message_v5 msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.cmd = g->cmd;
+        msg.move = g->move;
+        msg.flags = g->flags;
+        msg.turn = htons(g->turn);
+        msg.game = htonl(g->id);
+        if (g->cmd == MOVE && (g->flags & MSG_COOKIE))
+            memcpy(msg.board, g->cookie, sizeof(msg.board));
+        memcpy(pkt + sizeof(hdr) + i * sizeof(msg), &msg, sizeof(msg));
+    }
+
+    size_t len = sizeof(hdr) + games_per_client * sizeof(struct message_v5);
+    c->sent = now_ns();
+    c->state = WAITING;
+    if (send(c->fd, pkt, len, 0) == (ssize_t)len) {
+        st.requests += games_per_client;
+    }
+}
+
+static void start_batch(struct client *c)
+{
+    for (int i = 0; i < games_per_client; ++i)
+        reset_game(&c->games[i]);
+    send_batch(c);
+}
+
+static void handle_batch(struct client *c)
+{
+    char pkt[MAX_PACKET];
+    struct header_v5 hdr;
+    ssize_t rc = recv(c->fd, pkt, sizeof(pkt), 0);
+    if (rc < (ssize_t)sizeof(hdr) || c->state != WAITING) {
+        return;
+    }
+    memcpy(&hdr, pkt, sizeof(hdr));
+    if (hdr.version != VERSION_V5 || hdr.count != games_per_client
+        || rc < (ssize_t)(sizeof(hdr) + hdr.count * sizeof(struct message_v5))) {
+        st.errors++;
+        return;
+    }
+
+    // every game in the batch waited as long as the datagram
+    uint64_t ns = now_ns() - c->sent;
+    for (int i = 0; i < games_per_client; ++i)
+        record_latency(ns);
+    st.responses += games_per_client;
+    c->state = IDLE;
+
+    for (int i = 0; i < games_per_client; ++i) {
+        struct game *g = &c->games[i];
+        struct message_v5 msg;
+        memcpy(&msg, pkt + sizeof(hdr) + i * sizeof(msg), sizeof(msg));
+
+        if (msg.move >= 1 && msg.move <= NROWS * NCOLS) {
+            g->board[msg.move - 1] = 1;
+        }
+
+        if (msg.resp == GAMEOVR || msg.resp == GAMOVRACK) {
+            st.games++;
+            reset_game(g);
+            continue;
+        } else if (msg.resp != SUCC) {
+            st.errors++;
+            reset_game(g);
+            continue;
+        }
+
+        g->id = ntohl(msg.game);
+        g->turn = ntohs(msg.turn) + 1;
+        g->flags = msg.flags & MSG_COOKIE;
+        memcpy(g->cookie, msg.board, sizeof(g->cookie));
+
+        int cell = random_cell(g->board);
+        if (cell < 0) {
+            reset_game(g);
+            continue;
+        }
+        g->board[cell] = 2;
+        g->cmd = MOVE;
+        g->move = cell + 1;
+    }
+
+    send_batch(c);
+}
+
+static double percentile(double p)
+{
+    uint64_t target = (uint64_t)(p * st.responses), seen = 0;
+    for (int us = 0; us <= HIST_US; ++us) {
+        seen += st.hist[us];
+        if (seen > target)
+            return us;
+    }
+    return HIST_US;
+}
+
+int main(int argc, char *argv[])
+{
+    int nclients = 16;
+    int duration = 10;
+    int timeout_ms = 500;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:Cd:g:t:u:")) != -1) {
+        switch (opt) {
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        case 'C':
+            stateless = true;
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'g':
+            games_per_client = atoi(optarg);
+            break;
+        case 't':
+            timeout_ms = atoi(optarg);
+            break;
+        case 'u':
+            if (strlen(optarg) >= sizeof(local_server.sun_path))
+                goto usage;
+            local_server.sun_family = AF_UNIX;
+            strcpy(local_server.sun_path, optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    bool local = local_server.sun_family == AF_UNIX;
+    if (argc - optind != (local ? 0 : 2) || nclients < 1
+        || games_per_client < 0 || games_per_client > MAX_GAMES
+        || (stateless && !games_per_client)) {
+    usage:
+        fprintf(stderr, "Usage: %s [-c clients] [-d seconds] [-g games [-C]] "
+                "[-t timeout-ms] <host port | -u socket>\n", argv[0]);
+        exit(1);
+    }
+
+    if (!local) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        int status = getaddrinfo(argv[optind], argv[optind + 1], &hints,
+                                 &server);
+        if (status != 0) {
+            fprintf(stderr, "Unable to resolve server: %s\n",
+                    gai_strerror(status));
+            exit(1);
+        }
+    }
+
+    seed = time(NULL);
+    struct client *clients = calloc(nclients, sizeof(*clients));
+    struct pollfd *pfds = calloc(nclients, sizeof(*pfds));
+    for (int i = 0; i < nclients; ++i) {
+        clients[i].fd = open_client();
+        if (games_per_client) {
+            clients[i].games = calloc(games_per_client, sizeof(struct game));
+            start_batch(&clients[i]);
+        } else {
+            new_game(&clients[i]);
+        }
+    }
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)duration * 1000000000;
+    uint64_t timeout = (uint64_t)timeout_ms * 1000000;
+
+    uint64_t now;
+    while ((now = now_ns()) < end) {
+        for (int i = 0; i < nclients; ++i) {
+            pfds[i].fd = clients[i].fd;
+            pfds[i].events = POLLIN;
+        }
+
+        if (poll(pfds, nclients, 1) < 0 && errno != EINTR) {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        now = now_ns();
+        for (int i = 0; i < nclients; ++i) {
+            struct client *c = &clients[i];
+            if (pfds[i].revents & POLLIN) {
+                if (c->games)
+                    handle_batch(c);
+                else
+                    handle_reply(c);
+            } else if (c->state == WAITING && now - c->sent > timeout) {
+                // request or reply lost, abandon the game
+                close(c->fd);
+                c->fd = open_client();
+                if (c->games) {
+                    st.lost += games_per_client;
+                    start_batch(c);
+                } else {
+                    st.lost++;
+                    new_game(c);
+                }
+            }
+        }
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+
+    double secs = (now - start) / 1e9;
+    printf("duration      %.2f s, %d clients", secs, nclients);
+    if (games_per_client)
+        printf(", v5 with %d %sgames each", games_per_client,
+               stateless ? "stateless " : "");
+    printf("\n");
+    printf("games         %llu (%.1f/s)\n",
+           (unsigned long long)st.games, st.games / secs);
+    printf("requests      %llu (%.1f/s)\n",
+           (unsigned long long)st.requests, st.requests / secs);
+    printf("lost          %llu (%.4f%%)\n", (unsigned long long)st.lost,
+           st.requests ? 100.0 * st.lost / st.requests : 0.0);
+    printf("errors        %llu\n", (unsigned long long)st.errors);
+    printf("latency us    p50 %.0f  p90 %.0f  p99 %.0f  p999 %.0f  max %.0f\n",
+           percentile(0.5), percentile(0.9), percentile(0.99),
+           percentile(0.999), st.max_ns / 1e3);
+    printf("client cpu    %.2f s (%.1f us/request)\n", cpu,
+           st.requests ? cpu * 1e6 / st.requests : 0.0);
+
+    for (int i = 0; i < nclients; ++i) {
+        close(clients[i].fd);
+        free(clients[i].games);
+    }
+    free(clients);
+    free(pfds);
+    if (server)
+        freeaddrinfo(server);
+
+    return 0;
+}
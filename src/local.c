@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "local.h"
+#include "network.h"
+#include "game.h"
+#include "list.h"
+#include "mem.h"
+
+#define PEER_BITS 12 // peer hash table of 2^PEER_BITS buckets
+
+struct peer
+{
+    struct sockaddr_un addr;
+    socklen_t len;          // length of @addr, the name is not terminated
+    uint16_t gen;           // bumped every time the slot is reused
+    uint64_t last_seen;     // time of the last datagram, ms
+    struct list_head hash;  // name hash chain
+};
+
+int local_sockfd = -1;
+int local_udp_sockfd = -1;
+
+static char *local_path;
+static struct peer peers[MAX_LOCAL_PEERS]; // untouched slots cost no memory
+static int npeers = 0;    // slots taken so far, never shrinks
+static struct list_head buckets[1 << PEER_BITS];
+
+int local_listen(const char *path, int inet_sockfd)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errmsg("Local socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // a socket opened again keeps the peers, and their generations
+    if (npeers == 0) {
+        for (int i = 0; i < 1 << PEER_BITS; ++i) {
+            INIT_LIST_HEAD(&buckets[i]);
+        }
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        errmsg("Unable to create local socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        errmsg("Unable to bind local socket %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    local_path = mem_alloc(MEM_IO, strlen(path) + 1);
+    if (!local_path) {
+        errmsg("Out of memory for the local socket path\n");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    strcpy(local_path, path);
+    local_sockfd = fd;
+    local_udp_sockfd = inet_sockfd;
+    infomsg("Local socket listening on %s\n", path);
+    return fd;
+}
+
+void local_close()
+{
+    if (local_sockfd < 0) {
+        return;
+    }
+    close(local_sockfd);
+    unlink(local_path);
+    mem_free(MEM_IO, local_path);
+    local_sockfd = -1;
+    local_path = NULL;
+}
+
+/**
+ * FNV-1a of the @len bytes of name @addr, into a bucket of the peer table
+ */
+static unsigned int name_bucket(const struct sockaddr_un *addr, socklen_t len)
+{
+    const unsigned char *p = (const unsigned char *)addr->sun_path;
+    size_t n = len - offsetof(struct sockaddr_un, sun_path);
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h >> (32 - PEER_BITS);
+}
+
+/**
+ * Return the slot of the peer named @addr of @len bytes, taking a free or
+ * idle one for a new peer, or -1 if all are busy
+ */
+static int find_peer(const struct sockaddr_un *addr, socklen_t len)
+{
+    uint64_t now = mono_ms();
+    unsigned int b = name_bucket(addr, len);
+    struct peer *p;
+
+    list_for_each_entry(p, &buckets[b], hash) {
+        if (p->len == len && memcmp(&p->addr, addr, len) == 0) {
+            p->last_seen = now;
+            return p - peers;
+        }
+    }
+
+    int slot = -1;
+    if (npeers < MAX_LOCAL_PEERS) {
+        slot = npeers++;
+    } else {
+        // the table only fills up with churning peers, rarely worth a scan
+        uint64_t idle = (uint64_t)session_timeout * 1000;
+        for (int i = 0; i < MAX_LOCAL_PEERS; ++i) {
+            if (now - peers[i].last_seen > idle
+                && (slot < 0 || peers[i].last_seen < peers[slot].last_seen)) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            return -1;
+        }
+        list_del(&peers[slot].hash);
+        peers[slot].gen++;
+    }
+
+    p = &peers[slot];
+    memcpy(&p->addr, addr, len);
+    p->len = len;
+    p->last_seen = now;
+    list_add(&p->hash, &buckets[b]);
+    return slot;
+}
+
+ssize_t local_recv(int sockfd, void *buf, size_t len,
+                   struct sockaddr_in *addr, socklen_t *addr_len)
+{
+    struct sockaddr_un from;
+    socklen_t from_len = sizeof(from);
+    ssize_t rc = recvfrom(sockfd, buf, len, 0, (struct sockaddr *)&from,
+                          &from_len);
+    if (rc < 0) {
+        return rc;
+    }
+
+    // an unbound sender has no name to reply to
+    if (from_len <= offsetof(struct sockaddr_un, sun_path)) {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+
+    int slot = find_peer(&from, from_len);
+    if (slot < 0) {
+        errno = EUSERS;
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_UNIX;
+    addr->sin_addr.s_addr = htonl(slot + 1);
+    addr->sin_port = htons(peers[slot].gen);
+    *addr_len = sizeof(*addr);
+    return rc;
+}
+
+ssize_t local_send(const void *buf, size_t len, struct sockaddr_in addr)
+{
+    uint32_t slot = ntohl(addr.sin_addr.s_addr) - 1;
+    if (local_sockfd < 0 || slot >= (uint32_t)npeers
+        || peers[slot].gen != ntohs(addr.sin_port)) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    // a full peer queue blocks a Unix sender, drop the reply like UDP would
+    const struct peer *p = &peers[slot];
+    return sendto(local_sockfd, buf, len, MSG_DONTWAIT,
+                  (const struct sockaddr *)&p->addr, p->len);
+}
@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "match.h"
+#include "network.h"
+#include "list.h"
+#include "mem.h"
+
+#define WAIT_BITS 14 // waiting player hash table of 2^WAIT_BITS buckets
+
+struct waiter
+{
+    struct sockaddr_in addr;
+    uint64_t last_active; // time of the last NGAME, ms
+    struct list_head queue;
+    struct list_head hash;
+};
+
+bool pvp_mode = false;
+
+static LIST_HEAD(queue); // oldest first
+static struct list_head wait_table[1 << WAIT_BITS];
+static int nwaiting;
+
+static struct
+{
+    uint64_t queued;  // players that had to wait for an opponent
+    uint64_t matched; // games started by pairing two players
+    uint64_t expired; // waiting players dropped after the idle timeout
+    uint64_t full;    // NGAME rejected with the queue full
+} counts;
+
+static struct list_head *wait_bucket(struct sockaddr_in addr)
+{
+    if (!wait_table[0].next) {
+        for (int i = 0; i < (1 << WAIT_BITS); ++i)
+            INIT_LIST_HEAD(&wait_table[i]);
+    }
+    return &wait_table[addr_bucket(addr, WAIT_BITS)];
+}
+
+static struct waiter *find_waiter(struct sockaddr_in addr)
+{
+    struct waiter *w;
+    list_for_each_entry(w, wait_bucket(addr), hash) {
+        if (equal_addr(w->addr, addr))
+            return w;
+    }
+    return NULL;
+}
+
+static void drop_waiter(struct waiter *w)
+{
+    list_del(&w->queue);
+    list_del(&w->hash);
+    mem_free(MEM_MATCH, w);
+    nwaiting--;
+}
+
+static inline bool idle(const struct waiter *w, uint64_t now)
+{
+    return w->last_active + (uint64_t)session_timeout * 1000 < now;
+}
+
+int match_join(struct sockaddr_in addr, struct sockaddr_in *opponent)
+{
+    uint64_t now = mono_ms();
+
+    struct waiter *w = find_waiter(addr);
+    if (w) {
+        w->last_active = now;
+        return 0;
+    }
+
+    // players who gave up are only noticed once they reach the head
+    while (!list_empty(&queue)) {
+        w = list_first_entry(&queue, struct waiter, queue);
+        if (!idle(w, now)) {
+            *opponent = w->addr;
+            drop_waiter(w);
+            counts.matched++;
+            return 1;
+        }
+        drop_waiter(w);
+        counts.expired++;
+    }
+
+    return match_wait(addr, false);
+}
+
+int match_wait(struct sockaddr_in addr, bool first)
+{
+    if (!first && nwaiting >= MAX_WAITING) {
+        counts.full++;
+        return -1;
+    }
+
+    struct waiter *w = mem_alloc(MEM_MATCH, sizeof(*w));
+    w->addr = addr;
+    w->last_active = mono_ms();
+    list_add(&w->hash, wait_bucket(addr));
+    nwaiting++;
+
+    if (first) {
+        list_add(&w->queue, &queue);
+        counts.matched--;
+    } else {
+        list_add_tail(&w->queue, &queue);
+        counts.queued++;
+    }
+    return 0;
+}
+
+void match_expire()
+{
+    uint64_t now = mono_ms();
+    while (!list_empty(&queue)) {
+        struct waiter *w = list_first_entry(&queue, struct waiter, queue);
+        if (!idle(w, now))
+            break;
+        drop_waiter(w);
+        counts.expired++;
+    }
+}
+
+void match_clear()
+{
+    while (!list_empty(&queue)) {
+        drop_waiter(list_first_entry(&queue, struct waiter, queue));
+    }
+}
+
+void match_dump(FILE *f)
+{
+    if (!pvp_mode) {
+        return;
+    }
+    fprintf(f, "%-16s %d\n", "pvp_waiting", nwaiting);
+    fprintf(f, "%-16s %llu\n", "pvp_queued", (unsigned long long)counts.queued);
+    fprintf(f, "%-16s %llu\n", "pvp_matched",
+            (unsigned long long)counts.matched);
+    fprintf(f, "%-16s %llu\n", "pvp_expired",
+            (unsigned long long)counts.expired);
+    fprintf(f, "%-16s %llu\n", "pvp_full", (unsigned long long)counts.full);
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <malloc.h>
+
+#include "mem.h"
+
+struct pool
+{
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;      // live, usable size
+    uint64_t peak_bytes;
+    uint64_t peak_live;  // most blocks live at once
+    uint64_t mapped;
+};
+
+static struct pool pools[NMEMPOOLS];
+
+static const char *pool_names[NMEMPOOLS] = {
+    [MEM_SESSIONS] = "sessions",
+    [MEM_MATCH]    = "match",
+    [MEM_LOGGING]  = "logging",
+    [MEM_IO]       = "io",
+    [MEM_ENGINE]   = "engine",
+};
+
+static inline void account(struct pool *p, void *ptr)
+{
+    p->allocs++;
+    p->bytes += malloc_usable_size(ptr);
+    if (p->bytes > p->peak_bytes)
+        p->peak_bytes = p->bytes;
+    if (p->allocs - p->frees > p->peak_live)
+        p->peak_live = p->allocs - p->frees;
+}
+
+void *mem_alloc(enum MemPool pool, size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr) {
+        account(&pools[pool], ptr);
+    }
+    return ptr;
+}
+
+void *mem_calloc(enum MemPool pool, size_t n, size_t size)
+{
+    void *ptr = calloc(n, size);
+    if (ptr) {
+        account(&pools[pool], ptr);
+    }
+    return ptr;
+}
+
+void mem_free(enum MemPool pool, void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    pools[pool].frees++;
+    pools[pool].bytes -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+void mem_map(enum MemPool pool, long bytes)
+{
+    pools[pool].mapped += bytes;
+}
+
+uint64_t mem_allocs()
+{
+    uint64_t n = 0;
+    for (int i = 0; i < NMEMPOOLS; ++i) {
+        n += pools[i].allocs;
+    }
+    return n;
+}
+
+void mem_dump(FILE *f)
+{
+    fprintf(f, "%-10s %10s %10s %8s %8s %10s %10s %10s\n", "memory", "allocs",
+            "frees", "live", "peak", "bytes", "peak bytes", "mapped");
+    for (int i = 0; i < NMEMPOOLS; ++i) {
+        const struct pool *p = &pools[i];
+        if (p->allocs == 0 && p->mapped == 0)
+            continue;
+        fprintf(f, "%-10s %10llu %10llu %8llu %8llu %10llu %10llu %10llu\n",
+                pool_names[i], (unsigned long long)p->allocs,
+                (unsigned long long)p->frees,
+                (unsigned long long)(p->allocs - p->frees),
+                (unsigned long long)p->peak_live,
+                (unsigned long long)p->bytes,
+                (unsigned long long)p->peak_bytes,
+                (unsigned long long)p->mapped);
+    }
+}
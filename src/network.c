@@ -11,24 +11,96 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <signal.h>
 
 #include "network.h"
 #include "game.h"
+#include "archive.h"
+#include "trace.h"
+#include "stats.h"
+#include "filter.h"
+#include "capture.h"
+#include "mem.h"
+#include "local.h"
+#include "tstamp.h"
 
 const int VERSION = 4; // current protocol version
 
 const int BUFSZ = 100; // buffer size for all network package
 const int TIMEOUT = 60; // timeout after 1 minute
 
-#define MAX_ID 256            // maximum game ID
+int session_timeout = TIMEOUT;
+uint64_t games_started = 0;
+
+static int capacity = MAX_ID; // limit of concurrent games
 static int curr_max_id = 0;   // current maximum available ID
 static bool used_id[MAX_ID];  // for each ID, true means it's in use
 
-int init_socket(int argc, char *argv[])
+#define GAME_BUCKETS 4096            // game ID hash table size
+static struct list_head game_table[GAME_BUCKETS];
+static uint32_t next_v5_id = MAX_ID; // v5 IDs start above the v4 range
+static int v5_games = 0;             // live v5 sessions
+
+#define ADDR_BITS 10 // v4 client address hash tables of 2^ADDR_BITS buckets
+static struct list_head client_table[1 << ADDR_BITS];
+static struct list_head peer_table[1 << ADDR_BITS];
+
+static ssize_t kernel_recv(int sockfd, void *buf, size_t len,
+                           struct sockaddr_in *addr, socklen_t *addr_len)
+{
+    if (sockfd == local_sockfd) {
+        return local_recv(sockfd, buf, len, addr, addr_len);
+    } else if (sockfd == tstamp_sockfd) {
+        return tstamp_recv(sockfd, buf, len, addr, addr_len);
+    }
+    return recvfrom(sockfd, buf, len, 0, (struct sockaddr *)addr, addr_len);
+}
+
+static ssize_t kernel_send(int sockfd, const void *buf, size_t len,
+                           struct sockaddr_in addr)
+{
+    // replies follow the transport of the address, not the socket
+    if (local_addr(addr)) {
+        return local_send(buf, len, addr);
+    } else if (sockfd == local_sockfd) {
+        sockfd = local_udp_sockfd;
+    }
+    ssize_t rc = sendto(sockfd, buf, len, 0, (struct sockaddr *)&addr,
+                        sizeof(addr));
+    if (rc >= 0 && sockfd == tstamp_sockfd) {
+        tstamp_sent();
+    }
+    return rc;
+}
+
+static uint64_t kernel_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t kernel_mono_ms()
 {
-    unsigned int port;
-    if ((port = atoi(argv[1])) == 0 || port >= UINT16_MAX) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const struct net_ops kernel_ops = {
+    kernel_recv,
+    kernel_send,
+    kernel_now_ms,
+    kernel_mono_ms,
+};
+
+const struct net_ops *net_ops = &kernel_ops;
+
+int init_socket(const char *port)
+{
+    unsigned int port_no;
+    if ((port_no = atoi(port)) == 0 || port_no >= UINT16_MAX) {
         errmsg("Error: port number must be an 16-byte integer\n");
         exit(1);
     }
@@ -42,7 +114,7 @@ int init_socket(int argc, char *argv[])
 
     int status;
     // supplying port number
-    if ((status = getaddrinfo(NULL, argv[1], &hints, &res)) != 0) {
+    if ((status = getaddrinfo(NULL, port, &hints, &res)) != 0) {
         errmsg("Get address failed: %s\n", gai_strerror(status));
         exit(1);
     }
@@ -72,6 +144,9 @@ int init_socket(int argc, char *argv[])
     }
     infomsg("Server socket successfully binded\n");
 
+    // junk is dropped in the kernel, the server still copes without it
+    filter_attach(sockfd, FILTER_GAME);
+
     putchar('\n');
 
     freeaddrinfo(res);
@@ -82,6 +157,33 @@ sock_error: // Release resources when socket failed
     exit(1);
 }
 
+int mc_group_addr(const char *spec, int port, struct sockaddr_in *addr)
+{
+    char group[INET_ADDRSTRLEN];
+    const char *colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+    if (len >= sizeof(group)) {
+        return -1;
+    }
+    memcpy(group, spec, len);
+    group[len] = '\0';
+
+    if (colon && ((port = atoi(colon + 1)) <= 0 || port >= UINT16_MAX)) {
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &addr->sin_addr) != 1
+        || !IN_MULTICAST(ntohl(addr->sin_addr.s_addr))) {
+        return -1;
+    }
+
+    return 0;
+}
+
 int init_mc_sock()
 {
     int sockfd;
@@ -106,8 +208,11 @@ int init_mc_sock()
     }
 
     // setup multicast
+    struct sockaddr_in group;
+    mc_group_addr(MC_GROUP, MC_PORT, &group);
+
     struct ip_mreq mreq;
-    mreq.imr_multiaddr.s_addr = inet_addr(MC_GROUP);
+    mreq.imr_multiaddr = group.sin_addr;
     mreq.imr_interface.s_addr = htonl(INADDR_ANY);
     if (setsockopt(
             sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
@@ -121,6 +226,8 @@ int init_mc_sock()
     }
     infomsg("Multicast socket successfully binded\n");
 
+    filter_attach(sockfd, FILTER_PROBE);
+
     putchar('\n');
 
     return sockfd;
@@ -130,116 +237,332 @@ sock_error: // Release resources when socket failed
     exit(1);
 }
 
-int init_session(struct session *s, struct sockaddr_in addr)
+/**
+ * Reserve an available game ID, return -1 if all IDs are in use
+ */
+static int alloc_game_id()
 {
-    memset(s, 0, sizeof(*s));
-
     int game_id = -1;
-    if (curr_max_id < MAX_ID) {
+    if (curr_max_id < capacity) {
         game_id = curr_max_id;
         used_id[curr_max_id] = true;
         ++curr_max_id;
     } else {
         // loop to find a available ID
-        for (int i = 0; i < MAX_ID; ++i) {
+        for (int i = 0; i < capacity; ++i) {
             if (!used_id[i]) {
                 game_id = i;
                 used_id[i] = true;
+                break;
             }
         }
     }
 
-    s->game_id = game_id;
-    s->client = addr;
-    init_board(s->board);
-    s->turn = 0;
+    return game_id;
+}
+
+/**
+ * Reserve an available 32-bit game ID for protocol v5, -1 if at capacity
+ */
+static int alloc_v5_id()
+{
+    if (v5_games >= MAX_V5_GAMES) {
+        return -1;
+    }
+
+    // IDs are handed out in sequence, skipping the ones still in use
+    while (lookup_game(next_v5_id)) {
+        next_v5_id = (next_v5_id + 1 >= MAX_V5_ID) ? MAX_ID : next_v5_id + 1;
+    }
+    int game_id = next_v5_id;
+    next_v5_id = (next_v5_id + 1 >= MAX_V5_ID) ? MAX_ID : next_v5_id + 1;
+    v5_games++;
 
     return game_id;
 }
 
-int clone_session(struct session *s,
-                  struct sockaddr_in addr,
-                  struct message msg)
+static struct list_head *game_bucket(uint32_t game_id)
 {
-    memset(s, 0, sizeof(*s));
+    if (!game_table[0].next) {
+        for (int i = 0; i < GAME_BUCKETS; ++i)
+            INIT_LIST_HEAD(&game_table[i]);
+    }
+    return &game_table[game_id & (GAME_BUCKETS - 1)];
+}
 
-    int game_id = -1;
-    if (curr_max_id < MAX_ID) {
-        game_id = curr_max_id;
-        used_id[curr_max_id] = true;
-        ++curr_max_id;
-    } else {
-        // loop to find a available ID
-        for (int i = 0; i < MAX_ID; ++i) {
-            if (!used_id[i]) {
-                game_id = i;
-                used_id[i] = true;
-            }
-        }
+static struct list_head *addr_table_bucket(struct list_head *table,
+                                           struct sockaddr_in addr)
+{
+    if (!table[0].next) {
+        for (int i = 0; i < (1 << ADDR_BITS); ++i)
+            INIT_LIST_HEAD(&table[i]);
     }
+    return &table[addr_bucket(addr, ADDR_BITS)];
+}
+
+struct session *lookup_client(struct sockaddr_in addr)
+{
+    struct session *s;
+
+    list_for_each_entry(s, addr_table_bucket(client_table, addr), addr_hash) {
+        if (equal_addr(s->client, addr))
+            return s;
+    }
+    list_for_each_entry(s, addr_table_bucket(peer_table, addr), peer_hash) {
+        if (equal_addr(s->peer, addr))
+            return s;
+    }
+    return NULL;
+}
+
+void add_peer(struct session *s, struct sockaddr_in peer)
+{
+    s->peer = peer;
+    s->flags |= REC_PVP;
+    list_add(&s->peer_hash, addr_table_bucket(peer_table, peer));
+}
+
+struct session *lookup_game(uint32_t game_id)
+{
+    struct list_head *bucket = game_bucket(game_id);
+    struct session *s;
+
+    list_for_each_entry(s, bucket, hash) {
+        if ((uint32_t)s->game_id == game_id)
+            return s;
+    }
+    return NULL;
+}
+
+int init_session(struct session *s, struct sockaddr_in addr, int version)
+{
+    memset(s, 0, sizeof(*s));
+
+    int game_id = (version == VERSION_V5) ? alloc_v5_id() : alloc_game_id();
 
     s->game_id = game_id;
     s->client = addr;
+    init_board(s->board);
+    s->turn = 0;
+    s->start = time_ms();
+    s->last_active = mono_ms();
+    s->flags = (version == VERSION_V5) ? REC_V5 : 0;
+
+    if (game_id >= 0) {
+        // game IDs are reused all the time, the serial tells their games apart
+        s->serial = ++games_started;
+        seed_game(&s->rng, s->serial, game_id, 0);
+        list_add(&s->hash, game_bucket(game_id));
+        if (version != VERSION_V5)
+            list_add(&s->addr_hash, addr_table_bucket(client_table, addr));
+    }
+
+    return game_id;
+}
+
+int load_board(struct session *s, const char board[NROWS * NCOLS])
+{
+    init_board(s->board);
 
     int count = 0;
     for (int i = 0; i < NROWS * NCOLS; ++i) {
-        if (msg.board[i] == 0) {
-            s->board[i] = '0' + i + 1;
-        } else if (msg.board[i] == 1) {
+        if (board[i] == 1) {
             s->board[i] = 'X';
             count++;
-        } else if (msg.board[i] == 2) {
+        } else if (board[i] == 2) {
             s->board[i] = 'O';
             count++;
         }
     }
     s->turn = count;
 
+    return count;
+}
+
+int clone_session(struct session *s,
+                  struct sockaddr_in addr,
+                  const char board[NROWS * NCOLS],
+                  int version)
+{
+    int game_id = init_session(s, addr, version);
+
+    load_board(s, board);
+    s->flags |= REC_RESUMED;
+
     return game_id;
 }
 
+int adopt_session(struct session *s)
+{
+    if (s->game_id < 0 || lookup_game(s->game_id)) {
+        return -1;
+    }
+
+    if (s->flags & REC_V5) {
+        if (s->game_id < MAX_ID) {
+            return -1;
+        }
+        v5_games++;
+    } else {
+        if (s->game_id >= MAX_ID) {
+            return -1;
+        }
+        used_id[s->game_id] = true;
+        if (curr_max_id <= s->game_id) {
+            // IDs skipped below the adopted one remain free for the loop search
+            curr_max_id = s->game_id + 1;
+        }
+        list_add(&s->addr_hash, addr_table_bucket(client_table, s->client));
+        if (s->flags & REC_PVP)
+            list_add(&s->peer_hash, addr_table_bucket(peer_table, s->peer));
+    }
+
+    list_add(&s->hash, game_bucket(s->game_id));
+    return s->game_id;
+}
+
+int set_capacity(int n)
+{
+    if (n < 1 || n > MAX_ID) {
+        return -1;
+    }
+
+    // IDs from curr_max_id on are never taken, keep that true for a raise
+    capacity = n;
+    return 0;
+}
+
+int get_capacity()
+{
+    return capacity;
+}
+
+void finish_game(const struct session *s, int winner)
+{
+    struct game_record rec;
+
+    rec.start = s->start;
+    rec.length = (uint32_t)(time_ms() - s->start);
+    rec.addr = s->client.sin_addr.s_addr;
+    rec.port = s->client.sin_port;
+    rec.game_id = s->game_id;
+    rec.moves = s->moves;
+    rec.flags = s->flags;
+
+    if (winner == 1) {
+        rec.outcome = OUT_SERVER;
+        stats.server_wins++;
+    } else if (winner == 2) {
+        rec.outcome = OUT_CLIENT;
+        stats.client_wins++;
+    } else if (winner == -1) {
+        rec.outcome = OUT_TIE;
+        stats.ties++;
+    } else {
+        rec.outcome = OUT_UNFINISHED;
+    }
+
+    archive_append(&rec);
+}
+
 void free_session(struct session *s)
 {
-    used_id[s->game_id] = false;
-    free(s);
+    if (s->game_id >= 0) {
+        if (s->flags & REC_V5) {
+            v5_games--;
+        } else {
+            used_id[s->game_id] = false;
+            list_del(&s->addr_hash);
+            if (s->flags & REC_PVP)
+                list_del(&s->peer_hash);
+        }
+        list_del(&s->hash);
+    }
+    mem_free(MEM_SESSIONS, s);
 }
 
-int sendmsg_to(int sockfd, struct sockaddr_in addr, struct message msg)
+int send_packet(int sockfd, struct sockaddr_in addr, const void *buf, size_t len)
 {
-    int rc = sendto(
-        sockfd, &msg, sizeof(msg), 0, (struct sockaddr *)&addr, sizeof(addr));
-    char buf[sizeof(addr)];
+    TRACE_BEGIN(send, -1);
+    int rc = net_ops->send(sockfd, buf, len, addr);
+    TRACE_END(send, -1);
+    char str[INET_ADDRSTRLEN];
+
+    if (rc < 0) {
+        stats.tx_errors++;
+    } else {
+        stats.tx_packets++;
+        capture_packet(sockfd, addr, buf, rc, true);
+    }
 
     if (rc > 0) {
-        infomsg("Sent message to client %s:%u\n",
-                inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(addr)),
+        TRACE_BEGIN(log, -1);
+        infomsg("Sent %d bytes to client %s:%u\n", rc,
+                inet_ntop(AF_INET, &addr.sin_addr, str, sizeof(str)),
                 addr.sin_port);
-
-        infomsg("Message content: version %d, command %d, "
-                "response code %d, move %d, turn %d game %d\n",
-                (int)msg.version, (int)msg.cmd, (int)msg.resp, (int)msg.move,
-                (int)msg.turn, (int)msg.game);
+        TRACE_END(log, -1);
     }
 
     return rc;
 }
 
-int recvmsg_from(int sockfd, struct sockaddr_in *addr, socklen_t *len,
-                 struct message *msg)
+int recv_packet(int sockfd, struct sockaddr_in *addr, socklen_t *len,
+                void *buf, size_t size)
 {
-    int rc = recvfrom(
-        sockfd, msg, sizeof(*msg), 0, (struct sockaddr *)addr, len);
-    char buf[*len];
+    TRACE_BEGIN(recv, -1);
+    int rc = net_ops->recv(sockfd, buf, size, addr, len);
+    TRACE_END(recv, -1);
+    char str[INET_ADDRSTRLEN];
+
+    if (rc < 0) {
+        // an empty nonblocking receive is the busy-poll loop idling
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            stats.rx_errors++;
+    } else {
+        stats.rx_packets++;
+        capture_packet(sockfd, *addr, buf, rc, false);
+    }
 
     if (rc > 0) {
+        TRACE_BEGIN(log, -1);
         infomsg("Received incoming message from %s:%u\n",
-                inet_ntop(AF_INET, &addr->sin_addr, buf, *len), addr->sin_port);
+                inet_ntop(AF_INET, &addr->sin_addr, str, sizeof(str)),
+                addr->sin_port);
         infomsg("Received %d bytes\n", rc);
+        TRACE_END(log, -1);
+    }
+
+    return rc;
+}
+
+void log_message(const struct message *msg)
+{
+    TRACE_BEGIN(log, msg->game);
+    infomsg("Message content: version %d, command %d, "
+            "response code %d, move %d, turn %d and game %d\n",
+            (int)msg->version, (int)msg->cmd, (int)msg->resp, (int)msg->move,
+            (int)msg->turn, (int)msg->game);
+    TRACE_END(log, msg->game);
+}
 
-        infomsg("Message content: version %d, command %d, "
-                "response code %d, move %d, turn %d and game %d\n",
-                (int)msg->version, (int)msg->cmd, (int)msg->resp, (int)msg->move,
-                (int)msg->turn, (int)msg->game);
+int sendmsg_to(int sockfd, struct sockaddr_in addr, struct message msg)
+{
+    int rc = send_packet(sockfd, addr, &msg, sizeof(msg));
+
+    if (rc > 0) {
+        log_message(&msg);
+    }
+
+    return rc;
+}
+
+int recvmsg_from(int sockfd, struct sockaddr_in *addr, socklen_t *len,
+                 struct message *msg)
+{
+    int rc = recv_packet(sockfd, addr, len, msg, sizeof(*msg));
+
+    if (rc > 0) {
+        log_message(msg);
     }
 
     return rc;
@@ -247,6 +570,31 @@ int recvmsg_from(int sockfd, struct sockaddr_in *addr, socklen_t *len,
 
 int send_move(int sockfd, const struct session *sess, int move, int resp)
 {
+    return send_move_to(sockfd, sess, sess->client, move, resp);
+}
+
+int send_move_to(int sockfd, const struct session *sess,
+                 struct sockaddr_in addr, int move, int resp)
+{
+    if (sess->flags & REC_V5) {
+        // a batch of one for games played over protocol v5
+        struct
+        {
+            struct header_v5 hdr;
+            struct message_v5 msg;
+        } __attribute__((packed)) pkt;
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.hdr.version = VERSION_V5;
+        pkt.hdr.count = 1;
+        pkt.msg.cmd = MOVE;
+        pkt.msg.resp = resp;
+        pkt.msg.move = move;
+        pkt.msg.turn = htons(sess->turn);
+        pkt.msg.game = htonl(sess->game_id);
+
+        return send_packet(sockfd, addr, &pkt, sizeof(pkt));
+    }
+
     struct message msg = {
         (uint8_t) VERSION,
         (uint8_t) MOVE,
@@ -256,14 +604,40 @@ int send_move(int sockfd, const struct session *sess, int move, int resp)
         (uint8_t) sess->game_id,
     };
 
-    int rc = sendmsg_to(sockfd, sess->client, msg);
+    int rc = sendmsg_to(sockfd, addr, msg);
 
     return rc;
 }
 
+void record_move(struct session *s, int move)
+{
+    if (s->nmoves < 16) {
+        s->moves |= (uint64_t)move << (4 * s->nmoves);
+        s->nmoves++;
+    }
+}
+
+uint64_t time_ms()
+{
+    return net_ops->now_ms();
+}
+
+uint64_t mono_ms()
+{
+    return net_ops->mono_ms();
+}
+
 bool equal_addr(struct sockaddr_in lhs, struct sockaddr_in rhs)
 {
     return
         lhs.sin_addr.s_addr == rhs.sin_addr.s_addr
-        && lhs.sin_port == rhs.sin_port;
+        && lhs.sin_port == rhs.sin_port
+        && local_addr(lhs) == local_addr(rhs);
+}
+
+unsigned int addr_bucket(struct sockaddr_in addr, int bits)
+{
+    uint32_t h = (addr.sin_addr.s_addr ^ ((uint32_t)addr.sin_port << 16))
+        * 2654435761u;
+    return h >> (32 - bits);
 }
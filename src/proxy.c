@@ -0,0 +1,673 @@
+/**
+ * File: proxy.c
+ * UDP impairment proxy between clients and the tictactoe server
+ *
+ * Listens on a local port and relays every datagram to the server and back,
+ * from one upstream socket per client address so the server still tells
+ * clients apart. Datagrams in both directions can be lost, delayed with
+ * jitter, duplicated or reordered, like a lossy network would.
+ *
+ * The proxy follows the games it relays, v4 and v5 alike, and reports how
+ * long games take end to end, from the first NGAME of the client to the
+ * delivery of the final reply, and how many games stall: go without a reply
+ * for longer than the stall time, whether they recover or not.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "network.h"
+#include "flow.h"
+#include "list.h"
+#include "rng.h"
+
+#define PROTO_VERSION 4
+#define FLOW_IDLE_MS  10000    // a silent client is forgotten after this
+#define SCAN_MS       100      // stall and idle scan interval
+#define HIST_MS       60000    // game time histogram range, 1ms buckets
+#define MAX_EVENTS    64
+
+struct slot
+{
+    bool open;
+    bool replied;  // the server answered at least once
+    bool stalled;  // counted as stalled already
+    bool named;    // v5 game whose ID the server told
+    uint32_t id;   // v5 game ID, once named
+    uint64_t start; // first NGAME or RGAME, us
+    uint64_t last;  // last reply delivered, or start, us
+};
+
+// Client and the games it plays, flow.last in us
+struct client
+{
+    struct flow flow;
+    int pending;                   // datagrams of this client held back
+    struct slot games[MAX_BATCH];  // v4 uses the first, v5 any by game ID
+};
+
+// Datagram held back until @due, towards the server if @up
+struct pending
+{
+    uint64_t due;
+    uint64_t seq; // arrival order, keeps equal delays in order
+    struct client *client;
+    bool up;
+    int len;
+    char data[MAX_PACKET];
+};
+
+static struct
+{
+    uint32_t delay_us, jitter_us;
+    uint32_t loss, dup, reorder; // per million
+    uint64_t stall_us;
+} cfg = { 0, 0, 0, 0, 0, 1000000 };
+
+static struct
+{
+    uint64_t relayed[2], lost[2], duplicated[2], reordered[2];
+    uint64_t flows;
+    uint64_t started, completed, stalled, abandoned;
+    uint64_t hist[HIST_MS + 1];
+    uint64_t max_us;
+} st;
+
+static volatile sig_atomic_t quit = 0;
+
+static int listen_fd, epoll_fd, timer_fd;
+static struct sockaddr_in server;
+static struct rng rng;
+
+static struct flow_table flows;
+
+static struct pending **heap;
+static size_t nheld, heap_cap;
+static uint64_t next_seq;
+
+static void quit_handler(int signo)
+{
+    quit = 1;
+}
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* held datagrams, a binary min-heap on (due, seq) */
+
+static inline bool before(const struct pending *a, const struct pending *b)
+{
+    return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+static void hold(struct pending *p)
+{
+    if (nheld == heap_cap) {
+        heap_cap = heap_cap ? 2 * heap_cap : 1024;
+        heap = realloc(heap, heap_cap * sizeof(*heap));
+    }
+
+    size_t i = nheld++;
+    while (i > 0 && before(p, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = p;
+}
+
+static struct pending *release()
+{
+    struct pending *top = heap[0];
+    struct pending *last = heap[--nheld];
+    size_t i = 0;
+
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= nheld)
+            break;
+        if (c + 1 < nheld && before(heap[c + 1], heap[c]))
+            c++;
+        if (!before(heap[c], last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* clients */
+
+static struct client *open_client(struct sockaddr_in addr, uint64_t now)
+{
+    struct flow *f = flow_open(&flows, addr, &server, sizeof(struct client),
+                               now);
+    if (!f)
+        return NULL;
+    st.flows++;
+    return list_entry(f, struct client, flow);
+}
+
+static void close_client(struct client *c)
+{
+    for (int i = 0; i < MAX_BATCH; ++i) {
+        if (c->games[i].open)
+            st.abandoned++;
+    }
+    flow_close(&c->flow);
+}
+
+/* game tracking */
+
+static void start_game(struct slot *g, uint64_t now)
+{
+    // a retransmitted request keeps the game going
+    if (g->open && !g->replied)
+        return;
+    if (g->open)
+        st.abandoned++;
+
+    memset(g, 0, sizeof(*g));
+    g->open = true;
+    g->start = now;
+    g->last = now;
+    st.started++;
+}
+
+static void end_game(struct slot *g, uint64_t now)
+{
+    uint64_t us = now - g->start;
+    uint64_t ms = us / 1000;
+    st.hist[ms < HIST_MS ? ms : HIST_MS]++;
+    if (us > st.max_us)
+        st.max_us = us;
+    st.completed++;
+    g->open = false;
+}
+
+static void game_reply(struct slot *g, int resp, uint64_t now)
+{
+    if (!g->open)
+        return;
+
+    g->replied = true;
+    g->last = now;
+    if (resp == GAMEOVR || resp == GAMOVRACK) {
+        end_game(g, now);
+    } else if (resp != SUCC) {
+        // the client gives up on the game after an error
+        st.abandoned++;
+        g->open = false;
+    }
+}
+
+/**
+ * Open v5 game @id of client @c, NULL if none
+ */
+static struct slot *named_game(struct client *c, uint32_t id)
+{
+    for (int i = 0; i < MAX_BATCH; ++i) {
+        struct slot *g = &c->games[i];
+        if (g->open && g->named && g->id == id)
+            return g;
+    }
+    return NULL;
+}
+
+/**
+ * Longest waiting v5 game of client @c whose ID is not known yet, NULL if
+ * none
+ */
+static struct slot *unnamed_game(struct client *c)
+{
+    struct slot *found = NULL;
+    for (int i = 0; i < MAX_BATCH; ++i) {
+        struct slot *g = &c->games[i];
+        if (g->open && !g->named && (!found || g->start < found->start))
+            found = g;
+    }
+    return found;
+}
+
+/**
+ * Slot for a new v5 game of client @c: a free one, or else the game that
+ * went longest without a reply, which the client must have given up on
+ */
+static struct slot *free_game(struct client *c)
+{
+    struct slot *found = NULL;
+    for (int i = 0; i < MAX_BATCH; ++i) {
+        struct slot *g = &c->games[i];
+        if (!g->open)
+            return g;
+        if (g->named && (!found || g->last < found->last))
+            found = g;
+    }
+    return found;
+}
+
+/**
+ * Follow the v5 games of the @count messages at @buf, requests if @up or
+ * else replies. A game is only known by position until the reply to its
+ * NGAME or RGAME names it, so starts are counted: a request with no more
+ * starts than there are unnamed games is taken for a retransmission
+ */
+static void track_v5(struct client *c, bool up, const uint8_t *buf, int count,
+                     uint64_t now)
+{
+    if (up) {
+        int starts = 0, waiting = 0;
+        for (int i = 0; i < count; ++i) {
+            struct message_v5 msg;
+            memcpy(&msg, buf + i * sizeof(msg), sizeof(msg));
+            starts += (msg.cmd == NGAME || msg.cmd == RGAME);
+        }
+        for (int i = 0; i < MAX_BATCH; ++i)
+            waiting += (c->games[i].open && !c->games[i].named);
+
+        for (int i = waiting; i < starts; ++i) {
+            struct slot *g = free_game(c);
+            if (!g)
+                break;
+            start_game(g, now);
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        struct message_v5 msg;
+        memcpy(&msg, buf + i * sizeof(msg), sizeof(msg));
+        uint32_t id = ntohl(msg.game);
+
+        struct slot *g = named_game(c, id);
+        if (!g && (msg.cmd == NGAME || msg.cmd == RGAME)) {
+            g = unnamed_game(c);
+            if (g && msg.resp == SUCC) {
+                g->named = true;
+                g->id = id;
+            }
+        }
+        if (g)
+            game_reply(g, msg.resp, now);
+    }
+}
+
+/**
+ * Follow the games in datagram @buf, a request if @up or else a reply
+ */
+static void track(struct client *c, bool up, const uint8_t *buf, int len,
+                  uint64_t now)
+{
+    if (len >= (int)MIN_MESSAGE && buf[0] == PROTO_VERSION) {
+        struct message msg;
+        memcpy(&msg, buf, MIN_MESSAGE);
+        if (!up)
+            game_reply(&c->games[0], msg.resp, now);
+        else if (msg.cmd == NGAME || msg.cmd == RGAME)
+            start_game(&c->games[0], now);
+        return;
+    }
+
+    struct header_v5 hdr;
+    if (len < (int)sizeof(hdr))
+        return;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.version != VERSION_V5 || hdr.count > MAX_BATCH
+        || len < (int)(sizeof(hdr) + hdr.count * sizeof(struct message_v5)))
+        return;
+
+    track_v5(c, up, buf + sizeof(hdr), hdr.count, now);
+}
+
+/* impairment */
+
+static void deliver(struct pending *p, uint64_t now)
+{
+    struct client *c = p->client;
+    ssize_t rc;
+
+    if (p->up) {
+        rc = send(c->flow.fd, p->data, p->len, 0);
+    } else {
+        rc = sendto(listen_fd, p->data, p->len, 0,
+                    (struct sockaddr *)&c->flow.client, sizeof(c->flow.client));
+    }
+    if (rc == p->len) {
+        st.relayed[p->up]++;
+        if (!p->up)
+            track(c, false, (uint8_t *)p->data, p->len, now);
+    }
+    c->pending--;
+}
+
+/**
+ * Pass datagram @buf of client @c on, subject to the configured impairments
+ */
+static void impair(struct client *c, bool up, const char *buf, int len,
+                   uint64_t now)
+{
+    if (rng_below(&rng, 1000000) < cfg.loss) {
+        st.lost[up]++;
+        return;
+    }
+
+    int copies = 1;
+    if (rng_below(&rng, 1000000) < cfg.dup) {
+        st.duplicated[up]++;
+        copies = 2;
+    }
+
+    for (int i = 0; i < copies; ++i) {
+        uint64_t delay = cfg.delay_us;
+        if (cfg.jitter_us)
+            delay += rng_below(&rng, cfg.jitter_us + 1);
+        if (rng_below(&rng, 1000000) < cfg.reorder) {
+            // held back long enough to land behind later datagrams
+            st.reordered[up]++;
+            delay += 4 * (cfg.delay_us + cfg.jitter_us) + 1000;
+        }
+
+        struct pending *p = malloc(sizeof(*p));
+        p->due = now + delay;
+        p->seq = next_seq++;
+        p->client = c;
+        p->up = up;
+        p->len = len;
+        memcpy(p->data, buf, len);
+        c->pending++;
+
+        if (delay == 0) {
+            deliver(p, now);
+            free(p);
+        } else {
+            hold(p);
+        }
+    }
+}
+
+static void from_clients(uint64_t now)
+{
+    char buf[MAX_PACKET];
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    ssize_t len;
+
+    while ((len = recvfrom(listen_fd, buf, sizeof(buf), MSG_DONTWAIT,
+                           (struct sockaddr *)&addr, &addr_len)) >= 0) {
+        struct flow *f = flow_find(&flows, addr);
+        struct client *c = f ? list_entry(f, struct client, flow)
+                             : open_client(addr, now);
+        if (!c)
+            continue;
+
+        c->flow.last = now;
+        track(c, true, (uint8_t *)buf, len, now);
+        impair(c, true, buf, len, now);
+        addr_len = sizeof(addr);
+    }
+}
+
+static void from_server(struct client *c, uint64_t now)
+{
+    char buf[MAX_PACKET];
+    ssize_t len;
+
+    while ((len = recv(c->flow.fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+        c->flow.last = now;
+        impair(c, false, buf, len, now);
+    }
+}
+
+/**
+ * Count games gone quiet for longer than the stall time and forget idle
+ * clients
+ */
+static void scan_flows(uint64_t now)
+{
+    struct client *c, *next;
+    list_for_each_entry_safe(c, next, &flows.flows, flow.list) {
+        for (int i = 0; i < MAX_BATCH; ++i) {
+            struct slot *g = &c->games[i];
+            if (g->open && !g->stalled && now - g->last > cfg.stall_us) {
+                g->stalled = true;
+                st.stalled++;
+            }
+        }
+
+        if (c->pending == 0 && now - c->flow.last > FLOW_IDLE_MS * 1000ULL)
+            close_client(c);
+    }
+}
+
+static double percentile(double p)
+{
+    uint64_t target = (uint64_t)(p * st.completed), seen = 0;
+    for (int ms = 0; ms <= HIST_MS; ++ms) {
+        seen += st.hist[ms];
+        if (seen > target)
+            return ms;
+    }
+    return HIST_MS;
+}
+
+static void report(double secs, uint64_t seed)
+{
+    static const char *dir[2] = { "to clients", "to server" };
+
+    printf("duration      %.2f s, %llu clients, seed %llu\n", secs,
+           (unsigned long long)st.flows, (unsigned long long)seed);
+    for (int up = 1; up >= 0; --up) {
+        printf("%-13s %llu relayed, %llu lost, %llu duplicated, "
+               "%llu reordered\n", dir[up],
+               (unsigned long long)st.relayed[up],
+               (unsigned long long)st.lost[up],
+               (unsigned long long)st.duplicated[up],
+               (unsigned long long)st.reordered[up]);
+    }
+
+    uint64_t running = st.started - st.completed - st.abandoned;
+    printf("games         %llu started, %llu completed, %llu abandoned, "
+           "%llu open\n", (unsigned long long)st.started,
+           (unsigned long long)st.completed,
+           (unsigned long long)st.abandoned, (unsigned long long)running);
+    printf("stalled       %llu (%.2f%%) without a reply for %llu ms\n",
+           (unsigned long long)st.stalled,
+           st.started ? 100.0 * st.stalled / st.started : 0.0,
+           (unsigned long long)(cfg.stall_us / 1000));
+    printf("game ms       p50 %.0f  p90 %.0f  p99 %.0f  p999 %.0f  max %.0f\n",
+           percentile(0.5), percentile(0.9), percentile(0.99),
+           percentile(0.999), st.max_us / 1e3);
+}
+
+/**
+ * Parse a percentage into parts per million
+ */
+static uint32_t ppm(const char *arg)
+{
+    return (uint32_t)(atof(arg) * 10000);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t seed = time(NULL);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:j:l:u:r:s:S:")) != -1) {
+        switch (opt) {
+        case 'd':
+            cfg.delay_us = atof(optarg) * 1000;
+            break;
+        case 'j':
+            cfg.jitter_us = atof(optarg) * 1000;
+            break;
+        case 'l':
+            cfg.loss = ppm(optarg);
+            break;
+        case 'u':
+            cfg.dup = ppm(optarg);
+            break;
+        case 'r':
+            cfg.reorder = ppm(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'S':
+            cfg.stall_us = strtoull(optarg, NULL, 10) * 1000;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (argc - optind != 3 || cfg.stall_us == 0) {
+    usage:
+        fprintf(stderr, "Usage: %s [-d delay-ms] [-j jitter-ms] [-l loss%%] "
+                "[-u dup%%] [-r reorder%%]\n"
+                "       [-s seed] [-S stall-ms] <port> <server-host> "
+                "<server-port>\n", argv[0]);
+        exit(1);
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int status = getaddrinfo(argv[optind + 1], argv[optind + 2], &hints, &res);
+    if (status != 0) {
+        fprintf(stderr, "Unable to resolve server: %s\n", gai_strerror(status));
+        exit(1);
+    }
+    memcpy(&server, res->ai_addr, sizeof(server));
+    freeaddrinfo(res);
+
+    // every client address holds a socket, allow as many as we may
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(argv[optind]));
+
+    listen_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Unable to bind port %s: %s\n", argv[optind],
+                strerror(errno));
+        exit(1);
+    }
+
+    epoll_fd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        fprintf(stderr, "Unable to create epoll instance: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    ev.data.ptr = &timer_fd;
+    if (timer_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+        fprintf(stderr, "Unable to create timer: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    flow_init(&flows, epoll_fd);
+    rng_seed(&rng, seed);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = quit_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    uint64_t start = now_us();
+    uint64_t last_scan = start;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!quit) {
+        uint64_t now = now_us();
+        uint64_t wake = last_scan + SCAN_MS * 1000;
+        if (nheld > 0 && heap[0]->due < wake)
+            wake = heap[0]->due;
+        if (wake <= now)
+            wake = now + 1;
+
+        // epoll timeouts round to milliseconds, too coarse for the delays
+        struct itimerspec its = { { 0, 0 }, { wake / 1000000,
+                                              wake % 1000000 * 1000 } };
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        now = now_us();
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+                    continue;
+            } else if (events[i].data.ptr) {
+                from_server(list_entry((struct flow *)events[i].data.ptr,
+                                       struct client, flow), now);
+            } else {
+                from_clients(now);
+            }
+        }
+
+        while (nheld > 0 && heap[0]->due <= now) {
+            struct pending *p = release();
+            deliver(p, now);
+            free(p);
+        }
+
+        if (now - last_scan >= SCAN_MS * 1000) {
+            scan_flows(now);
+            last_scan = now;
+        }
+    }
+
+    report((now_us() - start) / 1e6, seed);
+
+    while (nheld > 0)
+        free(release());
+    struct client *c, *next;
+    list_for_each_entry_safe(c, next, &flows.flows, flow.list) {
+        // still running at exit, not given up on
+        memset(c->games, 0, sizeof(c->games));
+        close_client(c);
+    }
+    free(heap);
+    close(timer_fd);
+    close(epoll_fd);
+    close(listen_fd);
+
+    return 0;
+}
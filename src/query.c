@@ -0,0 +1,398 @@
+/**
+ * File: query.c
+ * Analytics over the columnar game archive written by the server
+ *
+ * The archive is memory mapped, the block headers are walked once to build
+ * the block index, and blocks that fall outside the requested time range are
+ * skipped without touching their columns. The remaining blocks are scanned
+ * in parallel, each thread aggregating into private counters that are merged
+ * at the end.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "game.h"
+
+FILE *log_file = NULL;
+
+#define NCELLS (NROWS * NCOLS)
+
+struct client_stat
+{
+    uint64_t key;        // address << 16 | port, 0 for an empty slot
+    uint64_t games;
+    uint64_t moves;
+    uint64_t outcome[4];
+};
+
+struct client_table
+{
+    struct client_stat *slots;
+    size_t cap;
+    size_t used;
+};
+
+struct aggregate
+{
+    uint64_t games;
+    uint64_t moves;
+    uint64_t length;                       // total game length in ms
+    uint64_t resumed;
+    uint64_t stateless;
+    uint64_t outcome[4];
+    uint64_t opening[NCELLS + 1][4];       // outcome per server opening square
+    uint64_t reply[NCELLS + 1][NCELLS + 1]; // client reply per opening square
+    struct client_table clients;
+};
+
+struct scan_job
+{
+    const struct archive_block **blocks;
+    size_t nblocks;
+    atomic_size_t next;
+    uint64_t from, to;
+    bool want_clients;
+};
+
+struct worker
+{
+    pthread_t tid;
+    struct scan_job *job;
+    struct aggregate agg;
+};
+
+static struct client_stat *client_slot(struct client_table *t, uint64_t key)
+{
+    if (t->used * 2 >= t->cap) {
+        size_t ncap = t->cap ? t->cap * 2 : 1024;
+        struct client_stat *nslots = calloc(ncap, sizeof(*nslots));
+        for (size_t i = 0; i < t->cap; ++i) {
+            if (t->slots[i].key == 0)
+                continue;
+            size_t j = (t->slots[i].key * 0x9e3779b97f4a7c15ULL) & (ncap - 1);
+            while (nslots[j].key != 0)
+                j = (j + 1) & (ncap - 1);
+            nslots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = nslots;
+        t->cap = ncap;
+    }
+
+    size_t i = (key * 0x9e3779b97f4a7c15ULL) & (t->cap - 1);
+    while (t->slots[i].key != 0 && t->slots[i].key != key)
+        i = (i + 1) & (t->cap - 1);
+
+    if (t->slots[i].key == 0) {
+        t->slots[i].key = key;
+        t->used++;
+    }
+    return &t->slots[i];
+}
+
+/**
+ * Aggregate every game of block @blk that started within [@from, @to]
+ */
+static void scan_block(const struct archive_block *blk, struct aggregate *agg,
+                       uint64_t from, uint64_t to, bool want_clients)
+{
+    struct archive_cols c = archive_columns(blk);
+    bool whole = blk->ts_min >= from && blk->ts_max <= to;
+
+    for (uint32_t i = 0; i < blk->count; ++i) {
+        if (!whole && (c.start[i] < from || c.start[i] > to))
+            continue;
+
+        uint64_t mv = c.moves[i];
+        int out = c.outcome[i] & 3;
+        int nmoves = (64 - __builtin_clzll(mv | 1) + 3) / 4;
+        int first = archive_move(mv, 0);
+        int second = archive_move(mv, 1);
+
+        agg->games++;
+        agg->moves += mv ? nmoves : 0;
+        agg->length += c.length[i];
+        agg->outcome[out]++;
+        agg->resumed += c.flags[i] & REC_RESUMED;
+        agg->stateless += !!(c.flags[i] & REC_COOKIE);
+
+        // the opening of a resumed or stateless game is unknown
+        if (!(c.flags[i] & (REC_RESUMED | REC_COOKIE))) {
+            agg->opening[first][out]++;
+            agg->reply[first][second]++;
+        }
+
+        if (want_clients) {
+            uint64_t key = (uint64_t)c.addr[i] << 16 | c.port[i];
+            struct client_stat *cs = client_slot(&agg->clients, key);
+            cs->games++;
+            cs->moves += mv ? nmoves : 0;
+            cs->outcome[out]++;
+        }
+    }
+}
+
+static void *scan_worker(void *arg)
+{
+    struct worker *w = arg;
+    struct scan_job *job = w->job;
+
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->nblocks) {
+        scan_block(job->blocks[i], &w->agg, job->from, job->to,
+                   job->want_clients);
+    }
+    return NULL;
+}
+
+static void merge(struct aggregate *dst, const struct aggregate *src)
+{
+    dst->games += src->games;
+    dst->moves += src->moves;
+    dst->length += src->length;
+    dst->resumed += src->resumed;
+    dst->stateless += src->stateless;
+    for (int o = 0; o < 4; ++o)
+        dst->outcome[o] += src->outcome[o];
+    for (int i = 0; i <= NCELLS; ++i) {
+        for (int o = 0; o < 4; ++o)
+            dst->opening[i][o] += src->opening[i][o];
+        for (int j = 0; j <= NCELLS; ++j)
+            dst->reply[i][j] += src->reply[i][j];
+    }
+    for (size_t i = 0; i < src->clients.cap; ++i) {
+        const struct client_stat *s = &src->clients.slots[i];
+        if (s->key == 0)
+            continue;
+        struct client_stat *d = client_slot(&dst->clients, s->key);
+        d->games += s->games;
+        d->moves += s->moves;
+        for (int o = 0; o < 4; ++o)
+            d->outcome[o] += s->outcome[o];
+    }
+}
+
+static double pct(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void print_summary(const struct aggregate *agg)
+{
+    printf("games           %llu\n", (unsigned long long)agg->games);
+    printf("resumed         %llu\n", (unsigned long long)agg->resumed);
+    printf("stateless       %llu\n", (unsigned long long)agg->stateless);
+    printf("server wins     %6.2f%%\n", pct(agg->outcome[OUT_SERVER], agg->games));
+    printf("client wins     %6.2f%%\n", pct(agg->outcome[OUT_CLIENT], agg->games));
+    printf("ties            %6.2f%%\n", pct(agg->outcome[OUT_TIE], agg->games));
+    printf("unfinished      %6.2f%%\n", pct(agg->outcome[OUT_UNFINISHED], agg->games));
+    printf("avg moves       %6.2f\n",
+           agg->games ? (double)agg->moves / agg->games : 0.0);
+    printf("avg length      %6.2f ms\n",
+           agg->games ? (double)agg->length / agg->games : 0.0);
+}
+
+static void print_openings(const struct aggregate *agg)
+{
+    printf("square    games  server%%  client%%    tie%%  top reply\n");
+    for (int sq = 1; sq <= NCELLS; ++sq) {
+        const uint64_t *o = agg->opening[sq];
+        uint64_t n = o[0] + o[1] + o[2] + o[3];
+        int best = 0;
+        for (int r = 1; r <= NCELLS; ++r) {
+            if (agg->reply[sq][r] > agg->reply[sq][best])
+                best = r;
+        }
+        printf("%6d %8llu  %7.2f  %7.2f  %6.2f  %9d\n", sq,
+               (unsigned long long)n, pct(o[OUT_SERVER], n),
+               pct(o[OUT_CLIENT], n), pct(o[OUT_TIE], n), best);
+    }
+}
+
+static int cmp_games(const void *a, const void *b)
+{
+    const struct client_stat *x = a, *y = b;
+    return (x->games < y->games) - (x->games > y->games);
+}
+
+static void print_clients(const struct aggregate *agg, int top)
+{
+    const struct client_table *t = &agg->clients;
+    struct client_stat *all = malloc((t->used + 1) * sizeof(*all));
+    size_t n = 0;
+    for (size_t i = 0; i < t->cap; ++i) {
+        if (t->slots[i].key != 0)
+            all[n++] = t->slots[i];
+    }
+    qsort(all, n, sizeof(*all), cmp_games);
+
+    printf("%-21s %8s  %7s  %7s  %9s\n",
+           "client", "games", "won%", "lost%", "avg moves");
+    for (size_t i = 0; i < n && i < (size_t)top; ++i) {
+        struct in_addr in = { (uint32_t)(all[i].key >> 16) };
+        char buf[INET_ADDRSTRLEN + 8];
+        snprintf(buf, sizeof(buf), "%s:%u", inet_ntoa(in),
+                 ntohs((uint16_t)all[i].key));
+        printf("%-21s %8llu  %7.2f  %7.2f  %9.2f\n", buf,
+               (unsigned long long)all[i].games,
+               pct(all[i].outcome[OUT_CLIENT], all[i].games),
+               pct(all[i].outcome[OUT_SERVER], all[i].games),
+               (double)all[i].moves / all[i].games);
+    }
+    printf("distinct clients %zu\n", n);
+    free(all);
+}
+
+int main(int argc, char *argv[])
+{
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int top = 10;
+    uint64_t from = 0, to = UINT64_MAX;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:s:e:n:")) != -1) {
+        switch (opt) {
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            from = strtoull(optarg, NULL, 10);
+            break;
+        case 'e':
+            to = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            top = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind >= argc || nthreads < 1) {
+    usage:
+        errmsg("Usage: %s [-j threads] [-s from-ms] [-e to-ms] [-n top] "
+               "<archive> [summary|openings|clients]...\n", argv[0]);
+        exit(1);
+    }
+
+    const char *path = argv[optind++];
+    bool want_summary = optind >= argc, want_openings = optind >= argc;
+    bool want_clients = false;
+    for (int i = optind; i < argc; ++i) {
+        if (strcmp(argv[i], "summary") == 0)
+            want_summary = true;
+        else if (strcmp(argv[i], "openings") == 0)
+            want_openings = true;
+        else if (strcmp(argv[i], "clients") == 0)
+            want_clients = true;
+        else
+            goto usage;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        errmsg("Unable to open archive %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    if ((size_t)st.st_size < sizeof(struct archive_header)) {
+        errmsg("Archive %s is truncated\n", path);
+        exit(1);
+    }
+
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        errmsg("Unable to map archive: %s\n", strerror(errno));
+        exit(1);
+    }
+    madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+
+    const struct archive_header *hdr = (const struct archive_header *)base;
+    if (hdr->magic != ARCHIVE_MAGIC || hdr->version != ARCHIVE_VERSION) {
+        errmsg("%s is not a game archive\n", path);
+        exit(1);
+    }
+
+    // build the block index, skipping blocks outside of the time range
+    struct scan_job job;
+    size_t cap = 1024, skipped = 0;
+    job.blocks = malloc(cap * sizeof(*job.blocks));
+    job.nblocks = 0;
+    atomic_init(&job.next, 0);
+    job.from = from;
+    job.to = to;
+    job.want_clients = want_clients;
+
+    size_t off = sizeof(*hdr);
+    while (off + sizeof(struct archive_block) <= (size_t)st.st_size) {
+        const struct archive_block *blk =
+            (const struct archive_block *)(base + off);
+        // the columns are located from the count, so it must match the size
+        if (blk->magic != BLOCK_MAGIC
+            || blk->size != archive_block_size(blk->count)
+            || off + sizeof(*blk) + blk->size > (size_t)st.st_size) {
+            errmsg("Corrupted block at offset %zu, stop scanning\n", off);
+            break;
+        }
+        off += sizeof(*blk) + blk->size;
+
+        if (blk->ts_max < from || blk->ts_min > to) {
+            skipped++;
+            continue;
+        }
+        if (job.nblocks == cap) {
+            cap *= 2;
+            job.blocks = realloc(job.blocks, cap * sizeof(*job.blocks));
+        }
+        job.blocks[job.nblocks++] = blk;
+    }
+
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    for (int i = 0; i < nthreads; ++i) {
+        workers[i].job = &job;
+        pthread_create(&workers[i].tid, NULL, scan_worker, &workers[i]);
+    }
+
+    struct aggregate total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(workers[i].tid, NULL);
+        merge(&total, &workers[i].agg);
+        free(workers[i].agg.clients.slots);
+    }
+
+    printf("blocks scanned %zu, skipped %zu, threads %d\n\n",
+           job.nblocks, skipped, nthreads);
+    if (want_summary) {
+        print_summary(&total);
+        putchar('\n');
+    }
+    if (want_openings) {
+        print_openings(&total);
+        putchar('\n');
+    }
+    if (want_clients) {
+        print_clients(&total, top);
+    }
+
+    free(total.clients.slots);
+    free(workers);
+    free(job.blocks);
+    munmap((void *)base, st.st_size);
+    close(fd);
+
+    return 0;
+}
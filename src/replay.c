@@ -0,0 +1,706 @@
+/**
+ * File: replay.c
+ * Replays a traffic capture against a server
+ *
+ * Every client address of a capture made with tictactoeServer -W gets a
+ * socket of its own and sends its requests in their recorded order, the
+ * next one only after the reply to the previous one or a timeout. At speed
+ * 1 the requests keep their recorded spacing, at speed N they come N times
+ * as fast and with -m as fast as the server answers.
+ *
+ * The server hands out its own game IDs, so IDs and cookies in later
+ * requests are rewritten from the replies of the replay. A reply whose
+ * response codes differ from the recorded ones counts as diverged, as when
+ * a random server move takes a square the recorded client moves to next.
+ * A v4 game the replay server already ended takes no more moves, so the
+ * recorded moves that follow are skipped instead of timed out.
+ * Reply latency percentiles can be saved and compared with a replay of the
+ * same capture against another build.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "network.h"
+#include "capture.h"
+#include "list.h"
+
+#define PROTO_VERSION 4
+#define CLIENT_BUCKETS 4096
+#define MAX_MAPPINGS   128    // recent game IDs remembered per client
+#define HIST_US        100000 // latency histogram range, 1us buckets
+#define MAX_EVENTS     64
+
+struct request
+{
+    uint64_t t_us;         // capture time, from the first record
+    const uint8_t *data;   // datagram, in the capture mapping
+    const uint8_t *reply;  // recorded reply, NULL if there was none
+    uint16_t len, reply_len;
+};
+
+// Game @orig of the capture is game @game in the replay
+struct mapping
+{
+    uint32_t orig, game;
+    bool has_cookie;
+    char cookie[NROWS * NCOLS];
+};
+
+struct client
+{
+    struct sockaddr_in addr; // recorded address
+    int fd;                  // replay socket, -1 before the first request
+    struct request *reqs;
+    int nreqs, cap, next;
+    bool waiting;
+    bool v4_over;            // the v4 game of the replay has ended
+    uint32_t gen;            // bumped on every request, for timeouts
+    uint64_t sent;           // send time of the request in flight, ns
+    struct mapping map[MAX_MAPPINGS];
+    int nmap;
+    struct list_head hash;
+};
+
+// Send the next request of @client at @due, or time it out if @timeout
+struct event
+{
+    uint64_t due;
+    uint64_t seq;
+    int client;
+    uint32_t gen;
+    bool timeout;
+};
+
+static struct
+{
+    uint64_t requests, responses, lost, diverged;
+    uint64_t unanswered; // requests without a reply in the capture
+    uint64_t skipped;    // v4 moves to a game the replay already ended
+    uint64_t hist[HIST_US + 1];
+    uint64_t max_ns;
+} st;
+
+static struct addrinfo *server;
+static int epoll_fd;
+static double speed = 1;   // 0 for as fast as possible
+static uint64_t timeout_ns = 500000000;
+static uint64_t start_ns;
+
+static struct client **clients;
+static int nclients, clients_cap;
+static struct list_head client_bucket[CLIENT_BUCKETS];
+
+static struct event *heap;
+static size_t nevents, heap_cap;
+static uint64_t next_seq;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* events, a binary min-heap on (due, seq) */
+
+static inline bool before(const struct event *a, const struct event *b)
+{
+    return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+static void push_event(uint64_t due, int client, uint32_t gen, bool timeout)
+{
+    if (nevents == heap_cap) {
+        heap_cap = heap_cap ? 2 * heap_cap : 1024;
+        heap = realloc(heap, heap_cap * sizeof(*heap));
+    }
+
+    struct event ev = { due, next_seq++, client, gen, timeout };
+    size_t i = nevents++;
+    while (i > 0 && before(&ev, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = ev;
+}
+
+static struct event pop_event()
+{
+    struct event top = heap[0];
+    struct event last = heap[--nevents];
+    size_t i = 0;
+
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= nevents)
+            break;
+        if (c + 1 < nevents && before(&heap[c + 1], &heap[c]))
+            c++;
+        if (!before(&heap[c], &last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* capture loading */
+
+static struct list_head *bucket_of(struct sockaddr_in addr)
+{
+    uint32_t h = (addr.sin_addr.s_addr ^ addr.sin_port) * 2654435761u;
+    return &client_bucket[h >> 20 & (CLIENT_BUCKETS - 1)];
+}
+
+static struct client *find_client(struct sockaddr_in addr, bool create)
+{
+    struct client *c;
+    list_for_each_entry(c, bucket_of(addr), hash) {
+        if (c->addr.sin_addr.s_addr == addr.sin_addr.s_addr
+            && c->addr.sin_port == addr.sin_port)
+            return c;
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if (nclients == clients_cap) {
+        clients_cap = clients_cap ? 2 * clients_cap : 256;
+        clients = realloc(clients, clients_cap * sizeof(*clients));
+    }
+    c = calloc(1, sizeof(*c));
+    c->addr = addr;
+    c->fd = -1;
+    list_add(&c->hash, bucket_of(addr));
+    clients[nclients++] = c;
+    return c;
+}
+
+/**
+ * Split the capture @buf of @size bytes into the requests of each client,
+ * each paired with the reply that followed it. Return the number of
+ * requests, -1 if @buf is not a capture
+ */
+static int64_t load_capture(const uint8_t *buf, size_t size)
+{
+    struct capture_header hdr;
+    if (size < sizeof(hdr)) {
+        return -1;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.magic != CAPTURE_MAGIC || hdr.version != CAPTURE_VERSION) {
+        return -1;
+    }
+
+    int64_t nreqs = 0;
+    uint64_t t_us = 0;
+    size_t off = sizeof(hdr);
+    while (off + sizeof(struct capture_record) <= size) {
+        struct capture_record rec;
+        memcpy(&rec, buf + off, sizeof(rec));
+        off += sizeof(rec);
+
+        size_t len = rec.len & ~CAPTURE_REPLY;
+        if (off + len > size) {
+            break; // cut short by a crash
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = rec.addr;
+        addr.sin_port = rec.port;
+        t_us += rec.t_us;
+
+        bool reply = rec.len & CAPTURE_REPLY;
+        struct client *c = find_client(addr, !reply);
+        if (!reply) {
+            if (c->nreqs == c->cap) {
+                c->cap = c->cap ? 2 * c->cap : 16;
+                c->reqs = realloc(c->reqs, c->cap * sizeof(*c->reqs));
+            }
+            struct request *r = &c->reqs[c->nreqs++];
+            memset(r, 0, sizeof(*r));
+            r->t_us = t_us;
+            r->data = buf + off;
+            r->len = len;
+            nreqs++;
+        } else if (c && c->nreqs > 0 && !c->reqs[c->nreqs - 1].reply) {
+            // the server answers a request before it reads the next one
+            c->reqs[c->nreqs - 1].reply = buf + off;
+            c->reqs[c->nreqs - 1].reply_len = len;
+        }
+        off += len;
+    }
+    return nreqs;
+}
+
+/* game ID mapping */
+
+static struct mapping *find_mapping(struct client *c, uint32_t orig)
+{
+    int n = c->nmap < MAX_MAPPINGS ? c->nmap : MAX_MAPPINGS;
+    for (int i = 0; i < n; ++i) {
+        if (c->map[i].orig == orig)
+            return &c->map[i];
+    }
+    return NULL;
+}
+
+static void learn_mapping(struct client *c, uint32_t orig, uint32_t game,
+                          const char *cookie)
+{
+    struct mapping *m = find_mapping(c, orig);
+    if (!m) {
+        m = &c->map[c->nmap++ % MAX_MAPPINGS];
+    }
+    m->orig = orig;
+    m->game = game;
+    m->has_cookie = (cookie != NULL);
+    if (cookie)
+        memcpy(m->cookie, cookie, sizeof(m->cookie));
+}
+
+/**
+ * Rewrite the game IDs and cookies of request @buf to those of the replay
+ */
+static void rewrite(struct client *c, uint8_t *buf, int len)
+{
+    if (len >= (int)MIN_MESSAGE && buf[0] == PROTO_VERSION) {
+        struct message *msg = (struct message *)buf;
+        struct mapping *m = find_mapping(c, msg->game);
+        if (msg->cmd == MOVE && m)
+            msg->game = m->game;
+        return;
+    }
+
+    struct header_v5 hdr;
+    if (len < (int)sizeof(hdr))
+        return;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.version != VERSION_V5
+        || len < (int)(sizeof(hdr) + hdr.count * sizeof(struct message_v5)))
+        return;
+
+    for (int i = 0; i < hdr.count; ++i) {
+        struct message_v5 msg;
+        uint8_t *p = buf + sizeof(hdr) + i * sizeof(msg);
+        memcpy(&msg, p, sizeof(msg));
+
+        struct mapping *m = find_mapping(c, ntohl(msg.game));
+        if (msg.cmd != MOVE || !m)
+            continue;
+        msg.game = htonl(m->game);
+        if ((msg.flags & MSG_COOKIE) && m->has_cookie)
+            memcpy(msg.board, m->cookie, sizeof(msg.board));
+        memcpy(p, &msg, sizeof(msg));
+    }
+}
+
+/**
+ * Learn the game IDs of reply @buf and compare it with the recorded reply
+ * @orig. Return whether the response codes differ
+ */
+static bool compare_reply(struct client *c, const uint8_t *buf, int len,
+                          const uint8_t *orig, int orig_len)
+{
+    if (len >= (int)MIN_MESSAGE && buf[0] == PROTO_VERSION) {
+        if (orig_len < (int)MIN_MESSAGE || orig[0] != PROTO_VERSION)
+            return true;
+        const struct message *msg = (const struct message *)buf;
+        const struct message *old = (const struct message *)orig;
+        if (old->game)
+            learn_mapping(c, old->game, msg->game, NULL);
+        return msg->resp != old->resp;
+    }
+
+    struct header_v5 hdr, old_hdr;
+    if (len < (int)sizeof(hdr) || orig_len < (int)sizeof(old_hdr))
+        return true;
+    memcpy(&hdr, buf, sizeof(hdr));
+    memcpy(&old_hdr, orig, sizeof(old_hdr));
+    int need = sizeof(hdr) + hdr.count * sizeof(struct message_v5);
+    if (hdr.version != VERSION_V5 || old_hdr.version != VERSION_V5
+        || hdr.count != old_hdr.count || len < need || orig_len < need)
+        return true;
+
+    bool diverged = false;
+    for (int i = 0; i < hdr.count; ++i) {
+        struct message_v5 msg, old;
+        memcpy(&msg, buf + sizeof(hdr) + i * sizeof(msg), sizeof(msg));
+        memcpy(&old, orig + sizeof(hdr) + i * sizeof(old), sizeof(old));
+        if (old.game)
+            learn_mapping(c, ntohl(old.game), ntohl(msg.game),
+                          (msg.flags & MSG_COOKIE) ? msg.board : NULL);
+        diverged |= (msg.resp != old.resp);
+    }
+    return diverged;
+}
+
+/* replay */
+
+static uint64_t due_of(const struct request *r, uint64_t now)
+{
+    if (speed == 0) {
+        return now;
+    }
+    uint64_t due = start_ns + (uint64_t)(r->t_us * 1000 / speed);
+    return due > now ? due : now;
+}
+
+static void advance(int idx, uint64_t now);
+
+static void send_next(int idx, uint64_t now)
+{
+    struct client *c = clients[idx];
+    struct request *r = &c->reqs[c->next];
+
+    if (c->fd < 0) {
+        c->fd = socket(server->ai_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = idx };
+        if (c->fd < 0
+            || connect(c->fd, server->ai_addr, server->ai_addrlen) < 0
+            || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+            fprintf(stderr, "Unable to create client socket: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+    }
+
+    // the server does not answer moves without a v4 session
+    if (r->len >= MIN_MESSAGE && r->data[0] == PROTO_VERSION) {
+        const struct message *msg = (const struct message *)r->data;
+        if (msg->cmd == NGAME || msg->cmd == RGAME) {
+            c->v4_over = false;
+        } else if (msg->cmd == MOVE && c->v4_over) {
+            st.skipped++;
+            advance(idx, now);
+            return;
+        }
+    }
+
+    uint8_t buf[MAX_PACKET];
+    memcpy(buf, r->data, r->len);
+    rewrite(c, buf, r->len);
+
+    c->gen++;
+    c->sent = now;
+    if (send(c->fd, buf, r->len, 0) == r->len) {
+        st.requests++;
+    }
+
+    // the server did not answer this one in the capture either
+    if (!r->reply) {
+        st.unanswered++;
+        advance(idx, now);
+        return;
+    }
+    c->waiting = true;
+    push_event(now + timeout_ns, idx, c->gen, true);
+}
+
+/**
+ * Move client @idx on to its next request, or close it after its last
+ */
+static void advance(int idx, uint64_t now)
+{
+    struct client *c = clients[idx];
+    c->waiting = false;
+
+    if (++c->next < c->nreqs) {
+        push_event(due_of(&c->reqs[c->next], now), idx, c->gen, false);
+    } else if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void handle_reply(int idx, uint64_t now)
+{
+    struct client *c = clients[idx];
+    uint8_t buf[MAX_PACKET];
+    ssize_t len;
+
+    while ((len = recv(c->fd, buf, sizeof(buf), 0)) >= 0) {
+        if (!c->waiting) {
+            continue; // late reply to a timed out request
+        }
+
+        uint64_t ns = now - c->sent;
+        uint64_t us = ns / 1000;
+        st.hist[us < HIST_US ? us : HIST_US]++;
+        if (ns > st.max_ns)
+            st.max_ns = ns;
+        st.responses++;
+
+        if (len >= (ssize_t)MIN_MESSAGE && buf[0] == PROTO_VERSION) {
+            const struct message *msg = (const struct message *)buf;
+            c->v4_over = (msg->resp == GAMEOVR || msg->resp == GAMOVRACK);
+        }
+
+        const struct request *r = &c->reqs[c->next];
+        if (r->reply && compare_reply(c, buf, len, r->reply, r->reply_len))
+            st.diverged++;
+
+        advance(idx, now);
+        if (c->fd < 0)
+            return;
+    }
+}
+
+/* latency summaries */
+
+static double percentile(const uint64_t *hist, uint64_t total, double p)
+{
+    uint64_t target = (uint64_t)(p * total), seen = 0;
+    for (int us = 0; us <= HIST_US; ++us) {
+        seen += hist[us];
+        if (seen > target)
+            return us;
+    }
+    return HIST_US;
+}
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *quantile_names[] = { "p50", "p90", "p99", "p999" };
+#define NQUANTILES 4
+
+static void print_latency(const char *label, const uint64_t *hist,
+                          uint64_t total)
+{
+    printf("%-13s", label);
+    for (int q = 0; q < NQUANTILES; ++q)
+        printf(" %s %.0f ", quantile_names[q],
+               percentile(hist, total, quantiles[q]));
+    printf("\n");
+}
+
+/**
+ * Save the latency histogram to @path, one "us count" line per bucket
+ */
+static int save_latency(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Unable to save latency to %s: %s\n", path,
+                strerror(errno));
+        return -1;
+    }
+    fprintf(f, "# tictactoeReplay latency, us count\n");
+    for (int us = 0; us <= HIST_US; ++us) {
+        if (st.hist[us])
+            fprintf(f, "%d %llu\n", us, (unsigned long long)st.hist[us]);
+    }
+    return fclose(f);
+}
+
+/**
+ * Print the latency saved in @path next to this run and the change
+ */
+static int compare_latency(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Unable to read baseline %s: %s\n", path,
+                strerror(errno));
+        return -1;
+    }
+
+    uint64_t *base = calloc(HIST_US + 1, sizeof(*base)), total = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        int us;
+        unsigned long long count;
+        if (line[0] != '#' && sscanf(line, "%d %llu", &us, &count) == 2
+            && us >= 0 && us <= HIST_US) {
+            base[us] += count;
+            total += count;
+        }
+    }
+    fclose(f);
+
+    print_latency("baseline us", base, total);
+    printf("%-13s", "change");
+    for (int q = 0; q < NQUANTILES; ++q) {
+        double was = percentile(base, total, quantiles[q]);
+        double now = percentile(st.hist, st.responses, quantiles[q]);
+        printf(" %s %+.1f%%", quantile_names[q],
+               was > 0 ? 100.0 * (now - was) / was : 0.0);
+    }
+    printf("\n");
+
+    free(base);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *save_path = NULL;
+    const char *base_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:ms:o:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            base_path = optarg;
+            break;
+        case 'm':
+            speed = 0;
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'o':
+            save_path = optarg;
+            break;
+        case 't':
+            timeout_ns = strtoull(optarg, NULL, 10) * 1000000;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (argc - optind != 3 || speed < 0 || timeout_ns == 0) {
+    usage:
+        fprintf(stderr, "Usage: %s [-s speed | -m] [-t timeout-ms] "
+                "[-o latency-file] [-b baseline-file]\n"
+                "       <capture> <host> <port>\n", argv[0]);
+        exit(1);
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", argv[optind],
+                strerror(errno));
+        exit(1);
+    }
+    const uint8_t *capture = NULL;
+    if (sb.st_size > 0) {
+        capture = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    for (int i = 0; i < CLIENT_BUCKETS; ++i)
+        INIT_LIST_HEAD(&client_bucket[i]);
+    int64_t total = (capture && capture != MAP_FAILED)
+        ? load_capture(capture, sb.st_size) : -1;
+    if (total < 0) {
+        fprintf(stderr, "%s is not a capture\n", argv[optind]);
+        exit(1);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int status = getaddrinfo(argv[optind + 1], argv[optind + 2], &hints,
+                             &server);
+    if (status != 0) {
+        fprintf(stderr, "Unable to resolve server: %s\n", gai_strerror(status));
+        exit(1);
+    }
+
+    // every client in flight holds a socket, allow as many as we may
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        fprintf(stderr, "Unable to create epoll instance: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+
+    start_ns = now_ns();
+    for (int i = 0; i < nclients; ++i) {
+        push_event(due_of(&clients[i]->reqs[0], start_ns), i, 0, false);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (nevents > 0) {
+        uint64_t now = now_ns();
+        while (nevents > 0 && heap[0].due <= now) {
+            struct event ev = pop_event();
+            struct client *c = clients[ev.client];
+            if (!ev.timeout) {
+                send_next(ev.client, now);
+            } else if (c->waiting && c->gen == ev.gen) {
+                st.lost++;
+                advance(ev.client, now);
+            }
+        }
+        if (nevents == 0) {
+            break;
+        }
+
+        int timeout = 0;
+        if (heap[0].due > now)
+            timeout = (int)((heap[0].due - now + 999999) / 1000000);
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        now = now_ns();
+        for (int i = 0; i < n; ++i) {
+            handle_reply(events[i].data.u32, now);
+        }
+    }
+
+    double secs = (now_ns() - start_ns) / 1e9;
+    printf("replayed      %llu of %lld requests from %d clients in %.2f s, ",
+           (unsigned long long)st.requests, (long long)total, nclients, secs);
+    if (speed == 0)
+        printf("max speed\n");
+    else
+        printf("speed %gx\n", speed);
+    printf("replies       %llu answered, %llu lost, %llu diverged from the "
+           "capture\n", (unsigned long long)st.responses,
+           (unsigned long long)st.lost, (unsigned long long)st.diverged);
+    printf("unanswered    %llu requests not answered in the capture either\n",
+           (unsigned long long)st.unanswered);
+    printf("skipped       %llu moves to v4 games the replay ended early\n",
+           (unsigned long long)st.skipped);
+    print_latency("latency us", st.hist, st.responses);
+    printf("max latency   %.0f us\n", st.max_ns / 1e3);
+
+    int rc = 0;
+    if (base_path && compare_latency(base_path) < 0)
+        rc = 1;
+    if (save_path && save_latency(save_path) < 0)
+        rc = 1;
+
+    for (int i = 0; i < nclients; ++i) {
+        if (clients[i]->fd >= 0)
+            close(clients[i]->fd);
+        free(clients[i]->reqs);
+        free(clients[i]);
+    }
+    free(clients);
+    free(heap);
+    freeaddrinfo(server);
+    munmap((void *)capture, sb.st_size);
+    return rc;
+}
@@ -0,0 +1,277 @@
+/**
+ * File: selfplay.c
+ * In-process self-play tournament between two engines
+ *
+ * Plays games entirely in memory across all cores, with one random
+ * generator per thread and logging turned off. Engines alternate the first
+ * move every game. Games are played in batches, a move on every board of a
+ * batch before the next, so the rules of libtictactoe run on whole arrays
+ * of boards. Reports throughput, results and the move latency distribution
+ * of each engine.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "game.h"
+#include "engine.h"
+#include "rng.h"
+#include "tictactoe.h"
+
+FILE *log_file = NULL;
+
+#define SUB_BITS 4
+#define NBUCKETS (64 << SUB_BITS)
+
+struct result
+{
+    uint64_t games;
+    uint64_t wins[2];  // wins of engine A and B
+    uint64_t draws;
+    uint64_t first_wins; // wins of whoever moved first
+    uint64_t moves[2];
+    uint64_t hist[2][NBUCKETS]; // move latency, log-linear ns buckets
+};
+
+struct worker
+{
+    pthread_t tid;
+    enum Engine engines[2];
+    uint64_t first_game, ngames;
+    uint64_t seed;
+    size_t batch; // games played in lockstep
+    bool timing;
+    struct result res;
+};
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Histogram bucket of @ns: exact below 2^SUB_BITS, then 2^SUB_BITS linear
+ * sub-buckets per power of two
+ */
+static inline int bucket_of(uint64_t ns)
+{
+    if (ns < (1 << SUB_BITS))
+        return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    int sub = (int)(ns >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return ((e - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+/**
+ * Lower bound in ns of histogram bucket @b
+ */
+static uint64_t bucket_floor(int b)
+{
+    if (b < (1 << SUB_BITS))
+        return b;
+    int e = (b >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = b & ((1 << SUB_BITS) - 1);
+    return (1ULL << e) | (sub << (e - SUB_BITS));
+}
+
+/**
+ * Count the finished game @g, which engine A started if @first is 0
+ */
+static void score(struct result *res, int first, int winner)
+{
+    res->games++;
+    if (winner < 0) {
+        res->draws++;
+    } else {
+        // player 1 is whoever moved first
+        res->wins[(winner == 1) ? first : first ^ 1]++;
+        res->first_wins += (winner == 1);
+    }
+}
+
+static void *play_games(void *arg)
+{
+    struct worker *w = arg;
+    struct result *res = &w->res;
+    struct rng rng;
+    rng_seed(&rng, w->seed);
+
+    char (*boards)[TTT_CELLS] = malloc(w->batch * sizeof(*boards));
+    int *moves = malloc(w->batch * sizeof(*moves));
+    int *winners = malloc(w->batch * sizeof(*winners));
+
+    // games of a batch are played in lockstep, one move on every board,
+    // then all boards checked in one call
+    uint64_t end = w->first_game + w->ngames;
+    for (uint64_t g0 = w->first_game; g0 < end; g0 += w->batch) {
+        size_t n = (end - g0 < w->batch) ? end - g0 : w->batch;
+        size_t playing = n;
+        ttt_init_batch(boards, n);
+        memset(winners, 0, n * sizeof(*winners));
+
+        for (int turn = 0; playing > 0; ++turn) {
+            int player = 1 + (turn & 1);
+            for (size_t b = 0; b < n; ++b) {
+                if (winners[b] != 0) {
+                    moves[b] = 0;
+                    continue;
+                }
+                // engine A moves first in even games
+                int side = ((g0 + b) & 1) ^ (turn & 1);
+                enum Engine e = w->engines[side];
+                if (w->timing) {
+                    uint64_t start = now_ns();
+                    moves[b] = engine_move(e, player, boards[b], &rng);
+                    res->hist[side][bucket_of(now_ns() - start)]++;
+                } else {
+                    moves[b] = engine_move(e, player, boards[b], &rng);
+                }
+                res->moves[side]++;
+            }
+
+            ttt_play_batch(boards, player, moves, n);
+            ttt_winner_batch((const char (*)[TTT_CELLS])boards, winners, n);
+            for (size_t b = 0; b < n; ++b) {
+                if (moves[b] != 0 && winners[b] != 0) {
+                    score(res, (g0 + b) & 1, winners[b]);
+                    playing--;
+                }
+            }
+        }
+    }
+
+    free(boards);
+    free(moves);
+    free(winners);
+    return NULL;
+}
+
+static void print_latency(const char *name, const uint64_t *hist,
+                          uint64_t moves)
+{
+    const double ps[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t at[4] = { 0 }, max = 0, seen = 0;
+    int next = 0;
+
+    for (int b = 0; b < NBUCKETS; ++b) {
+        if (hist[b] == 0)
+            continue;
+        seen += hist[b];
+        max = bucket_floor(b);
+        while (next < 4 && seen > ps[next] * moves)
+            at[next++] = bucket_floor(b);
+    }
+    printf("%-10s move ns     p50 %llu  p90 %llu  p99 %llu  p999 %llu  max %llu\n",
+           name, (unsigned long long)at[0], (unsigned long long)at[1],
+           (unsigned long long)at[2], (unsigned long long)at[3],
+           (unsigned long long)max);
+}
+
+int main(int argc, char *argv[])
+{
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t ngames = 1000000;
+    uint64_t seed = time(NULL);
+    bool timing = true;
+    long batch = 64;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "B:D:j:n:s:q")) != -1) {
+        switch (opt) {
+        case 'B':
+            batch = atol(optarg);
+            break;
+        case 'D':
+            if (engine_table_open(optarg) < 0) {
+                exit(1);
+            }
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 'n':
+            ngames = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'q':
+            timing = false;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    int a, b;
+    if (argc - optind != 2 || nthreads < 1 || batch < 1
+        || (a = engine_by_name(argv[optind])) < 0
+        || (b = engine_by_name(argv[optind + 1])) < 0) {
+    usage:
+        errmsg("Usage: %s [-B batch] [-D table] [-j threads] [-n games] "
+               "[-s seed] [-q] <engine> <engine>\n", argv[0]);
+        errmsg("Engines: random, heuristic, perfect, table\n");
+        exit(1);
+    }
+
+    log_level = LOG_ERROR;
+
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    uint64_t start = now_ns();
+    for (int i = 0; i < nthreads; ++i) {
+        struct worker *w = &workers[i];
+        w->engines[0] = a;
+        w->engines[1] = b;
+        w->first_game = ngames * i / nthreads;
+        w->ngames = ngames * (i + 1) / nthreads - w->first_game;
+        w->seed = seed + i;
+        w->batch = batch;
+        w->timing = timing;
+        pthread_create(&w->tid, NULL, play_games, w);
+    }
+
+    struct result total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < nthreads; ++i) {
+        struct result *r = &workers[i].res;
+        pthread_join(workers[i].tid, NULL);
+
+        total.games += r->games;
+        total.draws += r->draws;
+        total.first_wins += r->first_wins;
+        for (int s = 0; s < 2; ++s) {
+            total.wins[s] += r->wins[s];
+            total.moves[s] += r->moves[s];
+            for (int k = 0; k < NBUCKETS; ++k)
+                total.hist[s][k] += r->hist[s][k];
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    printf("%llu games in %.3f s on %d threads, seed %llu\n",
+           (unsigned long long)total.games, secs, nthreads,
+           (unsigned long long)seed);
+    printf("throughput           %.0f games/s, %.0f moves/s\n",
+           total.games / secs, (total.moves[0] + total.moves[1]) / secs);
+    printf("%-10s wins       %6.2f%%\n", engine_name(a),
+           100.0 * total.wins[0] / total.games);
+    printf("%-10s wins       %6.2f%%\n", engine_name(b),
+           100.0 * total.wins[1] / total.games);
+    printf("draws                %6.2f%%\n", 100.0 * total.draws / total.games);
+    printf("first mover wins     %6.2f%%\n",
+           100.0 * total.first_wins / total.games);
+    if (timing) {
+        print_latency(engine_name(a), total.hist[0], total.moves[0]);
+        print_latency(engine_name(b), total.hist[1], total.moves[1]);
+    }
+
+    free(workers);
+    return 0;
+}
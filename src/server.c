@@ -24,22 +24,123 @@
 #include "list.h"
 #include "game.h"
 #include "network.h"
+#include "archive.h"
+#include "trace.h"
+#include "handoff.h"
+#include "spectator.h"
+#include "admin.h"
+#include "stats.h"
+#include "filter.h"
+#include "cookie.h"
+#include "handler.h"
+#include "busypoll.h"
+#include "engine.h"
+#include "capture.h"
+#include "match.h"
+#include "dispatch.h"
+#include "heavy.h"
+#include "mem.h"
+#include "local.h"
+#include "tstamp.h"
 
 FILE *log_file = NULL;
+static char *log_buf = NULL; // stdio buffer of log_file
 
-static bool sigint = false;
+static volatile sig_atomic_t sigint = 0;
 void exit_handler(int s);
 
 int main(int argc, char *argv[])
 {
     int rc; // general return codes
 
-    srand(time(NULL));
-
     set_style(stdout, "\033[2J\033[H");
     fflush(stdout);
-    if (argc < 2) {
-        errmsg("Usage: %s <port>\n", argv[0]);
+
+    const char *archive_path = NULL;
+    const char *handoff_path = NULL; // listen for hot restart
+    const char *takeover_path = NULL; // take over a running server
+    const char *spectator_group = NULL;
+    const char *admin_path = NULL;
+    const char *capture_path = NULL;
+    const char *local_path = NULL;
+    enum TstampMode tstamp = TSTAMP_OFF;
+    uint64_t seed = time(NULL);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:A:B:CD:K:L:PQ:s:TH:R:S:U:W:")) != -1) {
+        switch (opt) {
+        case 'a':
+            archive_path = optarg;
+            break;
+        case 'C':
+            cookie_mode = true;
+            break;
+        case 'D':
+            // the mapping stays cold until moves look positions up
+            if (engine_table_open(optarg) < 0) {
+                exit(1);
+            }
+            move_engine = ENGINE_TABLE;
+            break;
+        case 'K':
+            if ((tstamp = tstamp_mode(optarg)) == TSTAMP_OFF) {
+                goto usage;
+            }
+            break;
+        case 'L':
+            slo_us = atoi(optarg);
+            break;
+        case 'P':
+            pvp_mode = true;
+            break;
+        case 'Q': {
+            // requests[:errors] per source and second
+            char *errs = strchr(optarg, ':');
+            throttle_requests = atoi(optarg);
+            if (errs) {
+                throttle_errors = atoi(errs + 1);
+            }
+            break;
+        }
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'A':
+            admin_path = optarg;
+            break;
+        case 'B':
+            busy_cpu = atoi(optarg);
+            break;
+        case 'H':
+            handoff_path = optarg;
+            break;
+        case 'R':
+            takeover_path = optarg;
+            break;
+        case 'S':
+            spectator_group = optarg;
+            break;
+        case 'T':
+            trace_sampling = true;
+            break;
+        case 'U':
+            local_path = optarg;
+            break;
+        case 'W':
+            capture_path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind >= argc && !takeover_path) {
+    usage:
+        errmsg("Usage: %s [-a archive] [-A socket] [-B cpu] [-C] [-D table] "
+               "[-K timestampns|timestamping] [-L slo-us] [-P] "
+               "[-Q requests[:errors]] [-s seed] [-T] [-H socket] "
+               "[-S group[:port]] [-U socket] [-W capture] "
+               "<port | -R socket>\n", argv[0]);
         exit(1);
     }
 
@@ -51,246 +152,148 @@ int main(int argc, char *argv[])
 
     sigaction(SIGINT, &sigint_handler, NULL);
 
-    int sockfd = init_socket(argc, argv);
-    int mcfd = init_mc_sock();
+    // create linked list of sessions
+    LIST_HEAD(list_session);
+
+    // a takeover replaces the key and the seed with those of the running
+    // server
+    cookie_init(NULL, 0);
+    seed_moves(seed);
+
+    int sockfd, mcfd;
+    if (takeover_path) {
+        // inherit sockets and sessions from the running server
+        if (handoff_receive(takeover_path, &sockfd, &mcfd, &list_session) < 0) {
+            exit(1);
+        }
+        // replace the filters of the old process to own the counters
+        filter_attach(sockfd, FILTER_GAME);
+        filter_attach(mcfd, FILTER_PROBE);
+    } else {
+        sockfd = init_socket(argv[optind]);
+        mcfd = init_mc_sock();
+    }
+
+    int hofd = -1;
+    if (handoff_path && (hofd = handoff_listen(handoff_path)) < 0) {
+        exit(1);
+    }
 
-    struct pollfd pfds[2];
+    int adminfd = -1;
+    if (admin_path && (adminfd = admin_listen(admin_path)) < 0) {
+        exit(1);
+    }
+
+    if (tstamp != TSTAMP_OFF && tstamp_enable(sockfd, tstamp) < 0) {
+        exit(1);
+    }
+
+    int localfd = -1;
+    if (local_path && (localfd = local_listen(local_path, sockfd)) < 0) {
+        exit(1);
+    }
+
+    if (busy_cpu >= 0) {
+        int fds[2] = { sockfd, mcfd };
+        if (busy_init(fds, 2) < 0) {
+            exit(1);
+        }
+    }
+
+    // unused slots hold -1 and are skipped by poll
+    struct pollfd pfds[6];
     pfds[0].fd = sockfd;
     pfds[0].events = POLLIN;
     pfds[1].fd = mcfd;
     pfds[1].events = POLLIN;
+    pfds[2].fd = hofd;
+    pfds[2].events = POLLIN;
+    pfds[3].fd = adminfd;
+    pfds[3].events = POLLIN;
+    pfds[4].fd = localfd;
+    pfds[4].events = POLLIN;
+    pfds[5].fd = -1;
+
+    uint64_t last_sweep = mono_ms();
+    bool handed_off = false;
 
     log_file = fopen("server.log", "a");
     if (!log_file) {
         goto error;
     }
+    log_buf = mem_alloc(MEM_LOGGING, BUFSIZ);
+    setvbuf(log_file, log_buf, _IOFBF, BUFSIZ);
     fprintf(log_file, "\n\n");
 
-    // create linked list of sessions
-    LIST_HEAD(list_session);
+    // the moves of any game follow from the seed and its game ID
+    infomsg("Move seed %llu\n", (unsigned long long)move_seed);
+
+    if (archive_path && archive_open(archive_path) < 0) {
+        goto error;
+    }
+
+    if (spectator_group && spectator_open(spectator_group) < 0) {
+        goto error;
+    }
+
+    if (capture_path && capture_open(capture_path, sockfd) < 0) {
+        goto error;
+    }
 
     do {
+        // publish the moves of the last iteration before waiting
+        spectator_flush();
+        admin_poll(&pfds[3], &pfds[5]);
+
         // server running
-        int poll_count = poll(pfds, 2, 10000);
-        if (poll_count < 0) {
+        int poll_count;
+        if (busy_cpu >= 0) {
+            poll_count = busy_poll(pfds, 6);
+        } else {
+            poll_count = poll(pfds, 6, 1000);
+        }
+        if (poll_count < 0 && errno == EINTR) {
+            continue;
+        } else if (poll_count < 0) {
             errmsg("Error, poll failed: %s\n", strerror(errno));
             goto error;
-        } else if (poll_count == 0) {
+        }
+
+        // drop idle sessions about once a second
+        if (mono_ms() - last_sweep >= 1000) {
+            expire_sessions(sockfd, &list_session);
+            heavy_roll();
+            last_sweep = mono_ms();
+        }
+
+        if (poll_count == 0) {
             continue;
         }
 
         if (pfds[0].revents & POLLIN) {
             // check if current sessions has incoming message
-            struct sockaddr_in addr;
-            socklen_t addr_len = sizeof(addr);
-            struct message msg;
-            char buf[addr_len];
-
-            tee(log_file, "\n");
-            rc = recvmsg_from(sockfd, &addr, &addr_len, &msg);
-            if (rc < 0) {
+            dispatch_sample(sockfd);
+            if (serve_packet(sockfd, &list_session) >= 0) {
+                busy_active();
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                busy_idle();
+            } else {
                 errmsg("Unable to receive message, retry: %s\n", strerror(errno));
-                continue;
-            }
-
-            if (msg.cmd == NGAME) { // new game request
-                infomsg("NEW GAME request from %s:%u\n",
-                        inet_ntop(AF_INET, &addr.sin_addr, buf, addr_len),
-                        addr.sin_port);
-
-                bool found = false;
-                struct session *pos;
-                list_for_each_entry(pos, &list_session, list) {
-                    if (equal_addr(pos->client, addr)) {
-                        found = true;
-                        break;
-                    }
-                }
-
-                if (found) {
-                    errmsg("Existing client sent new game request, rejecting\n");
-                    rc = send_move(sockfd, pos, 0, EBUSYGAME);
-                    if (rc <= 0) {
-                        errmsg("Unable to send response message: %s\n",
-                               strerror(errno));
-                    }
-                    goto mc;
-                }
-
-                struct session *sess = malloc(sizeof(struct session));
-                rc = init_session(sess, addr);
-                if (rc < 0) {
-                    errmsg("Server at full load, send busy response code\n");
-                    rc = send_move(sockfd, sess, 0, EBUSYGAME);
-                    if (rc <= 0) {
-                        errmsg("Unable to send response message: %s\n",
-                               strerror(errno));
-                    }
-                    goto mc;
-                }
-
-                int move = gen_move(sess->board);
-                play_move(1, move, sess->board);
-                print_board(sess->board, log_file);
-
-                infomsg("Assigned game ID %d to client %s:%u\n",
-                        sess->game_id,
-                        inet_ntop(AF_INET, &addr.sin_addr, buf, addr_len),
-                        addr.sin_port);
-                rc = send_move(sockfd, sess, move, SUCC);
-                if (rc <= 0) {
-                    errmsg("Unable to send initial message: %s\n", strerror(errno));
-                    goto mc;
-                }
-
-                INIT_LIST_HEAD(&sess->list);
-                list_add(&sess->list, &list_session);
-                infomsg("Added session to the current list\n");
-
-                continue;
-            } else if (msg.cmd == RGAME) {
-                // resume game request
-                infomsg("RESUME GAME request from %s:%u\n",
-                        inet_ntop(AF_INET, &addr.sin_addr, buf, addr_len),
-                        addr.sin_port);
-
-
-                if (rc < sizeof(msg)) {
-                    infomsg("Did not receive enough bytes\n");
-                    continue;
-                }
-
-                struct session *sess = malloc(sizeof(struct session));
-                rc = clone_session(sess, addr, msg);
-                if (rc < 0) {
-                    errmsg("Server at full load, ignore request\n");
-                    continue;
-                }
-
-                int move = gen_move(sess->board);
-                play_move(1, move, sess->board);
-
-                int winner = 0;
-                winner = checkwin(sess->board);
-                print_board(sess->board, log_file);
-
-                if (winner == 0) {
-                    infomsg("Assigned game ID %d to client %s:%u\n",
-                            sess->game_id,
-                            inet_ntop(AF_INET, &addr.sin_addr, buf, addr_len),
-                            addr.sin_port);
-                    rc = send_move(sockfd, sess, move, SUCC);
-                    if (rc <= 0) {
-                        errmsg("Unable to send initial message: %s\n",
-                               strerror(errno));
-                        goto mc;
-                    }
-
-                    INIT_LIST_HEAD(&sess->list);
-                    list_add(&sess->list, &list_session);
-                    infomsg("Added session to the current list\n");
-                    goto mc;
-                } else {
-                    infomsg("Sending move with winning message\n");
-                    rc = send_move(sockfd, sess, move, GAMEOVR);
-                    if (rc <= 0) {
-                        errmsg("Failed to send message to client: %s\n",
-                               strerror(errno));
-                    }
-                    free_session(sess);
-                    goto mc;
-                }
-
             }
+            tstamp_reap();
+        }
+        if (pfds[0].revents & POLLERR) {
+            // transmit timestamps of replies sent a while ago
+            tstamp_error();
+        }
 
-            struct session *sess = NULL;
-            list_for_each_entry(sess, &list_session, list) {
-                if (equal_addr(addr, sess->client)) {
-                    infomsg("New message from current session\n");
-
-                    // check for game ID
-                    if (msg.game != sess->game_id) {
-                        errmsg("Received mismatched game ID, expected %d, got %d\n",
-                               sess->game_id, msg.game);
-                        rc = send_move(sockfd, sess, 0, EGIDWRONG);
-                        if (rc <= 0) {
-                            errmsg("Unable to send response message: %s\n",
-                                   strerror(errno));
-                        }
-                        break;
-                    }
-
-                    if (msg.resp != SUCC
-                        && msg.resp != GAMEOVR
-                        && msg.resp != GAMOVRACK) {
-
-                        // error not able to handle
-                        break;
-                    }
-
-                    int winner = 0;
-
-                    set_style(stdout, "\033[2J\033[H");
-                    fflush(stdout);
-
-                    if (play_move(2, msg.move, sess->board)) {
-                        winner = checkwin(sess->board);
-                        print_board(sess->board, log_file);
-                    } else {
-                        errmsg("Received invalid move, send back response\n");
-                        rc = send_move(sockfd, sess, 0, EINVMOVE);
-                        if (rc <= 0) {
-                            errmsg("Unable to send response message: %s\n",
-                                   strerror(errno));
-                        }
-                        break;
-                    }
-
-                    ++(sess->turn);
-
-                    if (winner != 0) {
-                        infomsg("Server lost\n");
-                        // send acknowledge
-                        rc = send_move(sockfd, sess, 0, GAMOVRACK);
-
-                        // remove session from the list
-                        list_del(&sess->list);
-                        free_session(sess);
-                        break;
-                    }
-
-                    int move = gen_move(sess->board);
-                    play_move(1, move, sess->board);
-                    ++(sess->turn);
-
-                    winner = checkwin(sess->board);
-                    print_board(sess->board, log_file);
-
-                    if (winner == 0) {
-                        infomsg("Sending move to client\n");
-                        rc = send_move(sockfd, sess, move, SUCC);
-                        if (rc <= 0) {
-                            errmsg("Failed to send message to client: %s\n",
-                                   strerror(errno));
-                        }
-                    } else {
-                        infomsg("Sending move with winning message\n");
-                        rc = send_move(sockfd, sess, move, GAMEOVR);
-                        if (rc <= 0) {
-                            errmsg("Failed to send message to client: %s\n",
-                                   strerror(errno));
-                        }
-
-                        // remove session from the list
-                        list_del(&sess->list);
-                        free_session(sess);
-                        break;
-                    }
-                }
+        if (pfds[4].revents & POLLIN) {
+            // gateways on this host, same requests over the Unix socket
+            if (serve_packet(localfd, &list_session) < 0) {
+                errmsg("Unable to receive local message: %s\n", strerror(errno));
             }
         }
 
-    mc:
         if (pfds[1].revents & POLLIN) {
             // check multicast incoming message
             struct sockaddr_in addr;
@@ -302,20 +305,93 @@ int main(int argc, char *argv[])
             memset(&msg, 0, sizeof(msg));
             msg.version = VERSION;
             msg.resp = SPOTAVAIL;
+            stats.probes++;
 
             rc = sendmsg_to(sockfd, addr, msg);
         }
 
+        if (pfds[3].revents & POLLIN) {
+            admin_accept(adminfd);
+        }
+        if (pfds[5].revents) {
+            admin_io(sockfd, &list_session);
+        }
+
+        if (pfds[2].revents & POLLIN) {
+            // hot restart, a new server is taking over
+            archive_close();
+            capture_close();
+            // the new process binds the local path again, its games end here
+            end_local_games(sockfd, &list_session);
+            local_close();
+            rc = handoff_send(hofd, handoff_path, sockfd, mcfd, &list_session);
+            if (rc >= 0) {
+                infomsg("Hot restart complete, shutting down\n");
+                handed_off = true;
+                break;
+            }
+
+            errmsg("Hot restart failed, keep serving\n");
+            close(hofd);
+            pfds[2].fd = hofd = handoff_listen(handoff_path);
+            if (archive_path && archive_open(archive_path) < 0) {
+                goto error;
+            }
+            if (capture_path && capture_open(capture_path, sockfd) < 0) {
+                goto error;
+            }
+            if (local_path
+                && (pfds[4].fd = localfd = local_listen(local_path, sockfd)) < 0) {
+                goto error;
+            }
+        }
+
     } while (!sigint);
 
+    if (sigint) {
+        putchar('\n');
+        infomsg("Received SIGINT\n");
+    }
     infomsg("Server stopped, clean up resources and exit\n");
 
     close(sockfd);
     infomsg("Socket closed\n");
 
+    if (hofd >= 0) {
+        close(hofd);
+    }
+    // after a hot restart the paths belong to the new process
+    if (adminfd >= 0) {
+        close(adminfd);
+        if (!handed_off) {
+            unlink(admin_path);
+        }
+    }
+    if (!handed_off) {
+        local_close();
+    }
+
+    archive_close();
+    capture_close();
+    spectator_close();
+    stats_dump(log_file);
+    match_dump(log_file);
+    match_clear();
+    dispatch_dump(log_file);
+    filter_dump(log_file);
+    busy_dump(log_file);
+    heavy_dump(log_file);
+    mem_dump(log_file);
+    trace_report(stdout);
+    trace_report(log_file);
+    tstamp_dump(stdout);
+    tstamp_dump(log_file);
+
     if (log_file) {
         fflush(log_file);
         fclose(log_file);
+        log_file = NULL;
+        mem_free(MEM_LOGGING, log_buf);
         infomsg("Log file writes out, closing the stream\n");
         infomsg("Open server.log for infomation\n");
     }
@@ -327,7 +403,11 @@ error:
     if (log_file != NULL) {
         fflush(log_file);
         fclose(log_file);
+        log_file = NULL;
+        mem_free(MEM_LOGGING, log_buf);
     }
+    archive_close();
+    capture_close();
     errmsg("Encountered internal error!\n");
     errmsg("Clean up resources and shutdown\n");
     close(sockfd);
@@ -336,9 +416,11 @@ error:
     return 1;
 }
 
+/**
+ * Only async-signal-safe work here: stdio and malloc in infomsg() could
+ * interrupt themselves. The loop reports the signal once it stops
+ */
 void exit_handler(int s)
 {
-    putchar('\n');
-    infomsg("Received SIGINT %d\n", s);
-    sigint = true;
+    sigint = 1;
 }
@@ -0,0 +1,807 @@
+/**
+ * File: sim.c
+ * Deterministic simulation of the server request handling
+ *
+ * Drives the real request handler of handler.c through an in-memory network
+ * and a virtual clock, installed behind struct net_ops. Simulated clients
+ * play random games over v4 or batched v5, retransmitting on timeout. Every
+ * datagram can be lost, duplicated or reordered. All randomness derives
+ * from one seed, so a run is reproducible bit for bit; the checksum over
+ * every server reply makes regressions visible. Only the handler consumes
+ * real time, which is measured around every call.
+ *
+ * The binary is linked with malloc, calloc and realloc wrapped, so every
+ * heap allocation the handler makes is counted too. A MOVE on a live game
+ * must not allocate; -z makes the run fail if one does.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "network.h"
+#include "handler.h"
+#include "cookie.h"
+#include "engine.h"
+#include "stats.h"
+#include "game.h"
+#include "list.h"
+#include "mem.h"
+#include "rng.h"
+
+FILE *log_file = NULL;
+
+#define SERVER_FD  3          // socket the handler is given, never a real one
+#define EPOCH_MS   1500000000000ULL // virtual wall clock at start
+#define RETRIES    2          // retransmissions before a game is abandoned
+#define MAX_GAMES  MAX_BATCH  // v5 games per client
+#define MAX_BACKOFF 5         // busy replies double the wait up to 2^5 times
+
+#define SUB_BITS 4
+#define NBUCKETS (64 << SUB_BITS)
+
+struct packet
+{
+    int len;
+    struct sockaddr_in from, to;
+    char data[MAX_PACKET];
+};
+
+// Delivery of packet @pkt to client @dst, or to the server if @dst is -1
+// A client timer when @pkt is -1
+struct event
+{
+    uint64_t t;   // virtual time, us
+    uint64_t seq; // insertion order, breaks ties deterministically
+    int32_t dst;
+    int32_t pkt;
+    uint32_t gen; // client request generation, for timers
+};
+
+struct game
+{
+    uint32_t id;
+    uint16_t turn;
+    uint8_t cmd;
+    uint8_t move;
+    uint8_t flags;
+    char board[NROWS * NCOLS]; // 0 free, 1 server, 2 client
+    char cookie[NROWS * NCOLS];
+    uint64_t start;            // virtual start time, us
+};
+
+struct client
+{
+    struct sockaddr_in addr;
+    bool waiting;
+    bool backoff;   // busy server, the next request waits for the timer
+    uint32_t gen;   // bumped on every new request
+    int retries;
+    int busy;       // busy replies in a row
+    int len;        // request in flight, kept for retransmission
+    char req[MAX_PACKET];
+    struct game games[MAX_GAMES];
+};
+
+static struct
+{
+    int clients;
+    int games;        // v5 games per client, 0 for v4
+    bool stateless;
+    uint64_t requests;
+    uint32_t delay_us, jitter_us, timeout_us;
+    uint32_t loss, dup, reorder; // per million
+} cfg = { 64, 0, false, 1000000, 50, 0, 200000, 0, 0, 0 };
+
+static struct
+{
+    uint64_t sent, lost, duplicated, reordered;
+    uint64_t handled, games, abandoned, busy, timeouts, errors, retransmits;
+    uint64_t handler_ns;
+    uint64_t moves, move_allocs;   // MOVE-only requests and their allocations
+    uint64_t other_allocs;         // allocations of every other request
+    uint64_t handler_hist[NBUCKETS];
+    uint64_t game_hist[NBUCKETS]; // game completion time, us
+    uint64_t checksum;
+} st = { .checksum = 0xcbf29ce484222325ULL };
+
+static uint64_t now_us;
+static struct rng net_rng, client_rng;
+static struct client *clients;
+
+static struct event *heap;
+static size_t nevents, heap_cap;
+static uint64_t next_seq;
+
+static struct packet *pool;
+static int *free_pkts;
+static int npool, nfree;
+
+static int server_inbox = -1; // packet handed to the next recv call
+
+static uint64_t heap_allocs; // calls to the wrapped allocators
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    heap_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    heap_allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heap_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Histogram bucket of @v: exact below 2^SUB_BITS, then 2^SUB_BITS linear
+ * sub-buckets per power of two
+ */
+static inline int bucket_of(uint64_t v)
+{
+    if (v < (1 << SUB_BITS))
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int sub = (int)(v >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return ((e - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+static uint64_t bucket_floor(int b)
+{
+    if (b < (1 << SUB_BITS))
+        return b;
+    int e = (b >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = b & ((1 << SUB_BITS) - 1);
+    return (1ULL << e) | (sub << (e - SUB_BITS));
+}
+
+static void checksum(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    for (size_t i = 0; i < len; ++i) {
+        st.checksum ^= p[i];
+        st.checksum *= 0x100000001b3ULL;
+    }
+}
+
+/* event queue, a binary min-heap on (t, seq) */
+
+static inline bool before(const struct event *a, const struct event *b)
+{
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void push_event(uint64_t t, int dst, int pkt, uint32_t gen)
+{
+    if (nevents == heap_cap) {
+        heap_cap = heap_cap ? 2 * heap_cap : 1024;
+        heap = realloc(heap, heap_cap * sizeof(*heap));
+    }
+
+    struct event ev = { t, next_seq++, dst, pkt, gen };
+    size_t i = nevents++;
+    while (i > 0 && before(&ev, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = ev;
+}
+
+static struct event pop_event()
+{
+    struct event top = heap[0];
+    struct event last = heap[--nevents];
+    size_t i = 0;
+
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= nevents)
+            break;
+        if (c + 1 < nevents && before(&heap[c + 1], &heap[c]))
+            c++;
+        if (!before(&heap[c], &last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* packet pool */
+
+static int alloc_packet()
+{
+    if (nfree == 0) {
+        int grow = npool ? npool : 256;
+        pool = realloc(pool, (npool + grow) * sizeof(*pool));
+        free_pkts = realloc(free_pkts, (npool + grow) * sizeof(*free_pkts));
+        for (int i = 0; i < grow; ++i)
+            free_pkts[nfree++] = npool + i;
+        npool += grow;
+    }
+    return free_pkts[--nfree];
+}
+
+static void free_packet(int pkt)
+{
+    free_pkts[nfree++] = pkt;
+}
+
+/**
+ * Put datagram @buf from @from to @to on the wire, @dst is the receiving
+ * client or -1 for the server. Subject to the configured impairments
+ */
+static void transmit(int dst, struct sockaddr_in from, struct sockaddr_in to,
+                     const void *buf, size_t len)
+{
+    st.sent++;
+    if (rng_below(&net_rng, 1000000) < cfg.loss) {
+        st.lost++;
+        return;
+    }
+
+    int copies = 1;
+    if (rng_below(&net_rng, 1000000) < cfg.dup) {
+        st.duplicated++;
+        copies = 2;
+    }
+
+    for (int i = 0; i < copies; ++i) {
+        uint64_t delay = cfg.delay_us;
+        if (cfg.jitter_us)
+            delay += rng_below(&net_rng, cfg.jitter_us + 1);
+        if (rng_below(&net_rng, 1000000) < cfg.reorder) {
+            // held back long enough to land behind later datagrams
+            st.reordered++;
+            delay += 4 * (cfg.delay_us + cfg.jitter_us) + 1;
+        }
+
+        int pkt = alloc_packet();
+        pool[pkt].len = len;
+        pool[pkt].from = from;
+        pool[pkt].to = to;
+        memcpy(pool[pkt].data, buf, len);
+        push_event(now_us + delay, dst, pkt, 0);
+    }
+}
+
+/* net_ops of the simulation */
+
+static ssize_t sim_recv(int sockfd, void *buf, size_t len,
+                        struct sockaddr_in *addr, socklen_t *addr_len)
+{
+    if (server_inbox < 0) {
+        return -1;
+    }
+
+    struct packet *p = &pool[server_inbox];
+    size_t n = (size_t)p->len < len ? (size_t)p->len : len;
+    memcpy(buf, p->data, n);
+    *addr = p->from;
+    *addr_len = sizeof(*addr);
+
+    free_packet(server_inbox);
+    server_inbox = -1;
+    return n;
+}
+
+static ssize_t sim_send(int sockfd, const void *buf, size_t len,
+                        struct sockaddr_in addr)
+{
+    uint32_t ip = ntohl(addr.sin_addr.s_addr);
+    int dst = (int)(ip & 0xffffff) - 1;
+    if (dst < 0 || dst >= cfg.clients) {
+        return len;
+    }
+
+    checksum(&now_us, sizeof(now_us));
+    checksum(buf, len);
+
+    struct sockaddr_in server = { 0 };
+    transmit(dst, server, addr, buf, len);
+    return len;
+}
+
+static uint64_t sim_now_ms()
+{
+    return EPOCH_MS + now_us / 1000;
+}
+
+static uint64_t sim_mono_ms()
+{
+    return now_us / 1000;
+}
+
+static const struct net_ops sim_ops = {
+    sim_recv,
+    sim_send,
+    sim_now_ms,
+    sim_mono_ms,
+};
+
+/* clients */
+
+static void send_request(struct client *c)
+{
+    c->gen++;
+    c->waiting = true;
+    struct sockaddr_in server = { 0 };
+    transmit(-1, c->addr, server, c->req, c->len);
+    push_event(now_us + cfg.timeout_us, (int)(c - clients), -1, c->gen);
+}
+
+static void reset_game(struct game *g)
+{
+    memset(g, 0, sizeof(*g));
+    g->cmd = NGAME;
+    g->flags = cfg.stateless ? MSG_COOKIE : 0;
+    g->start = now_us;
+}
+
+/**
+ * Pick a random free cell of @board, -1 if it is full
+ */
+static int random_cell(const char *board)
+{
+    int free_cells[NROWS * NCOLS], nfree = 0;
+    for (int i = 0; i < NROWS * NCOLS; ++i) {
+        if (board[i] == 0)
+            free_cells[nfree++] = i;
+    }
+    return nfree ? free_cells[rng_below(&client_rng, nfree)] : -1;
+}
+
+/**
+ * Build and send the next request of client @c from the state of its games
+ */
+static void next_request(struct client *c)
+{
+    c->retries = 0;
+
+    if (cfg.games == 0) {
+        struct game *g = &c->games[0];
+        struct message msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.version = VERSION;
+        msg.cmd = g->cmd;
+        msg.move = g->move;
+        msg.turn = g->turn;
+        msg.game = g->id;
+        memcpy(c->req, &msg, sizeof(msg));
+        c->len = sizeof(msg);
+    } else {
+        struct header_v5 hdr = { VERSION_V5, cfg.games };
+        memcpy(c->req, &hdr, sizeof(hdr));
+        for (int i = 0; i < cfg.games; ++i) {
+            struct game *g = &c->games[i];
+            struct message_v5 msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.cmd = g->cmd;
+            msg.move = g->move;
+            msg.flags = g->flags;
+            msg.turn = htons(g->turn);
+            msg.game = htonl(g->id);
+            if (g->cmd == MOVE && (g->flags & MSG_COOKIE))
+                memcpy(msg.board, g->cookie, sizeof(msg.board));
+            memcpy(c->req + sizeof(hdr) + i * sizeof(msg), &msg, sizeof(msg));
+        }
+        c->len = sizeof(hdr) + cfg.games * sizeof(struct message_v5);
+    }
+
+    send_request(c);
+}
+
+/**
+ * Start over from a fresh port, the v4 server keys games by address
+ */
+static void restart_client(struct client *c)
+{
+    c->addr.sin_port = htons(ntohs(c->addr.sin_port) + 1);
+    for (int i = 0; i < MAX_GAMES; ++i)
+        reset_game(&c->games[i]);
+    next_request(c);
+}
+
+/**
+ * Apply reply @resp to game @g, return false if the game was abandoned
+ */
+static bool apply_reply(struct game *g, int resp, int move, int turn,
+                        uint32_t id, int flags, const char *cookie)
+{
+    if (move >= 1 && move <= NROWS * NCOLS) {
+        g->board[move - 1] = 1;
+    }
+
+    if (resp == GAMEOVR || resp == GAMOVRACK) {
+        st.games++;
+        st.game_hist[bucket_of(now_us - g->start)]++;
+        reset_game(g);
+        return true;
+    } else if (resp == EBUSYGAME) {
+        // no session was started, ask again later
+        st.busy++;
+        reset_game(g);
+        return true;
+    } else if (resp != SUCC) {
+        st.errors++;
+        st.abandoned++;
+        reset_game(g);
+        return false;
+    }
+
+    int cell = random_cell(g->board);
+    if (cell < 0) {
+        reset_game(g);
+        return true;
+    }
+
+    g->id = id;
+    g->turn = turn + 1;
+    g->flags = flags & MSG_COOKIE;
+    if (cookie)
+        memcpy(g->cookie, cookie, sizeof(g->cookie));
+    g->board[cell] = 2;
+    g->cmd = MOVE;
+    g->move = cell + 1;
+    return true;
+}
+
+/**
+ * Wait before the next request of client @c, which was only answered busy,
+ * twice as long for every busy reply in a row
+ */
+static void back_off(struct client *c)
+{
+    int shift = c->busy < MAX_BACKOFF ? c->busy : MAX_BACKOFF;
+    c->busy++;
+    c->gen++;
+    c->backoff = true;
+    uint64_t wait = (uint64_t)cfg.timeout_us << shift;
+    // spread out so the clients turned away together do not return together
+    push_event(now_us + wait + rng_below(&client_rng, cfg.timeout_us),
+               (int)(c - clients), -1, c->gen);
+}
+
+/**
+ * Whether a reply with @turn answers the request of game @g, stale
+ * duplicates carry an older turn
+ */
+static bool expected(const struct game *g, int turn)
+{
+    return g->cmd == NGAME || turn >= g->turn;
+}
+
+static void client_receive(struct client *c, struct packet *p)
+{
+    if (!c->waiting) {
+        return;
+    }
+
+    if (cfg.games == 0) {
+        struct message msg;
+        memset(&msg, 0, sizeof(msg));
+        memcpy(&msg, p->data, p->len < (int)sizeof(msg) ? p->len : (int)sizeof(msg));
+        if (!expected(&c->games[0], msg.turn)) {
+            return;
+        }
+
+        c->waiting = false;
+        if (!apply_reply(&c->games[0], msg.resp, msg.move, msg.turn,
+                         msg.game, 0, NULL)) {
+            restart_client(c);
+            return;
+        }
+        if (msg.resp == EBUSYGAME) {
+            back_off(c);
+            return;
+        }
+        c->busy = 0;
+        next_request(c);
+        return;
+    }
+
+    struct header_v5 hdr;
+    memcpy(&hdr, p->data, sizeof(hdr));
+    if (hdr.count != cfg.games) {
+        return;
+    }
+
+    struct message_v5 msgs[MAX_GAMES];
+    memcpy(msgs, p->data + sizeof(hdr), cfg.games * sizeof(msgs[0]));
+    for (int i = 0; i < cfg.games; ++i) {
+        if (!expected(&c->games[i], ntohs(msgs[i].turn)))
+            return;
+    }
+
+    c->waiting = false;
+    int busy = 0;
+    for (int i = 0; i < cfg.games; ++i) {
+        apply_reply(&c->games[i], msgs[i].resp, msgs[i].move,
+                    ntohs(msgs[i].turn), ntohl(msgs[i].game), msgs[i].flags,
+                    msgs[i].board);
+        busy += msgs[i].resp == EBUSYGAME;
+    }
+    if (busy == cfg.games) {
+        back_off(c);
+        return;
+    }
+    c->busy = 0;
+    next_request(c);
+}
+
+static void client_timeout(struct client *c, uint32_t gen)
+{
+    if (c->backoff && gen == c->gen) {
+        c->backoff = false;
+        next_request(c);
+        return;
+    }
+    if (!c->waiting || gen != c->gen) {
+        return;
+    }
+
+    st.timeouts++;
+    if (c->retries < RETRIES) {
+        int retries = c->retries + 1;
+        st.retransmits++;
+        send_request(c);
+        c->retries = retries;
+        return;
+    }
+
+    // the game stalled, give up on every game of the client
+    st.abandoned += cfg.games ? cfg.games : 1;
+    restart_client(c);
+}
+
+static void print_hist(const char *name, const uint64_t *hist, double scale,
+                       const char *unit)
+{
+    const double ps[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t at[4] = { 0 }, max = 0, seen = 0, total = 0;
+    int next = 0;
+
+    for (int b = 0; b < NBUCKETS; ++b)
+        total += hist[b];
+    for (int b = 0; b < NBUCKETS; ++b) {
+        if (hist[b] == 0)
+            continue;
+        seen += hist[b];
+        max = bucket_floor(b);
+        while (next < 4 && seen > ps[next] * total)
+            at[next++] = bucket_floor(b);
+    }
+    printf("%-13s p50 %.0f  p90 %.0f  p99 %.0f  p999 %.0f  max %.0f %s\n",
+           name, at[0] * scale, at[1] * scale, at[2] * scale, at[3] * scale,
+           max * scale, unit);
+}
+
+/**
+ * Parse a percentage into parts per million
+ */
+static uint32_t ppm(const char *arg)
+{
+    return (uint32_t)(atof(arg) * 10000);
+}
+
+/**
+ * Return whether datagram @p only carries moves, v4 or v5
+ */
+static bool only_moves(const struct packet *p)
+{
+    if (p->len >= (int)MIN_MESSAGE && p->data[0] == VERSION) {
+        return p->data[1] == MOVE;
+    }
+    if (p->len < (int)sizeof(struct header_v5) || p->data[0] != VERSION_V5) {
+        return false;
+    }
+    int count = (p->len - sizeof(struct header_v5)) / sizeof(struct message_v5);
+    for (int i = 0; i < count; ++i) {
+        const char *msg = p->data + sizeof(struct header_v5)
+            + i * sizeof(struct message_v5);
+        if (msg[offsetof(struct message_v5, cmd)] != MOVE)
+            return false;
+    }
+    return count > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t seed = 1;
+    bool dump = false;
+    bool zero_alloc = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:g:Cn:s:d:e:j:t:l:u:r:vz")) != -1) {
+        switch (opt) {
+        case 'c':
+            cfg.clients = atoi(optarg);
+            break;
+        case 'g':
+            cfg.games = atoi(optarg);
+            break;
+        case 'C':
+            cfg.stateless = true;
+            break;
+        case 'n':
+            cfg.requests = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            cfg.delay_us = atoi(optarg);
+            break;
+        case 'e':
+            session_timeout = atoi(optarg);
+            break;
+        case 'j':
+            cfg.jitter_us = atoi(optarg);
+            break;
+        case 't':
+            cfg.timeout_us = atoi(optarg) * 1000;
+            break;
+        case 'l':
+            cfg.loss = ppm(optarg);
+            break;
+        case 'u':
+            cfg.dup = ppm(optarg);
+            break;
+        case 'r':
+            cfg.reorder = ppm(optarg);
+            break;
+        case 'v':
+            dump = true;
+            break;
+        case 'z':
+            zero_alloc = true;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind != argc || cfg.clients < 1 || cfg.clients > 0xffffff
+        || cfg.games < 0 || cfg.games > MAX_GAMES
+        || (cfg.stateless && !cfg.games) || cfg.timeout_us == 0
+        || session_timeout < 1) {
+    usage:
+        errmsg("Usage: %s [-c clients] [-g games [-C]] [-n requests] [-s seed]\n"
+               "       [-d delay-us] [-j jitter-us] [-t timeout-ms] [-e session-s]\n"
+               "       [-l loss%%] [-u dup%%] [-r reorder%%] [-v] [-z]\n", argv[0]);
+        exit(1);
+    }
+
+    // everything random derives from the seed
+    log_level = LOG_QUIET;
+    rng_seed(&net_rng, seed);
+    rng_seed(&client_rng, seed ^ 0x5eed5eed5eed5eedULL);
+    seed_moves(seed);
+    uint64_t key[2] = { seed, ~seed };
+    cookie_init(key, MAX_V5_ID);
+    cookie_mode = true;
+    net_ops = &sim_ops;
+
+    LIST_HEAD(sessions);
+
+    clients = calloc(cfg.clients, sizeof(*clients));
+    for (int i = 0; i < cfg.clients; ++i) {
+        struct client *c = &clients[i];
+        c->addr.sin_family = AF_INET;
+        c->addr.sin_addr.s_addr = htonl(0x0a000000 + i + 1);
+        c->addr.sin_port = htons(1024 + rng_below(&client_rng, 32768));
+        for (int k = 0; k < MAX_GAMES; ++k)
+            reset_game(&c->games[k]);
+    }
+
+    // clients join spread over the first millisecond
+    for (int i = 0; i < cfg.clients; ++i) {
+        now_us = rng_below(&client_rng, 1000);
+        next_request(&clients[i]);
+    }
+    now_us = 0;
+
+    uint64_t last_sweep = 0;
+    uint64_t start = now_ns();
+
+    while (st.handled < cfg.requests && nevents > 0) {
+        struct event ev = pop_event();
+        now_us = ev.t;
+
+        if (now_us - last_sweep >= 1000000) {
+            expire_sessions(SERVER_FD, &sessions);
+            last_sweep = now_us;
+        }
+
+        if (ev.dst < 0) {
+            server_inbox = ev.pkt;
+            bool moves = only_moves(&pool[ev.pkt]);
+            uint64_t allocs = heap_allocs;
+            uint64_t t0 = now_ns();
+            serve_packet(SERVER_FD, &sessions);
+            uint64_t ns = now_ns() - t0;
+            if (moves) {
+                st.moves++;
+                st.move_allocs += heap_allocs - allocs;
+            } else {
+                st.other_allocs += heap_allocs - allocs;
+            }
+            st.handler_ns += ns;
+            st.handler_hist[bucket_of(ns)]++;
+            st.handled++;
+        } else if (ev.pkt < 0) {
+            client_timeout(&clients[ev.dst], ev.gen);
+        } else {
+            struct client *c = &clients[ev.dst];
+            struct packet *p = &pool[ev.pkt];
+            // replies to an abandoned port go nowhere
+            if (p->len >= 2 && p->to.sin_port == c->addr.sin_port)
+                client_receive(c, p);
+            free_packet(ev.pkt);
+        }
+    }
+
+    double secs = (now_ns() - start) / 1e9;
+
+    printf("simulated     %.3f s virtual, %llu requests in %.3f s (%.0f/s)\n",
+           now_us / 1e6, (unsigned long long)st.handled, secs,
+           st.handled / secs);
+    printf("network       %llu sent, %llu lost, %llu duplicated, %llu reordered\n",
+           (unsigned long long)st.sent, (unsigned long long)st.lost,
+           (unsigned long long)st.duplicated, (unsigned long long)st.reordered);
+    printf("games         %llu completed, %llu abandoned, %llu busy replies\n",
+           (unsigned long long)st.games, (unsigned long long)st.abandoned,
+           (unsigned long long)st.busy);
+    printf("clients       %llu timeouts, %llu retransmits, %llu error replies\n",
+           (unsigned long long)st.timeouts, (unsigned long long)st.retransmits,
+           (unsigned long long)st.errors);
+    printf("handler ns    mean %.0f\n",
+           st.handled ? (double)st.handler_ns / st.handled : 0.0);
+    print_hist("handler ns", st.handler_hist, 1, "");
+    printf("allocations   %llu in %llu MOVE requests, %llu in %llu others\n",
+           (unsigned long long)st.move_allocs, (unsigned long long)st.moves,
+           (unsigned long long)st.other_allocs,
+           (unsigned long long)(st.handled - st.moves));
+    print_hist("game ms", st.game_hist, 1e-3, "(virtual)");
+    printf("checksum      %016llx, seed %llu\n",
+           (unsigned long long)st.checksum, (unsigned long long)seed);
+    if (dump) {
+        stats_dump(stdout);
+        mem_dump(stdout);
+    }
+
+    free(clients);
+    free(heap);
+    free(pool);
+    free(free_pkts);
+
+    if (zero_alloc && st.move_allocs > 0) {
+        // errmsg() is quiet during the run
+        fprintf(stderr, "MOVE requests allocated %llu times\n",
+                (unsigned long long)st.move_allocs);
+        return 1;
+    }
+    return 0;
+}
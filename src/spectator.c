@@ -0,0 +1,100 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "spectator.h"
+#include "game.h"
+
+#define MAX_RECORDS ((SPECTATOR_MTU - sizeof(struct spectator_header)) \
+                     / sizeof(struct spectator_record))
+
+static int feed_fd = -1;
+static struct sockaddr_in feed_addr;
+static uint16_t feed_seq = 0;
+
+static struct
+{
+    struct spectator_header hdr;
+    struct spectator_record rec[MAX_RECORDS];
+} __attribute__((packed)) feed_buf;
+
+int spectator_open(const char *spec)
+{
+    if (mc_group_addr(spec, SPECTATOR_PORT, &feed_addr) < 0) {
+        errmsg("Invalid spectator multicast group: %s\n", spec);
+        return -1;
+    }
+
+    feed_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (feed_fd < 0) {
+        errmsg("Unable to create spectator socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    unsigned char ttl = 1, loop = 1;
+    if (setsockopt(feed_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0
+        || setsockopt(feed_fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+                      &loop, sizeof(loop)) < 0) {
+        errmsg("Unable to setup spectator socket: %s\n", strerror(errno));
+        close(feed_fd);
+        feed_fd = -1;
+        return -1;
+    }
+
+    infomsg("Publishing spectator feed to %s:%u\n",
+            inet_ntoa(feed_addr.sin_addr), ntohs(feed_addr.sin_port));
+    return 0;
+}
+
+void spectator_publish(const struct session *s, int player, int move,
+                       int winner)
+{
+    if (feed_fd < 0) {
+        return;
+    }
+
+    if (feed_buf.hdr.count == MAX_RECORDS) {
+        spectator_flush();
+    }
+
+    struct spectator_record *rec = &feed_buf.rec[feed_buf.hdr.count++];
+    rec->game = htonl(s->game_id);
+    rec->turn = htons(s->turn);
+    rec->move = (player << 4) | (move & 0xf);
+    rec->outcome = winner;
+}
+
+void spectator_flush()
+{
+    if (feed_fd < 0 || feed_buf.hdr.count == 0) {
+        return;
+    }
+
+    feed_buf.hdr.version = SPECTATOR_VERSION;
+    feed_buf.hdr.seq = htons(feed_seq++);
+
+    size_t len = sizeof(feed_buf.hdr)
+        + feed_buf.hdr.count * sizeof(struct spectator_record);
+    if (sendto(feed_fd, &feed_buf, len, 0,
+               (struct sockaddr *)&feed_addr, sizeof(feed_addr)) < 0) {
+        errmsg("Unable to publish spectator feed: %s\n", strerror(errno));
+    }
+
+    feed_buf.hdr.count = 0;
+}
+
+void spectator_close()
+{
+    if (feed_fd < 0) {
+        return;
+    }
+
+    spectator_flush();
+    close(feed_fd);
+    feed_fd = -1;
+}
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+#include "stats.h"
+
+struct stats stats;
+
+#define DUMP(f, field) \
+    fprintf(f, "%-16s %llu\n", #field, (unsigned long long)stats.field)
+
+void stats_dump(FILE *f)
+{
+    DUMP(f, rx_packets);
+    DUMP(f, tx_packets);
+    DUMP(f, rx_errors);
+    DUMP(f, tx_errors);
+    DUMP(f, games_new);
+    DUMP(f, games_resumed);
+    DUMP(f, games_stateless);
+    DUMP(f, server_wins);
+    DUMP(f, client_wins);
+    DUMP(f, ties);
+    DUMP(f, expired);
+    DUMP(f, aborted);
+    DUMP(f, busy);
+    DUMP(f, invalid_moves);
+    DUMP(f, wrong_game);
+    DUMP(f, out_of_sync);
+    DUMP(f, bad_cookies);
+    DUMP(f, probes);
+    DUMP(f, rejected);
+    DUMP(f, throttled);
+}
@@ -0,0 +1,408 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "table.h"
+#include "game.h"
+#include "mem.h"
+
+#define MAX_CELLS (TABLE_MAX_N * TABLE_MAX_N)
+#define MAX_LINES (2 * TABLE_MAX_N + 2)
+#define NSYMS     8
+
+static const char table_magic[4] = { 'T', 'T', 'T', 'C' };
+
+struct table_header
+{
+    char magic[4];
+    uint32_t n;    // board side
+    uint64_t npos; // positions that follow, 2 bits each
+};
+
+// Board geometry of one size, built once before any lookup
+struct geom
+{
+    int n, ncells;
+    int nlines;
+    uint8_t lines[MAX_LINES][TABLE_MAX_N];
+    int ncell_lines[MAX_CELLS];        // lines through each square
+    uint8_t cell_lines[MAX_CELLS][4];
+    uint8_t sym[NSYMS][MAX_CELLS];     // source square of every square
+    uint16_t sym_byte[NSYMS][MAX_CELLS / 8][256]; // squares a byte moves to
+    uint16_t xrank[1 << MAX_CELLS];    // rank of a canonical set of X squares
+    uint64_t offset[MAX_CELLS + 2];    // rank of the first board of m marks
+};
+
+static struct geom geoms[TABLE_MAX_N + 1];
+static uint64_t binom[MAX_CELLS + 1][MAX_CELLS + 1];
+
+/**
+ * Squares of @mask moved by symmetry @t
+ */
+static inline uint32_t sym_mask(const struct geom *g, int t, uint32_t mask)
+{
+    return g->sym_byte[t][0][mask & 0xff] | g->sym_byte[t][1][mask >> 8];
+}
+
+static void init_geom(int n)
+{
+    struct geom *g = &geoms[n];
+    if (g->n == n) {
+        return;
+    }
+
+    for (int i = 0; i <= MAX_CELLS; ++i) {
+        binom[i][0] = 1;
+        for (int k = 1; k <= i; ++k)
+            binom[i][k] = binom[i - 1][k - 1] + (k < i ? binom[i - 1][k] : 0);
+    }
+
+    memset(g, 0, sizeof(*g));
+    g->ncells = n * n;
+
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            g->lines[r][c] = r * n + c;         // rows
+            g->lines[n + r][c] = c * n + r;     // columns
+        }
+        g->lines[2 * n][r] = r * n + r;         // diagonals
+        g->lines[2 * n + 1][r] = r * n + n - 1 - r;
+    }
+    g->nlines = 2 * n + 2;
+    for (int l = 0; l < g->nlines; ++l) {
+        for (int k = 0; k < n; ++k) {
+            int i = g->lines[l][k];
+            g->cell_lines[i][g->ncell_lines[i]++] = l;
+        }
+    }
+
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            int i = r * n + c, m = n - 1;
+            g->sym[0][i] = r * n + c;
+            g->sym[1][i] = c * n + m - r;           // rotations
+            g->sym[2][i] = (m - r) * n + m - c;
+            g->sym[3][i] = (m - c) * n + r;
+            g->sym[4][i] = r * n + m - c;           // reflections
+            g->sym[5][i] = (m - r) * n + c;
+            g->sym[6][i] = c * n + r;
+            g->sym[7][i] = (m - c) * n + m - r;
+        }
+    }
+
+    for (int t = 0; t < NSYMS; ++t) {
+        for (int i = 0; i < g->ncells; ++i) {
+            int src = g->sym[t][i];
+            for (int v = 0; v < 256; ++v) {
+                if ((v >> (src % 8)) & 1)
+                    g->sym_byte[t][src / 8][v] |= 1 << i;
+            }
+        }
+    }
+
+    // a set of X squares is canonical if no symmetry maps it to a smaller
+    // mask, those of each size are ranked in mask order
+    int ncells = g->ncells;
+    uint32_t nxsets[MAX_CELLS + 1] = { 0 };
+    for (uint32_t mask = 0; mask < (1u << ncells); ++mask) {
+        bool canonical = true;
+        for (int t = 1; t < NSYMS && canonical; ++t)
+            canonical = sym_mask(g, t, mask) >= mask;
+        if (canonical) {
+            int nx = __builtin_popcount(mask);
+            g->xrank[mask] = nxsets[nx]++;
+        }
+    }
+
+    for (int m = 0; m <= ncells; ++m) {
+        int nx = (m + 1) / 2, no = m / 2;
+        g->offset[m + 1] = g->offset[m]
+            + nxsets[nx] * binom[ncells - nx][no];
+    }
+
+    g->n = n;
+}
+
+/**
+ * Whether the player of square @last completed a line through it
+ */
+static bool won(const struct geom *g, const uint8_t *cells, int last)
+{
+    for (int k = 0; k < g->ncell_lines[last]; ++k) {
+        const uint8_t *line = g->lines[g->cell_lines[last][k]];
+        int i = 0;
+        while (i < g->n && cells[line[i]] == cells[last])
+            i++;
+        if (i == g->n)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Rank of the canonical form of @cells, UINT64_MAX if the mark counts are
+ * not those of a game in progress
+ */
+static uint64_t index_of(const struct geom *g, const uint8_t *cells)
+{
+    int ncells = g->ncells;
+
+    uint32_t xs = 0, os = 0;
+    for (int i = 0; i < ncells; ++i) {
+        xs |= (uint32_t)(cells[i] == 1) << i;
+        os |= (uint32_t)(cells[i] == 2) << i;
+    }
+    int nx = __builtin_popcount(xs), no = __builtin_popcount(os);
+    if (nx != no && nx != no + 1) {
+        return UINT64_MAX;
+    }
+
+    // canonical form: the symmetric board with the smallest mask of X
+    // squares, then of O squares
+    uint32_t best_x = xs, best_o = os;
+    for (int t = 1; t < NSYMS; ++t) {
+        uint32_t x = sym_mask(g, t, xs), o = sym_mask(g, t, os);
+        if (x < best_x || (x == best_x && o < best_o)) {
+            best_x = x;
+            best_o = o;
+        }
+    }
+
+    // O squares are ranked among the squares X left free
+    uint64_t ro = 0;
+    int k = 0;
+    for (uint32_t o = best_o; o; o &= o - 1) {
+        int i = __builtin_ctz(o);
+        int rest = i - __builtin_popcount(best_x & ((1u << i) - 1));
+        ro += binom[rest][++k];
+    }
+
+    return g->offset[nx + no] + g->xrank[best_x] * binom[ncells - nx][no] + ro;
+}
+
+static inline enum Value get_value(const uint8_t *values, uint64_t idx)
+{
+    return (values[idx >> 2] >> ((idx & 3) * 2)) & 3;
+}
+
+static inline void set_value(uint8_t *values, uint64_t idx, enum Value v)
+{
+    values[idx >> 2] |= v << ((idx & 3) * 2);
+}
+
+struct solver
+{
+    const struct geom *g;
+    uint8_t *values;
+    int64_t solved;
+};
+
+/**
+ * Negamax over every position reachable from @cells, @marks placed and the
+ * last one on @last, memoized in the table itself
+ */
+static enum Value solve(struct solver *s, uint8_t *cells, int marks, int last)
+{
+    const struct geom *g = s->g;
+    uint64_t idx = index_of(g, cells);
+    enum Value v = get_value(s->values, idx);
+    if (v != VAL_NONE) {
+        return v;
+    }
+
+    if (last >= 0 && won(g, cells, last)) {
+        v = VAL_LOSS;
+    } else if (marks == g->ncells) {
+        v = VAL_DRAW;
+    } else {
+        // every reply is solved, the opponent may pick any of them
+        int player = (marks % 2) ? 2 : 1;
+        v = VAL_LOSS;
+        for (int i = 0; i < g->ncells; ++i) {
+            if (cells[i])
+                continue;
+            cells[i] = player;
+            enum Value reply = solve(s, cells, marks + 1, i);
+            cells[i] = 0;
+
+            if (reply == VAL_LOSS)
+                v = VAL_WIN;
+            else if (reply == VAL_DRAW && v == VAL_LOSS)
+                v = VAL_DRAW;
+        }
+    }
+
+    set_value(s->values, idx, v);
+    s->solved++;
+    return v;
+}
+
+int64_t table_solve(struct table *t, int n)
+{
+    if (n < 1 || n > TABLE_MAX_N) {
+        errmsg("Board size must be 1 to %d\n", TABLE_MAX_N);
+        return -1;
+    }
+    init_geom(n);
+
+    const struct geom *g = &geoms[n];
+    uint64_t npos = g->offset[g->ncells + 1];
+    uint8_t *values = mem_calloc(MEM_ENGINE, (npos + 3) / 4, 1);
+    if (!values) {
+        errmsg("Unable to allocate %llu positions\n", (unsigned long long)npos);
+        return -1;
+    }
+
+    struct solver s = { g, values, 0 };
+    uint8_t cells[MAX_CELLS] = { 0 };
+    solve(&s, cells, 0, -1);
+
+    memset(t, 0, sizeof(*t));
+    t->n = n;
+    t->npos = npos;
+    t->values = values;
+    return s.solved;
+}
+
+int table_write(const struct table *t, const char *path)
+{
+    struct table_header hdr;
+    memcpy(hdr.magic, table_magic, sizeof(hdr.magic));
+    hdr.n = t->n;
+    hdr.npos = t->npos;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        errmsg("Unable to create table %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t len = (t->npos + 3) / 4;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+        || fwrite(t->values, 1, len, f) != len) {
+        errmsg("Unable to write table %s: %s\n", path, strerror(errno));
+        fclose(f);
+        return -1;
+    }
+    return fclose(f);
+}
+
+int table_open(struct table *t, const char *path)
+{
+    memset(t, 0, sizeof(*t));
+
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) < 0) {
+        errmsg("Unable to open table %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    void *map = MAP_FAILED;
+    if ((size_t)sb.st_size >= sizeof(struct table_header)) {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        errmsg("Unable to map table %s\n", path);
+        return -1;
+    }
+
+    // lookups jump around, read-ahead would only inflate the RSS
+    madvise(map, sb.st_size, MADV_RANDOM);
+
+    const struct table_header *hdr = map;
+    if (memcmp(hdr->magic, table_magic, sizeof(hdr->magic)) != 0
+        || hdr->n < 1 || hdr->n > TABLE_MAX_N) {
+        errmsg("%s is not a solved table\n", path);
+        munmap(map, sb.st_size);
+        return -1;
+    }
+
+    init_geom(hdr->n);
+    const struct geom *g = &geoms[hdr->n];
+    if (hdr->npos != g->offset[g->ncells + 1]
+        || (size_t)sb.st_size != sizeof(*hdr) + (hdr->npos + 3) / 4) {
+        errmsg("Table %s is truncated or corrupt\n", path);
+        munmap(map, sb.st_size);
+        return -1;
+    }
+
+    t->n = hdr->n;
+    t->npos = hdr->npos;
+    t->values = (const uint8_t *)map + sizeof(*hdr);
+    t->map = map;
+    t->map_len = sb.st_size;
+    mem_map(MEM_ENGINE, t->map_len);
+    return 0;
+}
+
+void table_close(struct table *t)
+{
+    if (t->map) {
+        munmap(t->map, t->map_len);
+        mem_map(MEM_ENGINE, -(long)t->map_len);
+    } else {
+        mem_free(MEM_ENGINE, (void *)t->values);
+    }
+    memset(t, 0, sizeof(*t));
+}
+
+enum Value table_value(const struct table *t, const uint8_t *cells)
+{
+    uint64_t idx = index_of(&geoms[t->n], cells);
+    return (idx < t->npos) ? get_value(t->values, idx) : VAL_NONE;
+}
+
+int table_move(const struct table *t, const uint8_t *cells, int player,
+               struct rng *r)
+{
+    const struct geom *g = &geoms[t->n];
+
+    int nx = 0, no = 0;
+    for (int i = 0; i < g->ncells; ++i) {
+        nx += (cells[i] == 1);
+        no += (cells[i] == 2);
+    }
+    if (player != ((nx == no) ? 1 : (nx == no + 1) ? 2 : 0)) {
+        return -1;
+    }
+
+    uint8_t b[MAX_CELLS];
+    memcpy(b, cells, g->ncells);
+
+    // 3 wins now, 2 wins later, 1 draws and 0 loses
+    int best = -1, cand[MAX_CELLS], ncand = 0;
+    for (int i = 0; i < g->ncells; ++i) {
+        if (b[i])
+            continue;
+
+        b[i] = player;
+        int score;
+        if (won(g, b, i)) {
+            score = 3;
+        } else {
+            enum Value v = table_value(t, b);
+            score = (v == VAL_LOSS) ? 2 : (v == VAL_WIN) ? 0 : 1;
+        }
+        b[i] = 0;
+
+        if (score > best) {
+            best = score;
+            ncand = 0;
+        }
+        if (score == best)
+            cand[ncand++] = i;
+    }
+    return ncand ? cand[rng_below(r, ncand)] : -1;
+}
@@ -0,0 +1,155 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include "tictactoe.h"
+
+#define NLINES 8
+#define CHUNK  64 // boards evaluated together by ttt_winner_batch()
+
+// squares of every line as bits 0-8, in the order checkwin() marks them
+static const uint16_t lines[NLINES] = {
+    0007, 0070, 0700,  // rows
+    0111, 0222, 0444,  // columns
+    0421, 0124,        // diagonals
+};
+
+// bit m set when the squares of mask m contain a whole line
+static const uint64_t has_line[512 / 64] = {
+    0xff80808080808080ULL, 0xfff0aa80faf0aa80ULL,
+    0xffcc8080cccc8080ULL, 0xfffcaa80fefcaa80ULL,
+    0xfffaf0f0aaaa8080ULL, 0xfffafaf0fafaaa80ULL,
+    0xfffef0f0eeee8080ULL, 0xffffffffffffffffULL,
+};
+
+/**
+ * Masks of the squares taken by X and O. Marks have bit 0x40 set, which no
+ * digit has, and X has bit 0x10 where O does not, in either case; so a
+ * highlighted line still counts for its player. The first eight squares
+ * are tested at once in a word, one bit per byte, then packed into bits
+ * 0-7 by a multiply that moves bit 0 of byte i to bit 56 + i
+ */
+static inline void marks(const char *board, unsigned *x, unsigned *o)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t pack = 0x0102040810204080ULL;
+
+    uint64_t w;
+    memcpy(&w, board, sizeof(w));
+    w = le64toh(w);
+    uint64_t marked = (w >> 6) & ones;
+    uint64_t xbit = (w >> 4) & ones;
+
+    unsigned c = (unsigned char)board[TTT_CELLS - 1];
+    unsigned mark8 = (c >> 6) & 1, x8 = (c >> 4) & 1;
+
+    *x = (unsigned)(((marked & xbit) * pack) >> 56) | (mark8 & x8) << 8;
+    *o = (unsigned)(((marked & ~xbit) * pack) >> 56) | (mark8 & ~x8) << 8;
+}
+
+/**
+ * ttt_winner() of the masks, by table lookup
+ */
+static inline int winner_of(unsigned x, unsigned o)
+{
+    int wx = (has_line[x >> 6] >> (x & 63)) & 1;
+    int wo = (has_line[o >> 6] >> (o & 63)) & 1;
+    int full = (x | o) == 0777;
+    return wx + 2 * (wo & !wx) - (full & !wx & !wo);
+}
+
+/**
+ * winner_of() by testing every line, slower for one board but without the
+ * table loads, so a loop over boards vectorizes
+ */
+static inline int winner_lines(unsigned x, unsigned o)
+{
+    int wx = 0, wo = 0;
+    for (int l = 0; l < NLINES; ++l) {
+        wx |= (x & lines[l]) == lines[l];
+        wo |= (o & lines[l]) == lines[l];
+    }
+    int full = (x | o) == 0777;
+    return wx + 2 * (wo & !wx) - (full & !wx & !wo);
+}
+
+void ttt_init(char board[TTT_CELLS])
+{
+    for (int i = 0; i < TTT_CELLS; ++i) {
+        board[i] = '1' + i;
+    }
+}
+
+bool ttt_play(int player, int move, char board[TTT_CELLS])
+{
+    if (move < 1 || move > TTT_CELLS || board[move - 1] != move + '0') {
+        return false;
+    }
+    board[move - 1] = (player == 1) ? 'X' : 'O';
+    return true;
+}
+
+int ttt_winner(const char board[TTT_CELLS])
+{
+    unsigned x, o;
+    marks(board, &x, &o);
+    return winner_of(x, o);
+}
+
+int ttt_checkwin(char board[TTT_CELLS])
+{
+    unsigned x, o;
+    marks(board, &x, &o);
+    int winner = winner_of(x, o);
+    if (winner <= 0) {
+        return winner;
+    }
+
+    unsigned m = (winner == 1) ? x : o;
+    for (int l = 0; l < NLINES; ++l) {
+        if ((m & lines[l]) != lines[l])
+            continue;
+        for (int i = 0; i < TTT_CELLS; ++i) {
+            if (lines[l] & (1 << i))
+                board[i] |= 0x20;
+        }
+        break;
+    }
+    return winner;
+}
+
+void ttt_init_batch(char (*boards)[TTT_CELLS], size_t n)
+{
+    for (size_t b = 0; b < n; ++b) {
+        ttt_init(boards[b]);
+    }
+}
+
+size_t ttt_play_batch(char (*boards)[TTT_CELLS], int player, const int *moves,
+                      size_t n)
+{
+    size_t made = 0;
+    for (size_t b = 0; b < n; ++b) {
+        if (moves[b] != 0)
+            made += ttt_play(player, moves[b], boards[b]);
+    }
+    return made;
+}
+
+void ttt_winner_batch(const char (*boards)[TTT_CELLS], int *winners, size_t n)
+{
+    // masks first, then the lines of a whole chunk: that loop reads
+    // contiguous masks and is vectorized across boards
+    unsigned x[CHUNK], o[CHUNK];
+    for (size_t start = 0; start < n; start += CHUNK) {
+        size_t len = (n - start < CHUNK) ? n - start : CHUNK;
+        for (size_t b = 0; b < len; ++b) {
+            marks(boards[start + b], &x[b], &o[b]);
+        }
+        for (size_t b = 0; b < len; ++b) {
+            winners[start + b] = winner_lines(x[b], o[b]);
+        }
+    }
+}
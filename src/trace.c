@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define NBUCKETS 40 // log2 buckets of nanoseconds, up to ~18 minutes
+
+bool trace_sampling = false;
+
+static const char *stage_name[NSTAGES] = {
+    "recv", "lookup", "play", "engine", "log", "send",
+};
+
+static uint64_t stage_start[NSTAGES];
+static uint64_t stage_count[NSTAGES];
+static uint64_t stage_total[NSTAGES];
+static uint64_t stage_hist[NSTAGES][NBUCKETS];
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_sample_begin(enum Stage stage)
+{
+    stage_start[stage] = now_ns();
+}
+
+void trace_sample_end(enum Stage stage)
+{
+    uint64_t ns = now_ns() - stage_start[stage];
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= NBUCKETS)
+        bucket = NBUCKETS - 1;
+
+    stage_count[stage]++;
+    stage_total[stage] += ns;
+    stage_hist[stage][bucket]++;
+}
+
+void trace_report(FILE *f)
+{
+    if (!trace_sampling || !f) {
+        return;
+    }
+
+    fprintf(f, "\nPer-stage latency histograms (ns)\n");
+    for (int s = 0; s < NSTAGES; ++s) {
+        if (stage_count[s] == 0)
+            continue;
+
+        fprintf(f, "\n%s: count %llu, mean %llu ns\n", stage_name[s],
+                (unsigned long long)stage_count[s],
+                (unsigned long long)(stage_total[s] / stage_count[s]));
+
+        uint64_t max = 0;
+        for (int b = 0; b < NBUCKETS; ++b) {
+            if (stage_hist[s][b] > max)
+                max = stage_hist[s][b];
+        }
+        for (int b = 0; b < NBUCKETS; ++b) {
+            if (stage_hist[s][b] == 0)
+                continue;
+            uint64_t lo = b ? 1ULL << (b - 1) : 0;
+            int width = (int)(40 * stage_hist[s][b] / max);
+            fprintf(f, "  [%10llu, %10llu) %8llu |%.*s\n",
+                    (unsigned long long)lo, (unsigned long long)(1ULL << b),
+                    (unsigned long long)stage_hist[s][b], width,
+                    "****************************************");
+        }
+    }
+}
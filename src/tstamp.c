@@ -0,0 +1,302 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "tstamp.h"
+#include "game.h"
+
+#define NBUCKETS 40   // log2 buckets of nanoseconds, like the stage tracer
+#define PENDING  1024 // replies awaiting a transmit timestamp, power of 2
+
+// Spans measured from the kernel receive timestamp of a request
+enum Span
+{
+    SPAN_QUEUE, // until recvmsg returned it
+    SPAN_REPLY, // until sendto of its reply returned
+    SPAN_WIRE,  // until the kernel transmitted the reply
+    NSPANS
+};
+
+static const char *span_name[NSPANS] = {
+    "kernel receive to recvmsg",
+    "kernel receive to sendto return",
+    "kernel receive to kernel transmit",
+};
+
+struct hist
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint64_t buckets[NBUCKETS];
+};
+
+struct pending
+{
+    uint32_t id;    // counter of the datagram in the kernel
+    uint64_t rx_ns; // receive time of the request it answers, 0 if none
+};
+
+int tstamp_sockfd = -1;
+
+static enum TstampMode mode = TSTAMP_OFF;
+static struct hist spans[NSPANS];
+static uint64_t rx_ns;        // receive time of the request being served
+static uint32_t next_id;      // counter the kernel gives the next datagram
+static uint32_t outstanding;  // datagrams sent since the last reap
+static struct pending pending[PENDING];
+
+static struct
+{
+    uint64_t stamped;   // requests with a receive timestamp
+    uint64_t unstamped; // requests without, queued before -K took effect
+    uint64_t tx;        // transmit timestamps matched to a datagram
+    uint64_t unmatched; // transmit timestamps of a datagram no longer known
+} counts;
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record(enum Span span, uint64_t from, uint64_t to)
+{
+    // the realtime clock can step back under us
+    uint64_t ns = to > from ? to - from : 0;
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= NBUCKETS)
+        bucket = NBUCKETS - 1;
+
+    struct hist *h = &spans[span];
+    h->count++;
+    h->total += ns;
+    h->buckets[bucket]++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+/**
+ * Return the first timestamp of a SCM_TIMESTAMPNS or SCM_TIMESTAMPING
+ * message in @mh, the software one for the latter, 0 if there is none
+ */
+static uint64_t cmsg_time(struct msghdr *mh)
+{
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(mh); cmsg; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET
+            && (cmsg->cmsg_type == SCM_TIMESTAMPNS
+                || cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+enum TstampMode tstamp_mode(const char *name)
+{
+    if (strcmp(name, "timestampns") == 0)
+        return TSTAMP_NS;
+    if (strcmp(name, "timestamping") == 0)
+        return TSTAMP_ALL;
+    return TSTAMP_OFF;
+}
+
+int tstamp_enable(int sockfd, enum TstampMode m)
+{
+    // a socket taken over keeps the options of the old process, and only
+    // turning SOF_TIMESTAMPING_OPT_ID on anew restarts the kernel counter
+    int off = 0;
+    setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &off, sizeof(off));
+    setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &off, sizeof(off));
+
+    int rc;
+    if (m == TSTAMP_NS) {
+        int on = 1;
+        rc = setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    } else {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE
+            | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID
+            | SOF_TIMESTAMPING_OPT_TSONLY;
+        rc = setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+                        sizeof(flags));
+    }
+    if (rc < 0) {
+        errmsg("Unable to turn on kernel timestamps: %s\n", strerror(errno));
+        return -1;
+    }
+
+    tstamp_sockfd = sockfd;
+    mode = m;
+    next_id = 0;
+    outstanding = 0;
+    infomsg("Kernel timestamps on, %s\n",
+            m == TSTAMP_NS ? "SO_TIMESTAMPNS" : "SO_TIMESTAMPING");
+    return 0;
+}
+
+ssize_t tstamp_recv(int sockfd, void *buf, size_t len,
+                    struct sockaddr_in *addr, socklen_t *addr_len)
+{
+    char cbuf[CMSG_SPACE(3 * sizeof(struct timespec))];
+    struct iovec iov = { buf, len };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = addr;
+    mh.msg_namelen = *addr_len;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    ssize_t rc = recvmsg(sockfd, &mh, 0);
+    if (rc < 0) {
+        return rc;
+    }
+    *addr_len = mh.msg_namelen;
+
+    rx_ns = cmsg_time(&mh);
+    if (rx_ns) {
+        counts.stamped++;
+        record(SPAN_QUEUE, rx_ns, now_ns());
+    } else {
+        counts.unstamped++;
+    }
+    return rc;
+}
+
+void tstamp_sent()
+{
+    uint64_t rx = rx_ns;
+    if (rx) {
+        record(SPAN_REPLY, rx, now_ns());
+        rx_ns = 0;
+    }
+
+    if (mode == TSTAMP_ALL) {
+        pending[next_id % PENDING] = (struct pending){ next_id, rx };
+        next_id++;
+        outstanding++;
+    }
+}
+
+/**
+ * Read every transmit timestamp queued on the error queue so far
+ */
+static void drain()
+{
+    for (;;) {
+        char data[64];
+        char cbuf[256];
+        struct iovec iov = { data, sizeof(data) };
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+
+        if (recvmsg(tstamp_sockfd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        uint64_t tx = cmsg_time(&mh);
+        struct sock_extended_err ee = { 0 };
+        struct cmsghdr *cmsg;
+        for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6
+                    && cmsg->cmsg_type == IPV6_RECVERR)) {
+                memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+            }
+        }
+        if (!tx || ee.ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
+            continue;
+        }
+
+        const struct pending *p = &pending[ee.ee_data % PENDING];
+        if (p->id != ee.ee_data) {
+            counts.unmatched++;
+            continue;
+        }
+        counts.tx++;
+        if (p->rx_ns) {
+            record(SPAN_WIRE, p->rx_ns, tx);
+        }
+    }
+    outstanding = 0;
+}
+
+void tstamp_reap()
+{
+    rx_ns = 0;
+    // stamps the device has yet to take show up as POLLERR later on
+    if (mode == TSTAMP_ALL && outstanding > 0) {
+        drain();
+    }
+}
+
+void tstamp_error()
+{
+    // POLLERR stays up until the error queue is empty, whatever we expect
+    if (tstamp_sockfd >= 0) {
+        drain();
+    }
+}
+
+void tstamp_dump(FILE *f)
+{
+    if (mode == TSTAMP_OFF || !f) {
+        return;
+    }
+
+    fprintf(f, "\nKernel timestamps (%s), %llu requests stamped, %llu not",
+            mode == TSTAMP_NS ? "SO_TIMESTAMPNS" : "SO_TIMESTAMPING",
+            (unsigned long long)counts.stamped,
+            (unsigned long long)counts.unstamped);
+    if (mode == TSTAMP_ALL) {
+        fprintf(f, ", %llu datagrams stamped on transmit, %llu unmatched",
+                (unsigned long long)counts.tx,
+                (unsigned long long)counts.unmatched);
+    }
+    fprintf(f, "\n");
+
+    for (int s = 0; s < NSPANS; ++s) {
+        const struct hist *h = &spans[s];
+        if (h->count == 0)
+            continue;
+
+        fprintf(f, "\n%s: count %llu, mean %llu ns, max %llu ns\n",
+                span_name[s], (unsigned long long)h->count,
+                (unsigned long long)(h->total / h->count),
+                (unsigned long long)h->max);
+
+        uint64_t max = 0;
+        for (int b = 0; b < NBUCKETS; ++b) {
+            if (h->buckets[b] > max)
+                max = h->buckets[b];
+        }
+        for (int b = 0; b < NBUCKETS; ++b) {
+            if (h->buckets[b] == 0)
+                continue;
+            uint64_t lo = b ? 1ULL << (b - 1) : 0;
+            int width = (int)(40 * h->buckets[b] / max);
+            fprintf(f, "  [%10llu, %10llu) %8llu |%.*s\n",
+                    (unsigned long long)lo, (unsigned long long)(1ULL << b),
+                    (unsigned long long)h->buckets[b], width,
+                    "****************************************");
+        }
+    }
+}